@@ -5,106 +5,284 @@ typedef enum
 	TRACK_MODE,
 	SECTOR_MODE
 } DISK_SELECT_MODE;
-void writeSector(disk_t *pDisk, uint8_t drive_number);
-disks disk_drive;
+void writeSector(disks *drive, disk_t *pDisk, uint8_t drive_number);
 
-void set_status(uint8_t bit)
+void set_status(disks *drive, uint8_t bit)
 {
-	disk_drive.current->status &= (uint8_t)~bit;
+	drive->current->status &= (uint8_t)~bit;
 }
 
-void clear_status(uint8_t bit)
+void clear_status(disks *drive, uint8_t bit)
 {
-	disk_drive.current->status |= bit;
+	drive->current->status |= bit;
 }
 
-void disk_select(uint8_t b)
+/// <summary>
+/// Move the head. Image reads and writes all give the offset, so there is no file position to seek, only the
+/// pointer into the mapped sector to drop.
+/// </summary>
+static void seek_disk(disk_t *disk)
 {
-	uint8_t select         = b & 0xf;
-	disk_drive.currentDisk = select;
+#ifdef ALTAIR_DISK_MMAP
+	disk->sectorSource = NULL;
+#else
+	(void)disk;
+#endif // ALTAIR_DISK_MMAP
+}
+
+/// <summary>
+/// Write back batches finished so far, taken before a track read so the queue overlay knows what the read missed
+/// </summary>
+static uint32_t writeback_batches(disks *drive)
+{
+#ifdef ALTAIR_DISK_WRITEBACK
+	if (drive->writeback != NULL)
+	{
+		return disk_writeback_batches(drive->writeback);
+	}
+#else
+	(void)drive;
+#endif // ALTAIR_DISK_WRITEBACK
+	return 0;
+}
+
+#ifdef ALTAIR_DISK_IO_URING
+static track_prefetch_t *prefetch_for(disks *drive, disk_t *disk)
+{
+	return disk == &drive->disk1 ? &drive->prefetch[0] : disk == &drive->disk2 ? &drive->prefetch[1] : NULL;
+}
+
+/// <summary>
+/// Take finished track reads off the ring, with wait set until none are in flight. A kernel without
+/// IORING_OP_READ fails them all, the controller then goes back to pread.
+/// </summary>
+static void reap_prefetch(disks *drive, bool wait)
+{
+	bool unsupported = false;
+	uint64_t user_data;
+	int32_t result;
+
+	while (drive->uring->in_flight != 0 && disk_uring_complete(drive->uring, wait || unsupported, &user_data, &result))
+	{
+		track_prefetch_t *prefetch = &drive->prefetch[user_data];
+
+		prefetch->bytes = result > 0 ? (uint32_t)result : 0;
+		prefetch->state = prefetch->stale || result < 0 ? PREFETCH_IDLE : PREFETCH_DONE;
+		prefetch->stale = false;
+
+		if (result == -EINVAL || result == -EOPNOTSUPP)
+		{
+			unsupported = true;
+		}
+	}
+
+	if (unsupported)
+	{
+		Log_Debug("io_uring reads are not supported, reading disk tracks with pread\n");
+		drive->uring = NULL;
+	}
+}
+
+/// <summary>
+/// The head started reading the track at track_offset, start reading the next one in the direction it last stepped
+/// so it is in memory when the head gets there. CP/M reads files a track at a time in one direction.
+/// </summary>
+static void prefetch_next_track(disks *drive, disk_t *disk, uint32_t track_offset)
+{
+	track_prefetch_t *prefetch = prefetch_for(drive, disk);
+
+	if (drive->uring == NULL || prefetch == NULL || (drive->prefetch_step_out && track_offset == 0))
+	{
+		return;
+	}
+	track_offset = drive->prefetch_step_out ? track_offset - TRACK : track_offset + TRACK;
+#ifdef ALTAIR_DISK_MMAP
+	if (disk->image != NULL)
+	{
+		return;
+	}
+#endif
+
+	reap_prefetch(drive, false);
+
+	// One read per drive at a time
+	if (drive->uring == NULL || prefetch->state == PREFETCH_IN_FLIGHT ||
+		(prefetch->state == PREFETCH_DONE && prefetch->offset == track_offset) ||
+		(disk->trackBytes != 0 && disk->trackOffset == track_offset))
+	{
+		return;
+	}
+
+	prefetch->batches = writeback_batches(drive);
+
+	if (disk_uring_read(drive->uring, disk->fp, prefetch->data, TRACK, track_offset, prefetch == &drive->prefetch[0] ? 0 : 1))
+	{
+		prefetch->offset = track_offset;
+		prefetch->state	 = PREFETCH_IN_FLIGHT;
+		(*(int *)dt_filesystem_reads.propertyValue)++;
+	}
+	else
+	{
+		Log_Debug("io_uring submit failed, reading disk tracks with pread\n");
+		reap_prefetch(drive, true);
+		drive->uring = NULL;
+	}
+}
+
+/// <summary>
+/// Move a finished read ahead of track_offset into the track cache, with the write back batches finished when it
+/// was submitted
+/// </summary>
+static bool take_prefetch(disks *drive, disk_t *disk, uint32_t track_offset, uint32_t *batches)
+{
+	track_prefetch_t *prefetch = prefetch_for(drive, disk);
+
+	if (drive->uring == NULL || prefetch == NULL)
+	{
+		return false;
+	}
+
+	if (prefetch->state == PREFETCH_IN_FLIGHT)
+	{
+		reap_prefetch(drive, true);
+	}
+
+	if (prefetch->state != PREFETCH_DONE || prefetch->offset != track_offset)
+	{
+		return false;
+	}
+
+	memcpy(disk->trackData, prefetch->data, prefetch->bytes);
+	disk->trackBytes = prefetch->bytes;
+	prefetch->state	 = PREFETCH_IDLE;
+	*batches		 = prefetch->batches;
+	return true;
+}
+
+/// <summary>
+/// Keep a read ahead of the track the sector was written to in step with the file
+/// </summary>
+static void prefetch_sector_written(disks *drive, disk_t *disk, uint32_t disk_pointer, const uint8_t *sector_data)
+{
+	track_prefetch_t *prefetch = prefetch_for(drive, disk);
+	uint32_t sector_offset	   = disk_pointer % TRACK;
+
+	if (prefetch == NULL || prefetch->offset != disk_pointer - sector_offset)
+	{
+		return;
+	}
+
+	if (prefetch->state == PREFETCH_IN_FLIGHT)
+	{
+		prefetch->stale = true;
+	}
+	else if (prefetch->state == PREFETCH_DONE && sector_offset + SECTOR_SIZE <= prefetch->bytes)
+	{
+		memcpy(prefetch->data + sector_offset, sector_data, SECTOR_SIZE);
+	}
+}
+#endif // ALTAIR_DISK_IO_URING
+
+void disk_select(void *context, uint8_t b)
+{
+	disks *drive       = context;
+	uint8_t select     = b & 0xf;
+	drive->currentDisk = select;
 
 	switch (select)
 	{
 		case 0:
-			disk_drive.current = &disk_drive.disk1;
+			drive->current = &drive->disk1;
 			break;
 		case 1:
-			disk_drive.current = &disk_drive.disk2;
+			drive->current = &drive->disk2;
 			break;
 		default:
-			disk_drive.current     = &disk_drive.disk1;
-			disk_drive.currentDisk = 0;
+			drive->current     = &drive->disk1;
+			drive->currentDisk = 0;
 			break;
 	}
 }
 
-uint8_t disk_status()
+uint8_t disk_status(void *context)
 {
-	return disk_drive.current->status;
+	disks *drive = context;
+
+	return drive->current->status;
 }
 
-void disk_function(uint8_t b)
+void disk_function(void *context, uint8_t b)
 {
+	disks *drive = context;
+
 	if (b & CONTROL_STEP_IN)
 	{
-		disk_drive.current->track++;
-		disk_drive.current->sector = 0;
+		drive->current->track++;
+		drive->current->sector = 0;
 
-		if (disk_drive.current->track != 0)
+		if (drive->current->track != 0)
 		{
-			clear_status(STATUS_TRACK_0);
+			clear_status(drive, STATUS_TRACK_0);
 		}
 
-		uint32_t seek_offset = TRACK * disk_drive.current->track;
+		uint32_t seek_offset = TRACK * drive->current->track;
 
-		if (disk_drive.current->sectorDirty)
+		if (drive->current->sectorDirty)
 		{
-			writeSector(disk_drive.current, disk_drive.currentDisk);
+			writeSector(drive, drive->current, drive->currentDisk);
 		}
 
-		lseek(disk_drive.current->fp, seek_offset, SEEK_SET);
+		seek_disk(drive->current);
 
-		disk_drive.current->diskPointer    = seek_offset;
-		disk_drive.current->haveSectorData = false;
-		disk_drive.current->sectorPointer  = 0;
+		drive->current->diskPointer    = seek_offset;
+		drive->current->haveSectorData = false;
+		drive->current->sectorPointer  = 0;
+
+#ifdef ALTAIR_DISK_IO_URING
+		drive->prefetch_step_out = false;
+#endif
 	}
 
 	if (b & CONTROL_STEP_OUT)
 	{
-		if (disk_drive.current->track > 0)
+		if (drive->current->track > 0)
 		{
-			disk_drive.current->track--;
+			drive->current->track--;
 		}
 
-		if (disk_drive.current->track == 0)
+		if (drive->current->track == 0)
 		{
-			set_status(STATUS_TRACK_0);
+			set_status(drive, STATUS_TRACK_0);
 		}
 
-		disk_drive.current->sector = 0;
-		uint32_t seek_offset       = TRACK * disk_drive.current->track;
+		drive->current->sector = 0;
+		uint32_t seek_offset   = TRACK * drive->current->track;
 
-		if (disk_drive.current->sectorDirty)
+		if (drive->current->sectorDirty)
 		{
-			writeSector(disk_drive.current, disk_drive.currentDisk);
+			writeSector(drive, drive->current, drive->currentDisk);
 		}
 
-		lseek(disk_drive.current->fp, seek_offset, SEEK_SET);
+		seek_disk(drive->current);
+
+		drive->current->diskPointer    = seek_offset;
+		drive->current->haveSectorData = false;
+		drive->current->sectorPointer  = 0;
 
-		disk_drive.current->diskPointer    = seek_offset;
-		disk_drive.current->haveSectorData = false;
-		disk_drive.current->sectorPointer  = 0;
+#ifdef ALTAIR_DISK_IO_URING
+		drive->prefetch_step_out = true;
+#endif
 	}
 
 	if (b & CONTROL_HEAD_LOAD)
 	{
-		set_status(STATUS_HEAD);
-		set_status(STATUS_NRDA);
+		set_status(drive, STATUS_HEAD);
+		set_status(drive, STATUS_NRDA);
 	}
 
 	if (b & CONTROL_HEAD_UNLOAD)
 	{
-		clear_status(STATUS_HEAD);
+		clear_status(drive, STATUS_HEAD);
 	}
 
 	if (b & CONTROL_IE)
@@ -121,114 +299,258 @@ void disk_function(uint8_t b)
 
 	if (b & CONTROL_WE)
 	{
-		set_status(STATUS_ENWD);
-		disk_drive.current->write_status = 0;
+		set_status(drive, STATUS_ENWD);
+		drive->current->write_status = 0;
 	}
 }
 
-uint8_t sector()
+uint8_t sector(void *context)
 {
+	disks *drive = context;
 	uint32_t seek_offset;
 	uint8_t ret_val;
 
-	if (disk_drive.current->sector == 32)
+	if (drive->current->sector == 32)
 	{
-		disk_drive.current->sector = 0;
+		drive->current->sector = 0;
 	}
 
-	if (disk_drive.current->sectorDirty)
+	if (drive->current->sectorDirty)
 	{
-		writeSector(disk_drive.current, disk_drive.currentDisk);
+		writeSector(drive, drive->current, drive->currentDisk);
 	}
 
-	seek_offset = disk_drive.current->track * TRACK + disk_drive.current->sector * (SECTOR_SIZE);
-	disk_drive.current->sectorPointer = 0;
+	seek_offset = drive->current->track * TRACK + drive->current->sector * (SECTOR_SIZE);
+	drive->current->sectorPointer = 0;
 
-	lseek(disk_drive.current->fp, seek_offset, SEEK_SET);
+	seek_disk(drive->current);
 
-	disk_drive.current->diskPointer = seek_offset;
-	disk_drive.current->sectorPointer =
+	drive->current->diskPointer = seek_offset;
+	drive->current->sectorPointer =
 		0; // needs to be set here for write operation (read fetches sector data and resets the pointer).
-	disk_drive.current->haveSectorData = false;
+	drive->current->haveSectorData = false;
 
-	ret_val = (uint8_t)(disk_drive.current->sector << 1);
+	ret_val = (uint8_t)(drive->current->sector << 1);
 
-	disk_drive.current->sector++;
+	drive->current->sector++;
 	return ret_val;
 }
 
-void disk_write(uint8_t b)
+void disk_write(void *context, uint8_t b)
 {
-	disk_drive.current->sectorData[disk_drive.current->sectorPointer++] = b;
-	disk_drive.current->sectorDirty                                     = true;
+	disks *drive = context;
 
-	if (disk_drive.current->write_status == 137)
+	disk_copy_sector_data(drive->current);
+
+	drive->current->sectorData[drive->current->sectorPointer++] = b;
+	drive->current->sectorDirty                                 = true;
+
+	if (drive->current->write_status == 137)
 	{
 
-		writeSector(disk_drive.current, disk_drive.currentDisk);
+		writeSector(drive, drive->current, drive->currentDisk);
 
-		disk_drive.current->write_status = 0;
-		clear_status(STATUS_ENWD);
+		drive->current->write_status = 0;
+		clear_status(drive, STATUS_ENWD);
 	}
 	else
-		disk_drive.current->write_status++;
+		drive->current->write_status++;
+}
+
+/// <summary>
+/// Read the track at track_offset into the track cache. Returns the write back batches finished before the read.
+/// </summary>
+static uint32_t read_track(disks *drive, disk_t *disk, uint32_t track_offset)
+{
+	uint32_t batches = writeback_batches(drive);
+	ssize_t bytes	 = pread(disk->fp, disk->trackData, TRACK, track_offset);
+
+	disk->trackBytes = bytes > 0 ? (uint32_t)bytes : 0;
+	(*(int *)dt_filesystem_reads.propertyValue)++;
+	return batches;
 }
 
-uint8_t disk_read()
+/// <summary>
+/// Read the sector at diskPointer from the track cache, filling it with the whole track on a miss
+/// </summary>
+static void read_track_sector(disks *drive, disk_t *disk)
 {
-	uint16_t requested_sector_number = (uint16_t)(disk_drive.current->diskPointer / 137);
+	uint32_t track_offset  = disk->diskPointer - disk->diskPointer % TRACK;
+	uint32_t sector_offset = disk->diskPointer % TRACK;
+
+	disk->sectorPointer = 0;
 
-	if (!disk_drive.current->haveSectorData)
+	if (disk->trackBytes == 0 || disk->trackOffset != track_offset)
+	{
+		uint32_t batches;
+
+		disk->trackOffset = track_offset;
+
+#ifdef ALTAIR_DISK_IO_URING
+		if (!take_prefetch(drive, disk, track_offset, &batches))
+#endif // ALTAIR_DISK_IO_URING
+		{
+			batches = read_track(drive, disk, track_offset);
+		}
+
+#ifdef ALTAIR_DISK_IO_URING
+		prefetch_next_track(drive, disk, track_offset);
+#endif // ALTAIR_DISK_IO_URING
+
+#ifdef ALTAIR_DISK_WRITEBACK
+		// A batch that landed while the track was read can be in neither the track nor the queue, read it again
+		while (drive->writeback != NULL && !disk_writeback_overlay(drive->writeback, disk->fp, track_offset,
+											   disk->trackData, disk->trackBytes, batches))
+		{
+			batches = read_track(drive, disk, track_offset);
+		}
+#else
+		(void)batches;
+#endif // ALTAIR_DISK_WRITEBACK
+		(*(int *)dt_track_cache_misses.propertyValue)++;
+	}
+	else
+	{
+		(*(int *)dt_track_cache_hits.propertyValue)++;
+	}
+
+	if (sector_offset + SECTOR_SIZE > disk->trackBytes)
+	{
+		Log_Debug("Sector read failed. Offset %u is past the end of the disk image\n", disk->diskPointer);
+		memset(disk->sectorData, 0x00, SECTOR_SIZE);
+		disk->haveSectorData = false;
+		return;
+	}
+
+	memcpy(disk->sectorData, disk->trackData + sector_offset, SECTOR_SIZE);
+	disk->haveSectorData = true;
+}
+
+#ifdef ALTAIR_DISK_MMAP
+/// <summary>
+/// Zero copy sector read, point the read pointer at the sector in the mapped image
+/// </summary>
+static void read_mapped_sector(disk_t *disk)
+{
+	disk->sectorPointer = 0;
+
+	if (disk->diskPointer + SECTOR_SIZE <= disk->imageSize)
+	{
+		disk->sectorSource   = disk->image + disk->diskPointer;
+		disk->haveSectorData = true;
+	}
+	else
+	{
+		Log_Debug("Sector read failed. Offset %u is past the end of the disk image\n", disk->diskPointer);
+		memset(disk->sectorData, 0x00, SECTOR_SIZE);
+	}
+	(*(int *)dt_mapped_reads.propertyValue)++;
+}
+#endif // ALTAIR_DISK_MMAP
+
+uint8_t disk_read(void *context)
+{
+	disks *drive                     = context;
+	uint16_t requested_sector_number = (uint16_t)(drive->current->diskPointer / 137);
+
+	if (!drive->current->haveSectorData)
 	{
 
 #ifdef ALTAIR_CLOUD
-		disk_drive.current->sectorPointer = 0;
+		drive->current->sectorPointer = 0;
 
 		uint8_t *sector =
-			find_in_cache(disk_drive.current == &disk_drive.disk1 ? 0 : 1, requested_sector_number);
+			find_in_cache(&drive->difference_disk, drive->current == &drive->disk1 ? 0 : 1, requested_sector_number);
 		if (sector)
 		{
-			disk_drive.current->haveSectorData = true;
-			memset(disk_drive.current->sectorData, 0x00, SECTOR_SIZE);
-			memcpy(disk_drive.current->sectorData, sector, SECTOR_SIZE);
+			drive->current->haveSectorData = true;
+			memset(drive->current->sectorData, 0x00, SECTOR_SIZE);
+			memcpy(drive->current->sectorData, sector, SECTOR_SIZE);
 			(*(int *)dt_difference_disk_reads.propertyValue)++;
 		}
 #endif // ALTAIR_CLOUD
 
-		if (!disk_drive.current->haveSectorData)
+#ifdef ALTAIR_DISK_MMAP
+		if (!drive->current->haveSectorData && drive->current->image != NULL)
 		{
-			disk_drive.current->sectorPointer = 0;
-			memset(disk_drive.current->sectorData, 0x00, SECTOR_SIZE);
-			ssize_t bytes = read(disk_drive.current->fp, disk_drive.current->sectorData, SECTOR_SIZE);
-
-			if (bytes != SECTOR_SIZE)
-			{
-				Log_Debug("Sector read failed. Read %d\n", bytes);
-			}
-			(*(int *)dt_filesystem_reads.propertyValue)++;
-			disk_drive.current->haveSectorData = SECTOR_SIZE == bytes;
+			read_mapped_sector(drive->current);
+		}
+		else
+#endif // ALTAIR_DISK_MMAP
+		if (!drive->current->haveSectorData)
+		{
+			read_track_sector(drive, drive->current);
 		}
 	}
 
-	return disk_drive.current->sectorData[disk_drive.current->sectorPointer++];
+#ifdef ALTAIR_DISK_MMAP
+	if (drive->current->sectorSource != NULL && drive->current->sectorPointer < SECTOR_SIZE)
+	{
+		return drive->current->sectorSource[drive->current->sectorPointer++];
+	}
+#endif // ALTAIR_DISK_MMAP
+
+	return drive->current->sectorData[drive->current->sectorPointer++];
 }
 
-void writeSector(disk_t *pDisk, uint8_t drive_number)
+void writeSector(disks *drive, disk_t *pDisk, uint8_t drive_number)
 {
 	uint16_t requested_sector_number = (uint16_t)(pDisk->diskPointer / SECTOR_SIZE);
 
 #ifdef ALTAIR_CLOUD
 
-	add_to_cache(disk_drive.current == &disk_drive.disk1 ? 0 : 1, requested_sector_number, pDisk->sectorData);
+	add_to_cache(&drive->difference_disk, drive->current == &drive->disk1 ? 0 : 1, requested_sector_number, pDisk->sectorData);
 	(*(int *)dt_difference_disk_writes.propertyValue)++;
 
-#else
+#ifdef ALTAIR_DIFFERENCE_JOURNAL
+	if (drive->journal != NULL)
+	{
+		disk_journal_append(drive->journal, drive->current == &drive->disk1 ? 0 : 1, requested_sector_number, pDisk->sectorData);
+	}
+#endif
 
-	ssize_t bytes = write(pDisk->fp, pDisk->sectorData, SECTOR_SIZE);
+#else
 
-	if (bytes != SECTOR_SIZE)
+#ifdef ALTAIR_DISK_MMAP
+	if (pDisk->image != NULL)
 	{
-		Log_Debug("Sector write failed. Wrote %d\n", bytes);
+		// The page cache writes the mapping back to the image file, no syscall per sector
+		if (pDisk->diskPointer + SECTOR_SIZE <= pDisk->imageSize)
+		{
+			memcpy(pDisk->image + pDisk->diskPointer, pDisk->sectorData, SECTOR_SIZE);
+		}
+		else
+		{
+			Log_Debug("Sector write failed. Offset %u is past the end of the disk image\n", pDisk->diskPointer);
+		}
+	}
+	else
+#endif // ALTAIR_DISK_MMAP
+	{
+#ifdef ALTAIR_DISK_WRITEBACK
+		// Hand the sector to the I/O thread rather than stall the CPU on storage
+		if (drive->writeback == NULL ||
+			!disk_writeback_queue(drive->writeback, pDisk->fp, pDisk->diskPointer, pDisk->sectorData))
+#endif // ALTAIR_DISK_WRITEBACK
+		{
+			ssize_t bytes = pwrite(pDisk->fp, pDisk->sectorData, SECTOR_SIZE, pDisk->diskPointer);
+
+			if (bytes != SECTOR_SIZE)
+			{
+				Log_Debug("Sector write failed. Wrote %d\n", bytes);
+			}
+		}
+
+		// Write through to the track cache so reads see the new sector
+		uint32_t sector_offset = pDisk->diskPointer % TRACK;
+		if (pDisk->diskPointer - sector_offset == pDisk->trackOffset && sector_offset + SECTOR_SIZE <= pDisk->trackBytes)
+		{
+			memcpy(pDisk->trackData + sector_offset, pDisk->sectorData, SECTOR_SIZE);
+		}
+
+#ifdef ALTAIR_DISK_IO_URING
+		prefetch_sector_written(drive, pDisk, pDisk->diskPointer, pDisk->sectorData);
+#endif // ALTAIR_DISK_IO_URING
 	}
 
 #endif // ALTAIR_CLOUD
@@ -237,7 +559,87 @@ void writeSector(disk_t *pDisk, uint8_t drive_number)
 	pDisk->sectorDirty   = false;
 }
 
-void clear_difference_disk(void)
+void clear_difference_disk(disks *drive)
 {
-	delete_all();
+	delete_all(&drive->difference_disk);
+}
+
+/// <summary>
+/// Make sectorData hold the sector being read, so the disk state can be copied or written to
+/// </summary>
+void disk_copy_sector_data(disk_t *disk)
+{
+#ifdef ALTAIR_DISK_MMAP
+	if (disk->sectorSource != NULL)
+	{
+		memcpy(disk->sectorData, disk->sectorSource, SECTOR_SIZE);
+		disk->sectorSource = NULL;
+	}
+#endif // ALTAIR_DISK_MMAP
+}
+
+/// <summary>
+/// Put a drive back to saved state, keeping the open image file and mapping
+/// </summary>
+void disk_restore_state(disk_t *disk, const disk_t *saved)
+{
+	int fp = disk->fp;
+#ifdef ALTAIR_DISK_MMAP
+	uint8_t *image	 = disk->image;
+	size_t imageSize = disk->imageSize;
+#endif
+
+	*disk = *saved;
+	disk_copy_sector_data(disk);
+	disk->fp		 = fp;
+	disk->trackBytes = 0; // the cached track may be stale, read it again
+
+#ifdef ALTAIR_DISK_MMAP
+	disk->image		= image;
+	disk->imageSize = imageSize;
+#endif
+	seek_disk(disk);
+}
+
+#ifdef ALTAIR_DISK_MMAP
+/// <summary>
+/// Map the open image file so sector reads come from memory, writable maps are shared with the file
+/// </summary>
+bool disk_map_image(disk_t *disk, bool writable)
+{
+	struct stat image_stat;
+
+	if (fstat(disk->fp, &image_stat) == -1 || image_stat.st_size == 0)
+	{
+		return false;
+	}
+
+	void *image = mmap(NULL, (size_t)image_stat.st_size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED,
+		disk->fp, 0);
+	if (image == MAP_FAILED)
+	{
+		Log_Debug("Failed to map disk image. Error: %s\n", strerror(errno));
+		return false;
+	}
+
+	madvise(image, (size_t)image_stat.st_size, MADV_WILLNEED);
+
+	disk->image			= image;
+	disk->imageSize		= (size_t)image_stat.st_size;
+	disk->sectorSource	= NULL;
+	disk->haveSectorData = false;
+	return true;
+}
+
+void disk_unmap_image(disk_t *disk)
+{
+	if (disk->image != NULL)
+	{
+		msync(disk->image, disk->imageSize, MS_SYNC);
+		munmap(disk->image, disk->imageSize);
+		disk->image		   = NULL;
+		disk->imageSize	   = 0;
+		disk->sectorSource = NULL;
+	}
 }
+#endif // ALTAIR_DISK_MMAP
@@ -15,6 +15,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+
+#ifdef ALTAIR_DISK_IO_URING
+#include "disk_uring.h"
+#endif
+
+#ifdef ALTAIR_DISK_WRITEBACK
+#include "disk_writeback.h"
+#endif
+
+#ifdef ALTAIR_DIFFERENCE_JOURNAL
+#include "disk_journal.h"
+#endif
+
+#ifdef ALTAIR_DISK_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 #include <unistd.h>
 
 #define STATUS_ENWD			1
@@ -48,8 +65,36 @@ typedef struct
 	uint8_t sectorData[SECTOR_SIZE + 2];
 	bool sectorDirty;
 	bool haveSectorData;
+	uint8_t trackData[TRACK]; // whole track read ahead on the first sector read from it
+	uint32_t trackOffset;	  // image offset of the track in trackData
+	uint32_t trackBytes;	  // bytes of trackData filled, 0 when no track is cached
+#ifdef ALTAIR_DISK_MMAP
+	uint8_t *image;				 // whole disk image mapped by disk_map_image, NULL to go through fp
+	size_t imageSize;
+	const uint8_t *sectorSource; // sector being read straight from image, NULL when it is in sectorData
+#endif
 } disk_t;
 
+#ifdef ALTAIR_DISK_IO_URING
+typedef enum
+{
+	PREFETCH_IDLE,
+	PREFETCH_IN_FLIGHT,
+	PREFETCH_DONE
+} PREFETCH_STATE;
+
+// Track read ahead on the ring, taken into trackData by the first read from it
+typedef struct
+{
+	uint8_t data[TRACK];
+	uint32_t offset;
+	uint32_t bytes;
+	PREFETCH_STATE state;
+	bool stale;		  // a sector of the track was written while the read was in flight, drop the read when it lands
+	uint32_t batches; // write back batches finished when the read was submitted
+} track_prefetch_t;
+#endif // ALTAIR_DISK_IO_URING
+
 typedef struct
 {
 	disk_t disk1;
@@ -57,20 +102,43 @@ typedef struct
 	disk_t nodisk;
 	disk_t *current;
 	uint8_t currentDisk;
+	difference_disk_t difference_disk; // sectors written since the session started, ALTAIR_CLOUD only
+#ifdef ALTAIR_DISK_IO_URING
+	disk_uring_t *uring;		  // reads tracks ahead of the CPU, NULL reads them with pread when needed
+	track_prefetch_t prefetch[2]; // for disk1 and disk2
+	bool prefetch_step_out;		  // last head step was out, read ahead the track below
+#endif
+#ifdef ALTAIR_DISK_WRITEBACK
+	disk_writeback_t *writeback; // I/O thread writing sectors to the image files, NULL writes them in place
+#endif
+#ifdef ALTAIR_DIFFERENCE_JOURNAL
+	disk_journal_t *journal; // keeps differencing disk writes across restarts, NULL until the golden image is taken
+#endif
 } disks;
 
-extern disks disk_drive;
 extern DX_DEVICE_TWIN_BINDING dt_difference_disk_reads;
 extern DX_DEVICE_TWIN_BINDING dt_difference_disk_writes;
 extern DX_DEVICE_TWIN_BINDING dt_filesystem_reads;
+extern DX_DEVICE_TWIN_BINDING dt_mapped_reads;
+extern DX_DEVICE_TWIN_BINDING dt_track_cache_hits;
+extern DX_DEVICE_TWIN_BINDING dt_track_cache_misses;
+
+// Disk controller callbacks, the context is the machine's disks
+void disk_select(void *context, uint8_t b);
+uint8_t disk_status(void *context);
+void disk_function(void *context, uint8_t b);
+uint8_t sector(void *context);
+void disk_write(void *context, uint8_t b);
+uint8_t disk_read(void *context);
+void clear_difference_disk(disks *drive);
 
-void disk_select(uint8_t b);
-uint8_t disk_status(void);
-void disk_function(uint8_t b);
-uint8_t sector(void);
-void disk_write(uint8_t b);
-uint8_t disk_read(void);
-void clear_difference_disk(void);
+void disk_restore_state(disk_t *disk, const disk_t *saved);
+void disk_copy_sector_data(disk_t *disk);
+
+#ifdef ALTAIR_DISK_MMAP
+bool disk_map_image(disk_t *disk, bool writable);
+void disk_unmap_image(disk_t *disk);
+#endif
 
 
 #endif
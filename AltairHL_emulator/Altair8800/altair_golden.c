@@ -0,0 +1,102 @@
+#include "altair_golden.h"
+#include <string.h>
+
+#define GOLDEN_PAGE_SIZE 256
+
+/// <summary>
+/// Take the machine as the golden image. Call once, with the machine between slices. Sectors the machine has
+/// written move into the image and the machine reads them through its base layer from then on.
+/// </summary>
+bool altair_golden_capture(altair_golden_t *golden, altair_machine_t *machine)
+{
+	intel8080_t *cpu = &machine->cpu;
+	disks *drive	 = &machine->disk_drive;
+
+	if (atomic_load(&golden->ready))
+	{
+		return false;
+	}
+
+	altair_cpu_state_save(&golden->cpu, cpu);
+
+	memcpy(golden->ram, machine->memory.ram, sizeof(golden->ram));
+	for (int page = 0; page < 256; page++)
+	{
+		golden->rom_pages[page] = machine->memory.page_flags[page] & PAGE_ROM;
+	}
+
+	disk_copy_sector_data(&drive->disk1);
+	disk_copy_sector_data(&drive->disk2);
+	golden->drives[0]	 = drive->disk1;
+	golden->drives[1]	 = drive->disk2;
+	golden->current_disk = drive->currentDisk;
+	golden->current		 = drive->current == &drive->disk1	  ? 0
+						   : drive->current == &drive->disk2  ? 1
+						   : drive->current == &drive->nodisk ? 2
+															  : -1;
+
+	// The golden image takes the machine's sectors and the machine starts an empty layer over them
+	golden->difference_disk		 = drive->difference_disk;
+	golden->difference_disk.base = NULL;
+	memset(&drive->difference_disk, 0x00, sizeof(difference_disk_t));
+	drive->difference_disk.base = &golden->difference_disk;
+
+	atomic_store(&golden->ready, true);
+	return true;
+}
+
+/// <summary>
+/// Put the machine back to the golden image, keeping its disk image files and host callbacks. The machine must be
+/// stopped. Returns false, leaving the machine alone, when no image has been captured yet.
+/// </summary>
+bool altair_golden_clone(altair_golden_t *golden, altair_machine_t *machine)
+{
+	intel8080_t *cpu  = &machine->cpu;
+	disks *drive	  = &machine->disk_drive;
+	bool ram_restored = false;
+
+	if (!atomic_load(&golden->ready))
+	{
+		return false;
+	}
+
+	altair_cpu_state_restore(cpu, &golden->cpu);
+
+	// Most of a session's RAM still matches the image, only copy back the pages it changed
+	for (size_t offset = 0; offset < sizeof(golden->ram); offset += GOLDEN_PAGE_SIZE)
+	{
+		if (memcmp(machine->memory.ram + offset, golden->ram + offset, GOLDEN_PAGE_SIZE) != 0)
+		{
+			memcpy(machine->memory.ram + offset, golden->ram + offset, GOLDEN_PAGE_SIZE);
+			ram_restored = true;
+		}
+	}
+
+	memory_clear_page_flags(&machine->memory, PAGE_ROM);
+	for (int page = 0; page < 256; page++)
+	{
+		memory_set_page_flags(&machine->memory, (uint8_t)page, golden->rom_pages[page]);
+	}
+
+#ifdef ALTAIR_BLOCK_CACHE
+	if (ram_restored)
+	{
+		block_cache_flush(&machine->block_cache);
+	}
+#else
+	(void)ram_restored;
+#endif
+
+	disk_restore_state(&drive->disk1, &golden->drives[0]);
+	disk_restore_state(&drive->disk2, &golden->drives[1]);
+	drive->currentDisk = golden->current_disk;
+	drive->current	   = golden->current == 0	? &drive->disk1
+						 : golden->current == 1 ? &drive->disk2
+						 : golden->current == 2 ? &drive->nodisk
+												: NULL;
+
+	delete_all(&drive->difference_disk);
+	drive->difference_disk.base = &golden->difference_disk;
+
+	return true;
+}
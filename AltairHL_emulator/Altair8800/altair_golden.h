@@ -0,0 +1,30 @@
+#ifndef _ALTAIR_GOLDEN_H_
+#define _ALTAIR_GOLDEN_H_
+
+#include "altair_machine.h"
+#include "types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// A machine captured once at a ready state, e.g. booted to the CP/M prompt, that sessions are cloned from.
+// Its differencing disk becomes the read only base layer of every clone, so a session only holds the sectors it
+// writes itself, and resetting a clone copies back just the RAM pages that changed.
+typedef struct
+{
+	atomic_bool ready;
+
+	altair_cpu_state_t cpu;
+
+	uint8_t ram[64 * 1024];
+	uint8_t rom_pages[256];
+
+	disk_t drives[2];
+	int current; // 0 or 1 for the drives, 2 for no disk, -1 for none selected
+	uint8_t current_disk;
+	difference_disk_t difference_disk;
+} altair_golden_t;
+
+bool altair_golden_capture(altair_golden_t *golden, altair_machine_t *machine);
+bool altair_golden_clone(altair_golden_t *golden, altair_machine_t *machine);
+
+#endif
@@ -0,0 +1,81 @@
+#include "altair_machine.h"
+#include <string.h>
+
+/// <summary>
+/// Reset the machine with cleared memory and its disk controller wired to its own drives, disk images are opened by the host
+/// </summary>
+void altair_machine_init(altair_machine_t *machine, void *context, port_in terminal_in, port_out terminal_out,
+	read_sense_switches sense, azure_sphere_port_in port_in, azure_sphere_port_out port_out)
+{
+	disk_controller_t disk_controller = {
+		.context	   = &machine->disk_drive,
+		.disk_function = disk_function,
+		.disk_select   = disk_select,
+		.disk_status   = disk_status,
+		.read		   = disk_read,
+		.write		   = disk_write,
+		.sector		   = sector,
+	};
+
+	memory_init(&machine->memory);
+	memset(&machine->disk_drive, 0x00, sizeof(machine->disk_drive));
+
+#ifdef ALTAIR_BLOCK_CACHE
+	block_cache_init(&machine->block_cache, &machine->memory);
+#endif
+
+	i8080_reset(&machine->cpu, &machine->memory, context, terminal_in, terminal_out, sense, &disk_controller, port_in,
+		port_out);
+}
+
+/// <summary>
+/// Clear RAM and drop ROM pages ahead of loading a new image
+/// </summary>
+void altair_machine_clear_memory(altair_machine_t *machine)
+{
+	memset(machine->memory.ram, 0x00, sizeof(machine->memory.ram));
+	memory_clear_page_flags(&machine->memory, PAGE_ROM);
+}
+
+/// <summary>
+/// Copy out the CPU state a snapshot or golden image keeps, the machine must not be running
+/// </summary>
+void altair_cpu_state_save(altair_cpu_state_t *state, intel8080_t *cpu)
+{
+	state->registers		   = cpu->registers;
+	state->flags_result		   = cpu->flags_result;
+	state->cycles			   = cpu->cycles;
+	state->halted			   = cpu->halted;
+	state->interrupt_enable	   = cpu->interrupt_enable;
+	state->serial_rx_interrupt = cpu->serial_rx_interrupt;
+	state->interrupt_request   = cpu->interrupt_request;
+	state->serial_rx_character = cpu->serial_rx_character;
+	state->cpu_status		   = cpu->cpuStatus;
+	state->address_bus		   = cpu->address_bus;
+	state->data_bus			   = cpu->data_bus;
+	state->current_op_code	   = cpu->current_op_code;
+}
+
+/// <summary>
+/// Put the CPU back to a saved state with the idle detection reset, the machine must not be running
+/// </summary>
+void altair_cpu_state_restore(intel8080_t *cpu, const altair_cpu_state_t *state)
+{
+	cpu->registers			 = state->registers;
+	cpu->flags_result		 = state->flags_result;
+	cpu->cycles				 = state->cycles;
+	cpu->run_until			 = state->cycles;
+	cpu->halted				 = state->halted;
+	cpu->interrupt_enable	 = state->interrupt_enable;
+	cpu->serial_rx_interrupt = state->serial_rx_interrupt;
+	cpu->interrupt_request	 = state->interrupt_request;
+	cpu->serial_rx_character = state->serial_rx_character;
+	cpu->cpuStatus			 = state->cpu_status;
+	cpu->address_bus		 = state->address_bus;
+	cpu->data_bus			 = state->data_bus;
+	cpu->current_op_code	 = state->current_op_code;
+	cpu->idle				 = false;
+	cpu->idle_polls			 = 0;
+	cpu->idle_poll_pc		 = 0;
+	cpu->idle_poll_cycles	 = 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _ALTAIR_MACHINE_H_
+#define _ALTAIR_MACHINE_H_
+
+#include "88dcdd.h"
+#include "intel8080.h"
+#include "memory.h"
+#include "types.h"
+
+#ifdef ALTAIR_BLOCK_CACHE
+#include "block_cache.h"
+#endif
+
+// One Altair: CPU, 64K of memory and the 88-DCDD disk controller, each host callback gets the context the machine
+// was created with. The console and the io_ports.c ports are still process globals wired to the one machine named
+// altair: the terminal buffers, the port 29 and 30 delay timers and the RST 7 they raise, and the web request and
+// COPYX state. So a process runs a single machine, see ALTAIR_MAX_MACHINES.
+typedef struct
+{
+	intel8080_t cpu;
+	memory_t memory;
+	disks disk_drive;
+
+#ifdef ALTAIR_BLOCK_CACHE
+	block_cache_t block_cache;
+#endif
+} altair_machine_t;
+
+// The CPU state a snapshot or golden image keeps, the rest of intel8080_t is wiring to the machine and host
+typedef struct
+{
+	registers_t registers;
+	uint16_t flags_result;
+	uint64_t cycles;
+	bool halted;
+	bool interrupt_enable;
+	bool serial_rx_interrupt;
+	uint8_t interrupt_request;
+	uint8_t serial_rx_character;
+	uint8_t cpu_status;
+	uint16_t address_bus;
+	uint8_t data_bus;
+	uint8_t current_op_code;
+} altair_cpu_state_t;
+
+void altair_machine_init(altair_machine_t *machine, void *context, port_in terminal_in, port_out terminal_out,
+	read_sense_switches sense, azure_sphere_port_in port_in, azure_sphere_port_out port_out);
+void altair_machine_clear_memory(altair_machine_t *machine);
+void altair_cpu_state_save(altair_cpu_state_t *state, intel8080_t *cpu);
+void altair_cpu_state_restore(intel8080_t *cpu, const altair_cpu_state_t *state);
+
+#endif
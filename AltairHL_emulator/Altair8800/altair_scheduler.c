@@ -0,0 +1,515 @@
+#include "altair_scheduler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef ALTAIR_BLOCK_CACHE
+#include "block_cache.h"
+#endif
+
+#define NS_PER_MS	1000000ULL
+#define NO_UNPARK	UINT64_MAX
+
+static uint64_t scheduler_now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000 * NS_PER_MS + (uint64_t)now.tv_nsec;
+}
+
+/// <summary>
+/// Free the run queues of the first workers workers and the machines, then the locks, which are always created first
+/// </summary>
+static void scheduler_free(altair_scheduler_t *scheduler, int workers)
+{
+	for (int i = 0; i < workers; i++)
+	{
+		pthread_mutex_destroy(&scheduler->workers[i].lock);
+		free(scheduler->workers[i].queue);
+		scheduler->workers[i].queue = NULL;
+	}
+
+	free(scheduler->machines);
+	scheduler->machines = NULL;
+
+	pthread_cond_destroy(&scheduler->idle_cond);
+	pthread_mutex_destroy(&scheduler->idle_lock);
+	pthread_mutex_destroy(&scheduler->unpark_lock);
+}
+
+/// <summary>
+/// Create the workers and their run queues, workers <= 0 uses one worker per online host core.
+/// Returns false with nothing left allocated when out of memory.
+/// </summary>
+bool altair_scheduler_init(altair_scheduler_t *scheduler, int workers, int max_machines, uint32_t slice_cycles)
+{
+	pthread_condattr_t idle_cond_attr;
+
+	memset(scheduler, 0x00, sizeof(altair_scheduler_t));
+
+	if (workers <= 0)
+	{
+		long cores = sysconf(_SC_NPROCESSORS_ONLN);
+		workers	   = cores > 0 ? (int)cores : 1;
+	}
+	if (workers > SCHEDULER_MAX_WORKERS)
+	{
+		workers = SCHEDULER_MAX_WORKERS;
+	}
+
+	scheduler->worker_count		= workers;
+	scheduler->machine_capacity = max_machines;
+	scheduler->slice_cycles		= slice_cycles;
+
+	pthread_condattr_init(&idle_cond_attr);
+	pthread_condattr_setclock(&idle_cond_attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&scheduler->idle_cond, &idle_cond_attr);
+	pthread_condattr_destroy(&idle_cond_attr);
+
+	pthread_mutex_init(&scheduler->idle_lock, NULL);
+	pthread_mutex_init(&scheduler->unpark_lock, NULL);
+	atomic_store(&scheduler->next_unpark_ns, NO_UNPARK);
+
+	if ((scheduler->machines = calloc((size_t)max_machines, sizeof(scheduled_machine_t))) == NULL)
+	{
+		scheduler_free(scheduler, 0);
+		return false;
+	}
+
+	for (int i = 0; i < workers; i++)
+	{
+		scheduler_worker_t *worker = &scheduler->workers[i];
+
+		if ((worker->queue = calloc((size_t)max_machines, sizeof(scheduled_machine_t *))) == NULL)
+		{
+			scheduler_free(scheduler, i);
+			return false;
+		}
+		pthread_mutex_init(&worker->lock, NULL);
+		worker->scheduler = scheduler;
+		worker->index	  = i;
+	}
+
+	return true;
+}
+
+/// <summary>
+/// Append a machine to a worker's run queue and wake a sleeping worker to run or steal it. A worker putting back
+/// the machine it just ran only wakes another when it has more queued than that machine.
+/// </summary>
+static void worker_push(scheduler_worker_t *worker, scheduled_machine_t *machine, bool requeue)
+{
+	altair_scheduler_t *scheduler = worker->scheduler;
+	int count;
+
+	pthread_mutex_lock(&worker->lock);
+	worker->queue[(worker->head + worker->count) % scheduler->machine_capacity] = machine;
+	count = ++worker->count;
+	pthread_mutex_unlock(&worker->lock);
+
+	atomic_fetch_add(&scheduler->queued, 1);
+
+	if (atomic_load(&scheduler->idle_workers) > 0 && (!requeue || count > 1))
+	{
+		pthread_mutex_lock(&scheduler->idle_lock);
+		pthread_cond_signal(&scheduler->idle_cond);
+		pthread_mutex_unlock(&scheduler->idle_lock);
+	}
+}
+
+static scheduled_machine_t *worker_pop(scheduler_worker_t *worker)
+{
+	altair_scheduler_t *scheduler = worker->scheduler;
+	scheduled_machine_t *machine  = NULL;
+
+	pthread_mutex_lock(&worker->lock);
+	if (worker->count)
+	{
+		machine		 = worker->queue[worker->head];
+		worker->head = (worker->head + 1) % scheduler->machine_capacity;
+		worker->count--;
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	if (machine)
+	{
+		atomic_fetch_sub(&scheduler->queued, 1);
+	}
+	return machine;
+}
+
+/// <summary>
+/// Take the most recently queued machine from the first other worker that has one
+/// </summary>
+static scheduled_machine_t *worker_steal(scheduler_worker_t *thief)
+{
+	altair_scheduler_t *scheduler = thief->scheduler;
+
+	for (int i = 1; i < scheduler->worker_count; i++)
+	{
+		scheduler_worker_t *victim	 = &scheduler->workers[(thief->index + i) % scheduler->worker_count];
+		scheduled_machine_t *machine = NULL;
+
+		pthread_mutex_lock(&victim->lock);
+		if (victim->count)
+		{
+			victim->count--;
+			machine = victim->queue[(victim->head + victim->count) % scheduler->machine_capacity];
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if (machine)
+		{
+			atomic_fetch_sub(&scheduler->queued, 1);
+			return machine;
+		}
+	}
+	return NULL;
+}
+
+static void scheduler_lower_unpark(altair_scheduler_t *scheduler, uint64_t until)
+{
+	uint_fast64_t next = atomic_load(&scheduler->next_unpark_ns);
+
+	while (until < next && !atomic_compare_exchange_weak(&scheduler->next_unpark_ns, &next, until))
+	{
+	}
+}
+
+/// <summary>
+/// Queue every parked machine whose park time has passed, one worker scans while the others carry on
+/// </summary>
+static void scheduler_unpark_due(altair_scheduler_t *scheduler, uint64_t now)
+{
+	uint64_t next = NO_UNPARK;
+
+	if (now < atomic_load(&scheduler->next_unpark_ns) || pthread_mutex_trylock(&scheduler->unpark_lock) != 0)
+	{
+		return;
+	}
+
+	atomic_store(&scheduler->next_unpark_ns, NO_UNPARK);
+
+	for (int i = 0; i < atomic_load(&scheduler->machine_count); i++)
+	{
+		scheduled_machine_t *machine = &scheduler->machines[i];
+		MACHINE_STATE parked		 = MACHINE_PARKED;
+		uint64_t until;
+
+		if (atomic_load(&machine->state) != MACHINE_PARKED)
+		{
+			continue;
+		}
+
+		// Read once, a wake may run and park the machine again meanwhile. A stale time at worst unparks it
+		// early, for one extra slice.
+		if ((until = atomic_load(&machine->park_until_ns)) > now)
+		{
+			next = until < next ? until : next;
+		}
+		else if (atomic_compare_exchange_strong(&machine->state, &parked, MACHINE_QUEUED))
+		{
+			worker_push(&scheduler->workers[machine->worker], machine, false);
+		}
+	}
+
+	scheduler_lower_unpark(scheduler, next);
+	pthread_mutex_unlock(&scheduler->unpark_lock);
+}
+
+/// <summary>
+/// Take the machine off the run queues until it is woken or until the given time
+/// </summary>
+static void scheduler_park(scheduled_machine_t *machine, uint64_t until)
+{
+	MACHINE_STATE parked = MACHINE_PARKED;
+
+	atomic_store(&machine->park_until_ns, until);
+	atomic_store(&machine->state, MACHINE_PARKED);
+	scheduler_lower_unpark(machine->scheduler, until);
+
+	// A wake that raced with the slice must not be lost
+	if (atomic_load(&machine->wake_pending) && atomic_compare_exchange_strong(&machine->state, &parked, MACHINE_QUEUED))
+	{
+		worker_push(&machine->scheduler->workers[machine->worker], machine, false);
+	}
+}
+
+static void scheduler_cpu_run(intel8080_t *cpu, uint32_t cycles)
+{
+#ifdef ALTAIR_BLOCK_CACHE
+	i8080_block_run(cpu, cycles);
+#else
+	i8080_run(cpu, cycles);
+#endif
+}
+
+/// <summary>
+/// Run SCHEDULER_THROTTLE_SLICE_MS worth of T-states at clock_hz. T-states run over the slice are carried into
+/// the next one so the average clock stays exact.
+/// </summary>
+static void scheduler_run_throttled(scheduled_machine_t *machine, uint32_t clock_hz, uint64_t now)
+{
+	intel8080_t *cpu = machine->cpu;
+
+	// Start over if the machine was parked or the host fell more than a slice behind
+	if (now > machine->slice_due_ns + SCHEDULER_THROTTLE_SLICE_MS * NS_PER_MS)
+	{
+		machine->slice_due_ns	  = now;
+		machine->slice_end_cycles = cpu->cycles;
+	}
+
+	machine->slice_end_cycles += clock_hz / 1000 * SCHEDULER_THROTTLE_SLICE_MS;
+
+	if (cpu->cycles < machine->slice_end_cycles)
+	{
+		scheduler_cpu_run(cpu, (uint32_t)(machine->slice_end_cycles - cpu->cycles));
+	}
+
+	machine->slice_due_ns += SCHEDULER_THROTTLE_SLICE_MS * NS_PER_MS;
+}
+
+/// <summary>
+/// Run one slice of the machine then park it if it is not ready, waiting on console input, halted or ahead of its
+/// clock, otherwise put it back on the end of this worker's run queue
+/// </summary>
+static void scheduler_run_machine(scheduler_worker_t *worker, scheduled_machine_t *machine)
+{
+	intel8080_t *cpu = machine->cpu;
+	uint32_t clock_hz;
+	uint64_t now;
+	bool ready;
+
+	machine->worker = worker->index;
+	atomic_store(&machine->state, MACHINE_RUNNING);
+	atomic_store(&machine->wake_pending, false);
+
+	// Held by another thread, it saw the machine queued or parked and may already be changing it
+	if (atomic_load(&machine->held))
+	{
+		scheduler_park(machine, scheduler_now_ns() + SCHEDULER_STOPPED_PARK_MS * NS_PER_MS);
+		return;
+	}
+
+	ready	 = machine->hooks.ready == NULL || machine->hooks.ready(machine->context);
+	clock_hz = machine->hooks.clock_hz ? machine->hooks.clock_hz(machine->context) : 0;
+
+	if (ready && clock_hz)
+	{
+		scheduler_run_throttled(machine, clock_hz, scheduler_now_ns());
+	}
+	else if (ready)
+	{
+		scheduler_cpu_run(cpu, worker->scheduler->slice_cycles);
+	}
+
+	if (machine->hooks.slice_done)
+	{
+		machine->hooks.slice_done(machine->context);
+	}
+
+	now = scheduler_now_ns();
+
+	if (!ready)
+	{
+		scheduler_park(machine, now + SCHEDULER_STOPPED_PARK_MS * NS_PER_MS);
+	}
+	else if (cpu->idle)
+	{
+		cpu->idle		= false;
+		cpu->idle_polls = 0;
+		scheduler_park(machine, now + SCHEDULER_IDLE_PARK_MS * NS_PER_MS);
+	}
+	else if (cpu->halted)
+	{
+		scheduler_park(machine, now + SCHEDULER_STOPPED_PARK_MS * NS_PER_MS);
+	}
+	else if (clock_hz && machine->slice_due_ns > now)
+	{
+		scheduler_park(machine, machine->slice_due_ns);
+	}
+	else
+	{
+		atomic_store(&machine->state, MACHINE_QUEUED);
+		worker_push(worker, machine, true);
+	}
+}
+
+/// <summary>
+/// Sleep until a machine is queued, a parked machine is due or the scheduler stops
+/// </summary>
+static void scheduler_idle(altair_scheduler_t *scheduler)
+{
+	uint64_t until = scheduler_now_ns() + SCHEDULER_STOPPED_PARK_MS * NS_PER_MS;
+	uint64_t next  = atomic_load(&scheduler->next_unpark_ns);
+	struct timespec deadline;
+
+	until				= next < until ? next : until;
+	deadline.tv_sec		= (time_t)(until / (1000 * NS_PER_MS));
+	deadline.tv_nsec	= (long)(until % (1000 * NS_PER_MS));
+
+	pthread_mutex_lock(&scheduler->idle_lock);
+	atomic_fetch_add(&scheduler->idle_workers, 1);
+
+	while (atomic_load(&scheduler->queued) == 0 && !atomic_load(&scheduler->stopping))
+	{
+		if (pthread_cond_timedwait(&scheduler->idle_cond, &scheduler->idle_lock, &deadline) != 0)
+		{
+			break;
+		}
+	}
+
+	atomic_fetch_sub(&scheduler->idle_workers, 1);
+	pthread_mutex_unlock(&scheduler->idle_lock);
+}
+
+static void *scheduler_worker_thread(void *arg)
+{
+	scheduler_worker_t *worker	  = arg;
+	altair_scheduler_t *scheduler = worker->scheduler;
+
+	while (!atomic_load(&scheduler->stopping))
+	{
+		scheduler_unpark_due(scheduler, scheduler_now_ns());
+
+		scheduled_machine_t *machine = worker_pop(worker);
+
+		if (machine == NULL)
+		{
+			machine = worker_steal(worker);
+		}
+
+		if (machine)
+		{
+			scheduler_run_machine(worker, machine);
+		}
+		else
+		{
+			scheduler_idle(scheduler);
+		}
+	}
+	return NULL;
+}
+
+/// <summary>
+/// Register a machine and queue it to run, machines are spread round robin over the workers
+/// </summary>
+scheduled_machine_t *altair_scheduler_add(
+	altair_scheduler_t *scheduler, intel8080_t *cpu, const altair_schedule_hooks_t *hooks, void *context)
+{
+	int index = atomic_load(&scheduler->machine_count);
+
+	do
+	{
+		if (index >= scheduler->machine_capacity)
+		{
+			return NULL;
+		}
+	} while (!atomic_compare_exchange_weak(&scheduler->machine_count, &index, index + 1));
+
+	scheduled_machine_t *machine = &scheduler->machines[index];
+
+	machine->scheduler = scheduler;
+	machine->cpu	   = cpu;
+	machine->context   = context;
+	machine->worker	   = index % scheduler->worker_count;
+	if (hooks)
+	{
+		machine->hooks = *hooks;
+	}
+
+	atomic_store(&machine->state, MACHINE_QUEUED);
+	worker_push(&scheduler->workers[machine->worker], machine, false);
+
+	return machine;
+}
+
+/// <summary>
+/// Start the worker threads. If one can not be created the ones already running are stopped again.
+/// </summary>
+bool altair_scheduler_start(altair_scheduler_t *scheduler)
+{
+	atomic_store(&scheduler->stopping, false);
+
+	for (int i = 0; i < scheduler->worker_count; i++)
+	{
+		if (pthread_create(&scheduler->workers[i].thread, NULL, scheduler_worker_thread, &scheduler->workers[i]) != 0)
+		{
+			altair_scheduler_stop(scheduler);
+			return false;
+		}
+		scheduler->threads_started++;
+	}
+	return true;
+}
+
+/// <summary>
+/// Stop the workers once their current slices end, machines keep their state and are not freed.
+/// Does nothing if the workers are not running, so it can be called again on shutdown.
+/// </summary>
+void altair_scheduler_stop(altair_scheduler_t *scheduler)
+{
+	atomic_store(&scheduler->stopping, true);
+
+	pthread_mutex_lock(&scheduler->idle_lock);
+	pthread_cond_broadcast(&scheduler->idle_cond);
+	pthread_mutex_unlock(&scheduler->idle_lock);
+
+	for (int i = 0; i < scheduler->threads_started; i++)
+	{
+		pthread_join(scheduler->workers[i].thread, NULL);
+	}
+	scheduler->threads_started = 0;
+}
+
+/// <summary>
+/// Stop the workers if they are running and free the run queues, machine slots and locks. The CPUs and contexts
+/// added belong to the caller and are left alone.
+/// </summary>
+void altair_scheduler_destroy(altair_scheduler_t *scheduler)
+{
+	altair_scheduler_stop(scheduler);
+	scheduler_free(scheduler, scheduler->worker_count);
+	atomic_store(&scheduler->machine_count, 0);
+}
+
+/// <summary>
+/// Queue a parked machine to run, e.g. on console input or an interrupt. Safe from any thread.
+/// </summary>
+void altair_scheduler_wake(scheduled_machine_t *machine)
+{
+	MACHINE_STATE parked = MACHINE_PARKED;
+
+	atomic_store(&machine->wake_pending, true);
+
+	if (atomic_compare_exchange_strong(&machine->state, &parked, MACHINE_QUEUED))
+	{
+		worker_push(&machine->scheduler->workers[machine->worker], machine, false);
+	}
+}
+
+/// <summary>
+/// Keep the machine off the workers and wait for any slice it is in to end, so another thread can change the CPU,
+/// memory or disks, e.g. to restore a snapshot. Ends with altair_scheduler_unpark.
+/// </summary>
+void altair_scheduler_park(scheduled_machine_t *machine)
+{
+	// Either this sees the machine running and waits, or the worker taking it next sees held and parks it
+	atomic_store(&machine->held, true);
+
+	while (atomic_load(&machine->state) == MACHINE_RUNNING)
+	{
+		nanosleep(&(struct timespec){0, SCHEDULER_PARK_POLL_MS * NS_PER_MS}, NULL);
+	}
+}
+
+/// <summary>
+/// Let the workers run a machine held by altair_scheduler_park again
+/// </summary>
+void altair_scheduler_unpark(scheduled_machine_t *machine)
+{
+	atomic_store(&machine->held, false);
+	altair_scheduler_wake(machine);
+}
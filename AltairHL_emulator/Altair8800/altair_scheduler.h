@@ -0,0 +1,97 @@
+#ifndef _ALTAIR_SCHEDULER_H_
+#define _ALTAIR_SCHEDULER_H_
+
+#include "intel8080.h"
+#include "types.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#define SCHEDULER_MAX_WORKERS		64
+#define SCHEDULER_IDLE_PARK_MS		50		// machine spinning on console input
+#define SCHEDULER_STOPPED_PARK_MS	1000	// machine halted or not ready, until woken
+#define SCHEDULER_THROTTLE_SLICE_MS	10		// clock throttled machines run this much emulated time per slice
+#define SCHEDULER_PARK_POLL_MS		1		// altair_scheduler_park checks this often for the slice to end
+
+// Where a machine is: in a worker's run queue, being run by a worker, or parked until woken or its park time ends
+typedef enum
+{
+	MACHINE_QUEUED,
+	MACHINE_RUNNING,
+	MACHINE_PARKED
+} MACHINE_STATE;
+
+// Host callbacks for one machine, all optional and all called on a worker thread with the machine's context
+typedef struct
+{
+	bool (*ready)(void *context);		  // false parks the machine, e.g. stopped from the front panel
+	uint32_t (*clock_hz)(void *context);  // emulated clock to throttle to, 0 runs flat out
+	void (*slice_done)(void *context);	  // after every turn the machine gets, run or not ready
+} altair_schedule_hooks_t;
+
+typedef struct altair_scheduler_t altair_scheduler_t;
+
+typedef struct
+{
+	altair_scheduler_t *scheduler;
+	intel8080_t *cpu;
+	altair_schedule_hooks_t hooks;
+	void *context;
+
+	_Atomic MACHINE_STATE state;
+	atomic_bool wake_pending; // woken while running, stops it being parked after the slice
+	atomic_bool held;		  // altair_scheduler_park, workers park the machine rather than run it
+	_Atomic uint64_t park_until_ns; // a worker re-parking the machine writes it while it is read for unparking
+	atomic_int worker; // run queue the machine goes back to when woken
+
+	uint64_t slice_due_ns;		// throttled machines only, when the next slice may start
+	uint64_t slice_end_cycles;
+} scheduled_machine_t;
+
+// FIFO of runnable machines owned by one worker, thieves take from the tail
+typedef struct
+{
+	pthread_mutex_t lock;
+	scheduled_machine_t **queue;
+	int head;
+	int count;
+
+	pthread_t thread;
+	altair_scheduler_t *scheduler;
+	int index;
+} scheduler_worker_t;
+
+struct altair_scheduler_t
+{
+	scheduler_worker_t workers[SCHEDULER_MAX_WORKERS];
+	int worker_count;
+	int threads_started; // worker threads running, joined by altair_scheduler_stop
+
+	scheduled_machine_t *machines;
+	int machine_capacity;
+	atomic_int machine_count;
+	uint32_t slice_cycles;
+
+	// Workers with nothing to run or steal sleep here until a machine is queued or a park time ends
+	pthread_mutex_t idle_lock;
+	pthread_cond_t idle_cond;
+	atomic_int queued;
+	atomic_int idle_workers;
+
+	atomic_uint_fast64_t next_unpark_ns;
+	pthread_mutex_t unpark_lock;
+
+	atomic_bool stopping;
+};
+
+bool altair_scheduler_init(altair_scheduler_t *scheduler, int workers, int max_machines, uint32_t slice_cycles);
+scheduled_machine_t *altair_scheduler_add(
+	altair_scheduler_t *scheduler, intel8080_t *cpu, const altair_schedule_hooks_t *hooks, void *context);
+bool altair_scheduler_start(altair_scheduler_t *scheduler);
+void altair_scheduler_stop(altair_scheduler_t *scheduler);
+void altair_scheduler_destroy(altair_scheduler_t *scheduler);
+void altair_scheduler_wake(scheduled_machine_t *machine);
+void altair_scheduler_park(scheduled_machine_t *machine);
+void altair_scheduler_unpark(scheduled_machine_t *machine);
+
+#endif
@@ -0,0 +1,513 @@
+#include "altair_snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SNAPSHOT_DISK_NONE	0xff	// no drive selected
+
+// Bytes of one section being built or parsed
+typedef struct
+{
+	uint8_t *data;
+	size_t length;
+	size_t capacity;
+	size_t position;
+	bool failed;
+} snapshot_buffer_t;
+
+// Everything a snapshot restores, parsed in full before the machine is touched
+typedef struct
+{
+	bool have_cpu;
+	altair_cpu_state_t cpu;
+
+	bool have_ram;
+	uint8_t ram[64 * 1024];
+
+	bool have_pages;
+	uint8_t rom_pages[256];
+
+	bool have_disk;
+	uint8_t current_disk;
+	uint8_t current;
+	disk_t drives[2];
+
+	bool have_difference;
+	uint32_t difference_count;
+	const uint8_t *difference_entries;
+} snapshot_state_t;
+
+#define SNAPSHOT_DIFFERENCE_ENTRY	(1 + 2 + SECTOR_LENGTH)
+
+static void put_bytes(snapshot_buffer_t *buffer, const void *data, size_t length)
+{
+	if (buffer->failed)
+	{
+		return;
+	}
+
+	if (buffer->length + length > buffer->capacity)
+	{
+		size_t capacity = buffer->capacity ? buffer->capacity : 1024;
+		while (capacity < buffer->length + length)
+		{
+			capacity *= 2;
+		}
+
+		uint8_t *data_grown = realloc(buffer->data, capacity);
+		if (data_grown == NULL)
+		{
+			buffer->failed = true;
+			return;
+		}
+		buffer->data	 = data_grown;
+		buffer->capacity = capacity;
+	}
+
+	memcpy(buffer->data + buffer->length, data, length);
+	buffer->length += length;
+}
+
+static void put8(snapshot_buffer_t *buffer, uint8_t value)
+{
+	put_bytes(buffer, &value, 1);
+}
+
+static void put16(snapshot_buffer_t *buffer, uint16_t value)
+{
+	uint8_t bytes[2] = {(uint8_t)value, (uint8_t)(value >> 8)};
+	put_bytes(buffer, bytes, sizeof(bytes));
+}
+
+static void put32(snapshot_buffer_t *buffer, uint32_t value)
+{
+	put16(buffer, (uint16_t)value);
+	put16(buffer, (uint16_t)(value >> 16));
+}
+
+static void put64(snapshot_buffer_t *buffer, uint64_t value)
+{
+	put32(buffer, (uint32_t)value);
+	put32(buffer, (uint32_t)(value >> 32));
+}
+
+static const uint8_t *get_bytes(snapshot_buffer_t *buffer, size_t length)
+{
+	if (buffer->failed || buffer->length - buffer->position < length)
+	{
+		buffer->failed = true;
+		return NULL;
+	}
+
+	const uint8_t *data = buffer->data + buffer->position;
+	buffer->position += length;
+	return data;
+}
+
+static uint8_t get8(snapshot_buffer_t *buffer)
+{
+	const uint8_t *data = get_bytes(buffer, 1);
+	return data ? data[0] : 0;
+}
+
+static uint16_t get16(snapshot_buffer_t *buffer)
+{
+	const uint8_t *data = get_bytes(buffer, 2);
+	return data ? (uint16_t)(data[0] | data[1] << 8) : 0;
+}
+
+static uint32_t get32(snapshot_buffer_t *buffer)
+{
+	uint32_t low = get16(buffer);
+	return low | (uint32_t)get16(buffer) << 16;
+}
+
+static uint64_t get64(snapshot_buffer_t *buffer)
+{
+	uint64_t low = get32(buffer);
+	return low | (uint64_t)get32(buffer) << 32;
+}
+
+/// <summary>
+/// Append a section, the tag and length header followed by the payload
+/// </summary>
+static void put_section(snapshot_buffer_t *file, const char *tag, snapshot_buffer_t *section)
+{
+	if (section->failed)
+	{
+		file->failed = true;
+	}
+
+	put_bytes(file, tag, 4);
+	put32(file, (uint32_t)section->length);
+	put_bytes(file, section->data, section->length);
+
+	section->length = 0;
+}
+
+/// <summary>
+/// Run length encode memory: a control byte n below 128 is followed by n + 1 literal bytes,
+/// n from 128 up is followed by one byte repeated n - 125 times
+/// </summary>
+static void put_ram(snapshot_buffer_t *buffer, const uint8_t *ram, size_t length)
+{
+	size_t position = 0;
+
+	while (position < length)
+	{
+		size_t run = 1;
+		while (position + run < length && run < 130 && ram[position + run] == ram[position])
+		{
+			run++;
+		}
+
+		if (run >= 3)
+		{
+			put8(buffer, (uint8_t)(run + 125));
+			put8(buffer, ram[position]);
+			position += run;
+			continue;
+		}
+
+		size_t literal = 0;
+		while (position + literal < length && literal < 128)
+		{
+			if (position + literal + 2 < length && ram[position + literal] == ram[position + literal + 1] &&
+				ram[position + literal] == ram[position + literal + 2])
+			{
+				break;
+			}
+			literal++;
+		}
+
+		put8(buffer, (uint8_t)(literal - 1));
+		put_bytes(buffer, ram + position, literal);
+		position += literal;
+	}
+}
+
+static bool get_ram(snapshot_buffer_t *buffer, uint8_t *ram, size_t length)
+{
+	size_t position = 0;
+
+	while (position < length && !buffer->failed)
+	{
+		uint8_t control = get8(buffer);
+
+		if (control < 128)
+		{
+			size_t literal		 = (size_t)control + 1;
+			const uint8_t *bytes = get_bytes(buffer, literal);
+			if (bytes == NULL || position + literal > length)
+			{
+				return false;
+			}
+			memcpy(ram + position, bytes, literal);
+			position += literal;
+		}
+		else
+		{
+			size_t run	  = (size_t)control - 125;
+			uint8_t value = get8(buffer);
+			if (position + run > length)
+			{
+				return false;
+			}
+			memset(ram + position, value, run);
+			position += run;
+		}
+	}
+
+	return !buffer->failed && position == length;
+}
+
+static void put_disk(snapshot_buffer_t *buffer, const disk_t *disk)
+{
+	put8(buffer, disk->track);
+	put8(buffer, disk->sector);
+	put8(buffer, disk->status);
+	put8(buffer, disk->write_status);
+	put32(buffer, disk->diskPointer);
+	put8(buffer, disk->sectorPointer);
+	put_bytes(buffer, disk->sectorData, sizeof(disk->sectorData));
+	put8(buffer, disk->sectorDirty);
+	put8(buffer, disk->haveSectorData);
+}
+
+static void get_disk(snapshot_buffer_t *buffer, disk_t *disk)
+{
+	disk->track			= get8(buffer);
+	disk->sector		= get8(buffer);
+	disk->status		= get8(buffer);
+	disk->write_status	= get8(buffer);
+	disk->diskPointer	= get32(buffer);
+	disk->sectorPointer = get8(buffer);
+
+	const uint8_t *sector_data = get_bytes(buffer, sizeof(disk->sectorData));
+	if (sector_data != NULL)
+	{
+		memcpy(disk->sectorData, sector_data, sizeof(disk->sectorData));
+	}
+
+	disk->sectorDirty	 = get8(buffer) != 0;
+	disk->haveSectorData = get8(buffer) != 0;
+}
+
+static void put_difference_sector(int disk_number, int sector_number, uint8_t *sector, void *context)
+{
+	snapshot_buffer_t *buffer = context;
+
+	put8(buffer, (uint8_t)disk_number);
+	put16(buffer, (uint16_t)sector_number);
+	put_bytes(buffer, sector, SECTOR_LENGTH);
+}
+
+/// <summary>
+/// Write the machine to file_name. Call with the machine stopped, the file is replaced only once it is complete.
+/// </summary>
+bool altair_snapshot_save(altair_machine_t *machine, const char *file_name)
+{
+	disks *drive			  = &machine->disk_drive;
+	snapshot_buffer_t file	  = {0};
+	snapshot_buffer_t section = {0};
+	altair_cpu_state_t cpu;
+	char temp_name[256];
+	bool saved = false;
+
+	altair_cpu_state_save(&cpu, &machine->cpu);
+
+	put_bytes(&file, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC));
+	put16(&file, SNAPSHOT_VERSION);
+
+	put_bytes(&section, cpu.registers.r, sizeof(cpu.registers.r));
+	put16(&section, cpu.registers.sp);
+	put16(&section, cpu.registers.pc);
+	put16(&section, cpu.flags_result);
+	put64(&section, cpu.cycles);
+	put8(&section, cpu.halted);
+	put8(&section, cpu.interrupt_enable);
+	put8(&section, cpu.serial_rx_interrupt);
+	put8(&section, cpu.interrupt_request);
+	put8(&section, cpu.serial_rx_character);
+	put8(&section, cpu.cpu_status);
+	put16(&section, cpu.address_bus);
+	put8(&section, cpu.data_bus);
+	put8(&section, cpu.current_op_code);
+	put_section(&file, SNAPSHOT_TAG_CPU, &section);
+
+	put_ram(&section, machine->memory.ram, sizeof(machine->memory.ram));
+	put_section(&file, SNAPSHOT_TAG_RAM, &section);
+
+	for (int page = 0; page < 256; page++)
+	{
+		put8(&section, machine->memory.page_flags[page] & PAGE_ROM);
+	}
+	put_section(&file, SNAPSHOT_TAG_PAGES, &section);
+
+	put8(&section, drive->currentDisk);
+	put8(&section, drive->current == &drive->disk1   ? 0
+				   : drive->current == &drive->disk2 ? 1
+				   : drive->current == &drive->nodisk ? 2
+													  : SNAPSHOT_DISK_NONE);
+	disk_copy_sector_data(&drive->disk1);
+	disk_copy_sector_data(&drive->disk2);
+	put_disk(&section, &drive->disk1);
+	put_disk(&section, &drive->disk2);
+	put_section(&file, SNAPSHOT_TAG_DISK, &section);
+
+	put32(&section, difference_disk_count(&drive->difference_disk));
+	difference_disk_for_each(&drive->difference_disk, put_difference_sector, &section);
+	put_section(&file, SNAPSHOT_TAG_DIFFERENCE, &section);
+
+	put_section(&file, SNAPSHOT_TAG_END, &section);
+
+	if (!file.failed && snprintf(temp_name, sizeof(temp_name), "%s.tmp", file_name) < (int)sizeof(temp_name))
+	{
+		FILE *fp = fopen(temp_name, "wb");
+		if (fp != NULL)
+		{
+			saved = fwrite(file.data, 1, file.length, fp) == file.length;
+			saved = (fclose(fp) == 0) && saved;
+			saved = saved && rename(temp_name, file_name) == 0;
+			if (!saved)
+			{
+				unlink(temp_name);
+			}
+		}
+	}
+
+	free(section.data);
+	free(file.data);
+	return saved;
+}
+
+static bool parse_section(snapshot_state_t *state, const uint8_t *tag, snapshot_buffer_t *section)
+{
+	if (memcmp(tag, SNAPSHOT_TAG_CPU, 4) == 0)
+	{
+		altair_cpu_state_t *cpu = &state->cpu;
+		const uint8_t *r		= get_bytes(section, sizeof(cpu->registers.r));
+		if (r != NULL)
+		{
+			memcpy(cpu->registers.r, r, sizeof(cpu->registers.r));
+		}
+		cpu->registers.sp		 = get16(section);
+		cpu->registers.pc		 = get16(section);
+		cpu->flags_result		 = get16(section);
+		cpu->cycles				 = get64(section);
+		cpu->halted				 = get8(section) != 0;
+		cpu->interrupt_enable	 = get8(section) != 0;
+		cpu->serial_rx_interrupt = get8(section) != 0;
+		cpu->interrupt_request	 = get8(section);
+		cpu->serial_rx_character = get8(section);
+		cpu->cpu_status			 = get8(section);
+		cpu->address_bus		 = get16(section);
+		cpu->data_bus			 = get8(section);
+		cpu->current_op_code	 = get8(section);
+		state->have_cpu			 = !section->failed;
+	}
+	else if (memcmp(tag, SNAPSHOT_TAG_RAM, 4) == 0)
+	{
+		state->have_ram = get_ram(section, state->ram, sizeof(state->ram));
+	}
+	else if (memcmp(tag, SNAPSHOT_TAG_PAGES, 4) == 0)
+	{
+		const uint8_t *pages = get_bytes(section, sizeof(state->rom_pages));
+		if (pages != NULL)
+		{
+			memcpy(state->rom_pages, pages, sizeof(state->rom_pages));
+		}
+		state->have_pages = !section->failed;
+	}
+	else if (memcmp(tag, SNAPSHOT_TAG_DISK, 4) == 0)
+	{
+		state->current_disk = get8(section);
+		state->current		= get8(section);
+		get_disk(section, &state->drives[0]);
+		get_disk(section, &state->drives[1]);
+		state->have_disk = !section->failed && (state->current <= 2 || state->current == SNAPSHOT_DISK_NONE);
+	}
+	else if (memcmp(tag, SNAPSHOT_TAG_DIFFERENCE, 4) == 0)
+	{
+		state->difference_count = get32(section);
+		if (state->difference_count > (section->length - section->position) / SNAPSHOT_DIFFERENCE_ENTRY)
+		{
+			return false;
+		}
+		state->difference_entries = get_bytes(section, (size_t)state->difference_count * SNAPSHOT_DIFFERENCE_ENTRY);
+		state->have_difference	  = !section->failed;
+	}
+
+	return !section->failed;
+}
+
+static bool read_file(const char *file_name, snapshot_buffer_t *buffer)
+{
+	FILE *fp = fopen(file_name, "rb");
+	if (fp == NULL)
+	{
+		return false;
+	}
+
+	uint8_t chunk[4096];
+	size_t count;
+	while ((count = fread(chunk, 1, sizeof(chunk), fp)) > 0)
+	{
+		put_bytes(buffer, chunk, count);
+	}
+
+	bool ok = !ferror(fp) && !buffer->failed;
+	fclose(fp);
+	return ok;
+}
+
+/// <summary>
+/// Restore the machine from file_name. The whole file is checked before anything is changed, so on failure
+/// the machine is as it was. Disk image files and host callbacks are kept, the machine must be stopped.
+/// </summary>
+bool altair_snapshot_load(altair_machine_t *machine, const char *file_name)
+{
+	snapshot_buffer_t file	 = {0};
+	snapshot_state_t *state	 = NULL;
+	bool loaded				 = false;
+	size_t magic_length		 = strlen(SNAPSHOT_MAGIC);
+
+	if (!read_file(file_name, &file) || file.length < magic_length + 2 ||
+		memcmp(file.data, SNAPSHOT_MAGIC, magic_length) != 0)
+	{
+		goto cleanup;
+	}
+	file.position = magic_length;
+
+	if (get16(&file) != SNAPSHOT_VERSION || (state = calloc(1, sizeof(snapshot_state_t))) == NULL)
+	{
+		goto cleanup;
+	}
+
+	for (;;)
+	{
+		const uint8_t *tag = get_bytes(&file, 4);
+		uint32_t length	   = get32(&file);
+
+		if (file.failed || length > SNAPSHOT_MAX_SECTION)
+		{
+			goto cleanup;
+		}
+		if (memcmp(tag, SNAPSHOT_TAG_END, 4) == 0)
+		{
+			break;
+		}
+
+		snapshot_buffer_t section = {.data = (uint8_t *)get_bytes(&file, length), .length = length};
+		if (section.data == NULL || !parse_section(state, tag, &section))
+		{
+			goto cleanup;
+		}
+	}
+
+	if (!state->have_cpu || !state->have_ram || !state->have_pages || !state->have_disk || !state->have_difference)
+	{
+		goto cleanup;
+	}
+
+	disks *drive = &machine->disk_drive;
+
+	altair_cpu_state_restore(&machine->cpu, &state->cpu);
+
+	memcpy(machine->memory.ram, state->ram, sizeof(machine->memory.ram));
+	memory_clear_page_flags(&machine->memory, PAGE_ROM);
+	for (int page = 0; page < 256; page++)
+	{
+		if (state->rom_pages[page] & PAGE_ROM)
+		{
+			memory_set_page_flags(&machine->memory, (uint8_t)page, PAGE_ROM);
+		}
+	}
+
+#ifdef ALTAIR_BLOCK_CACHE
+	block_cache_flush(&machine->block_cache);
+#endif
+
+	disk_restore_state(&drive->disk1, &state->drives[0]);
+	disk_restore_state(&drive->disk2, &state->drives[1]);
+	drive->currentDisk = state->current_disk;
+	drive->current	   = state->current == 0   ? &drive->disk1
+						 : state->current == 1 ? &drive->disk2
+						 : state->current == 2 ? &drive->nodisk
+											   : NULL;
+
+	delete_all(&drive->difference_disk);
+	for (uint32_t entry = 0; entry < state->difference_count; entry++)
+	{
+		const uint8_t *bytes = state->difference_entries + (size_t)entry * SNAPSHOT_DIFFERENCE_ENTRY;
+		add_to_cache(&drive->difference_disk, bytes[0], bytes[1] | bytes[2] << 8, (uint8_t *)bytes + 3);
+	}
+
+	loaded = true;
+
+cleanup:
+	free(state);
+	free(file.data);
+	return loaded;
+}
@@ -0,0 +1,25 @@
+#ifndef _ALTAIR_SNAPSHOT_H_
+#define _ALTAIR_SNAPSHOT_H_
+
+#include "altair_machine.h"
+#include "types.h"
+#include <stdbool.h>
+
+// A snapshot file is the magic and version followed by sections, each a four character tag, a little endian
+// uint32 payload length and the payload. Readers skip sections they do not know.
+#define SNAPSHOT_MAGIC			"ALTAIRSS"
+#define SNAPSHOT_VERSION		1
+
+#define SNAPSHOT_TAG_CPU		"CPU "	// registers, interrupt state and T-state count
+#define SNAPSHOT_TAG_RAM		"RAM "	// 64K of memory, run length encoded
+#define SNAPSHOT_TAG_PAGES		"PAGE"	// PAGE_ROM bit of each page
+#define SNAPSHOT_TAG_DISK		"DISK"	// 88-DCDD controller and both drives, not the open image files
+#define SNAPSHOT_TAG_DIFFERENCE	"DIFF"	// sectors in the differencing disk
+#define SNAPSHOT_TAG_END		"END "
+
+#define SNAPSHOT_MAX_SECTION	(16 * 1024 * 1024)
+
+bool altair_snapshot_save(altair_machine_t *machine, const char *file_name);
+bool altair_snapshot_load(altair_machine_t *machine, const char *file_name);
+
+#endif
@@ -0,0 +1,153 @@
+#include "block_cache.h"
+#include "memory.h"
+#include <string.h>
+
+#define BLOCK_OP_LENGTH		0x03
+#define BLOCK_OP_END		0x80
+
+// Instruction length and whether the instruction ends a block (jumps, calls, returns, restarts and undefined op codes)
+// clang-format off
+static const uint8_t block_op_info[256] = {
+	/* 0x00 */ 0x01, 0x03, 0x01, 0x01, 0x01, 0x01, 0x02, 0x01, 0x81, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x01,
+	/* 0x10 */ 0x81, 0x03, 0x01, 0x01, 0x01, 0x01, 0x02, 0x01, 0x81, 0x01, 0x01, 0x01, 0x01, 0x01, 0x02, 0x01,
+	/* 0x20 */ 0x81, 0x03, 0x03, 0x01, 0x01, 0x01, 0x02, 0x01, 0x81, 0x01, 0x03, 0x01, 0x01, 0x01, 0x02, 0x01,
+	/* 0x30 */ 0x81, 0x03, 0x03, 0x01, 0x01, 0x01, 0x02, 0x01, 0x81, 0x01, 0x03, 0x01, 0x01, 0x01, 0x02, 0x01,
+	/* 0x40 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0x50 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0x60 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0x70 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x81, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0x80 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0x90 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0xa0 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0xb0 */ 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+	/* 0xc0 */ 0x81, 0x01, 0x83, 0x83, 0x83, 0x01, 0x02, 0x81, 0x81, 0x81, 0x83, 0x81, 0x83, 0x83, 0x02, 0x81,
+	/* 0xd0 */ 0x81, 0x01, 0x83, 0x02, 0x83, 0x01, 0x02, 0x81, 0x81, 0x81, 0x83, 0x02, 0x83, 0x81, 0x02, 0x81,
+	/* 0xe0 */ 0x81, 0x01, 0x83, 0x01, 0x83, 0x01, 0x02, 0x81, 0x81, 0x81, 0x83, 0x01, 0x83, 0x81, 0x02, 0x81,
+	/* 0xf0 */ 0x81, 0x01, 0x83, 0x01, 0x83, 0x01, 0x02, 0x81, 0x81, 0x01, 0x83, 0x01, 0x83, 0x81, 0x02, 0x81,
+};
+// clang-format on
+
+/// <summary>
+/// Attach an empty cache to the address space it translates, writes to cached code then invalidate it
+/// </summary>
+void block_cache_init(block_cache_t *cache, memory_t *memory)
+{
+	cache->memory		= memory;
+	memory->block_cache = cache;
+	block_cache_flush(cache);
+}
+
+void block_cache_flush(block_cache_t *cache)
+{
+	memset(cache->block_index, 0x00, sizeof(cache->block_index));
+	memset(cache->code_map, 0x00, sizeof(cache->code_map));
+	memory_clear_page_flags(cache->memory, PAGE_WATCHED);
+	cache->blocks_used		 = 0;
+	cache->block_invalidated = true;
+}
+
+/// <summary>
+/// Drop every cached block covering the address, a block can start at most BLOCK_MAX_BYTES before it
+/// </summary>
+void block_cache_invalidate(block_cache_t *cache, uint16_t address)
+{
+	for (uint16_t back = 0; back < BLOCK_MAX_BYTES; back++)
+	{
+		uint16_t start = (uint16_t)(address - back);
+		uint16_t block = cache->block_index[start];
+
+		if (block && back < cache->blocks[block - 1].length)
+		{
+			cache->block_index[start] = 0;
+		}
+	}
+
+	cache->code_map[address >> 3] &= (uint8_t)~(1 << (address & 7));
+	cache->block_invalidated = true;
+}
+
+static block_t *block_translate(block_cache_t *cache, uint16_t pc)
+{
+	if (cache->blocks_used == BLOCK_CACHE_BLOCKS)
+	{
+		block_cache_flush(cache);
+	}
+
+	block_t *block	= &cache->blocks[cache->blocks_used++];
+	uint16_t address = pc;
+	uint8_t info;
+
+	block->start = pc;
+	block->count = 0;
+
+	do
+	{
+		uint8_t op_code = read8(cache->memory, address);
+		info			= block_op_info[op_code];
+
+		block->op_code[block->count] = op_code;
+		block->handler[block->count] = i8080_op_table[op_code];
+		block->count++;
+
+		address = (uint16_t)(address + (info & BLOCK_OP_LENGTH));
+	} while (!(info & BLOCK_OP_END) && block->count < BLOCK_MAX_OPS);
+
+	block->length = (uint8_t)(address - pc);
+
+	for (uint8_t offset = 0; offset < block->length; offset++)
+	{
+		address = (uint16_t)(pc + offset);
+		cache->code_map[address >> 3] |= (uint8_t)(1 << (address & 7));
+		memory_set_page_flags(cache->memory, address >> 8, PAGE_WATCHED);
+	}
+
+	cache->block_index[pc] = cache->blocks_used;
+
+	return block;
+}
+
+/// <summary>
+/// Run the straight line block starting at PC, translating it first if it is not cached.
+/// Stops early if the block writes over cached code or reaches run_until, so HLT, EI, interrupt requests and the
+/// end of the budget cut a block short the same way they cut short i8080_run.
+/// </summary>
+static void block_run(intel8080_t *cpu)
+{
+	block_cache_t *cache  = cpu->memory->block_cache;
+	uint16_t block_number = cache->block_index[cpu->registers.pc];
+	block_t *block		  = block_number ? &cache->blocks[block_number - 1] : block_translate(cache, cpu->registers.pc);
+
+	cpu->cpuStatus	 = 0;
+	cpu->address_bus = block->start;
+	cpu->data_bus	 = block->op_code[0];
+
+	cache->block_invalidated = false;
+
+	for (uint8_t i = 0; i < block->count; i++)
+	{
+		cpu->current_op_code = block->op_code[i];
+		I8080_COUNT_OP(cpu, cpu->current_op_code);
+		cpu->cycles += block->handler[i](cpu);
+
+		if (cache->block_invalidated || cpu->cycles >= i8080_run_until(cpu))
+		{
+			break;
+		}
+	}
+}
+
+/// <summary>
+/// Run blocks until budget T-states have run, a block stops at the instruction that reaches the end
+/// </summary>
+void i8080_block_run(intel8080_t *cpu, uint32_t budget)
+{
+	uint64_t end = cpu->cycles + budget;
+
+	while (i8080_run_continue(cpu, end))
+	{
+		while (cpu->cycles < i8080_run_until(cpu))
+		{
+			block_run(cpu);
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#ifndef _BLOCK_CACHE_H_
+#define _BLOCK_CACHE_H_
+
+#include "intel8080.h"
+#include "memory.h"
+#include "types.h"
+#include <stdbool.h>
+
+#define BLOCK_CACHE_BLOCKS	2048
+#define BLOCK_MAX_OPS		16
+#define BLOCK_MAX_BYTES		(BLOCK_MAX_OPS * 3)
+
+typedef struct
+{
+	uint16_t start;
+	uint8_t length; // bytes of 8080 code covered by the block
+	uint8_t count;	// number of pre-decoded instructions
+	uint8_t op_code[BLOCK_MAX_OPS];
+	i8080_op_handler handler[BLOCK_MAX_OPS];
+} block_t;
+
+// Translated code of one machine, memory is the address space the blocks were read from
+struct block_cache_t
+{
+	memory_t *memory;
+	block_t blocks[BLOCK_CACHE_BLOCKS];
+	uint16_t block_index[64 * 1024]; // block number + 1 by start address, 0 when not translated
+	uint16_t blocks_used;
+	bool block_invalidated;
+	uint8_t code_map[64 * 1024 / 8]; // one bit per address, set when the byte belongs to a translated block
+};
+
+static inline bool block_cache_covers(block_cache_t *cache, uint16_t address)
+{
+	return cache->code_map[address >> 3] & (1 << (address & 7));
+}
+
+void block_cache_init(block_cache_t *cache, memory_t *memory);
+void block_cache_flush(block_cache_t *cache);
+void block_cache_invalidate(block_cache_t *cache, uint16_t address);
+void i8080_block_run(intel8080_t *cpu, uint32_t budget);
+
+#endif
@@ -0,0 +1,403 @@
+#include "disk_journal.h"
+#include <applibs/log.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define JOURNAL_MAGIC_SIZE	(sizeof(DISK_JOURNAL_MAGIC) - 1)
+#define JOURNAL_HEADER_SIZE (JOURNAL_MAGIC_SIZE + 4)
+#define JOURNAL_CHECKED		(sizeof(journal_record_t) - 4)
+
+_Static_assert(sizeof(journal_record_t) == 4 + SECTOR_LENGTH + 4, "journal records must not be padded");
+
+typedef struct
+{
+	int fd;
+	bool failed;
+} journal_writer_t;
+
+static uint32_t record_check(const journal_record_t *record)
+{
+	const uint8_t *bytes = (const uint8_t *)record;
+	uint32_t hash		 = 2166136261u;
+
+	for (size_t i = 0; i < JOURNAL_CHECKED; i++)
+	{
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static void seal_record(journal_record_t *record)
+{
+	uint32_t check = record_check(record);
+
+	record->check[0] = (uint8_t)check;
+	record->check[1] = (uint8_t)(check >> 8);
+	record->check[2] = (uint8_t)(check >> 16);
+	record->check[3] = (uint8_t)(check >> 24);
+}
+
+static bool record_valid(const journal_record_t *record)
+{
+	uint32_t check = (uint32_t)record->check[0] | (uint32_t)record->check[1] << 8 | (uint32_t)record->check[2] << 16 |
+					 (uint32_t)record->check[3] << 24;
+
+	return check == record_check(record);
+}
+
+static void fill_record(journal_record_t *record, int disk_number, int sector_number, const uint8_t *sector)
+{
+	record->type	  = JOURNAL_SECTOR;
+	record->disk	  = (uint8_t)disk_number;
+	record->sector[0] = (uint8_t)sector_number;
+	record->sector[1] = (uint8_t)(sector_number >> 8);
+	memcpy(record->data, sector, SECTOR_LENGTH);
+}
+
+static bool write_all(int fd, const void *data, size_t length)
+{
+	const uint8_t *bytes = data;
+
+	while (length > 0)
+	{
+		ssize_t written = write(fd, bytes, length);
+
+		if (written == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (written <= 0)
+		{
+			return false;
+		}
+		bytes += written;
+		length -= (size_t)written;
+	}
+	return true;
+}
+
+static void write_batch(disk_journal_t *journal, journal_record_t *batch, size_t count)
+{
+	size_t first = 0;
+
+	// A clear drops everything before it, in the file as well as the batch
+	for (size_t i = count; i-- > 0;)
+	{
+		if (batch[i].type == JOURNAL_CLEAR)
+		{
+			first = i + 1;
+			if (ftruncate(journal->fd, JOURNAL_HEADER_SIZE) == -1)
+			{
+				Log_Debug("Failed to empty the disk journal. Error: %s\n", strerror(errno));
+			}
+			break;
+		}
+	}
+
+	for (size_t i = first; i < count; i++)
+	{
+		seal_record(&batch[i]);
+	}
+
+	if (!write_all(journal->fd, batch + first, (count - first) * sizeof(journal_record_t)) ||
+		fdatasync(journal->fd) == -1)
+	{
+		Log_Debug("Disk journal write failed. Error: %s\n", strerror(errno));
+	}
+}
+
+static void *journal_thread(void *arg)
+{
+	disk_journal_t *journal = arg;
+	struct timespec due;
+
+	pthread_mutex_lock(&journal->lock);
+
+	for (;;)
+	{
+		// Wake on the interval rather than on each write, so the CPU thread never has to signal
+		clock_gettime(CLOCK_REALTIME, &due);
+		due.tv_sec += journal->sync_ms / 1000;
+		due.tv_nsec += (long)(journal->sync_ms % 1000) * 1000000;
+		if (due.tv_nsec >= 1000000000)
+		{
+			due.tv_sec++;
+			due.tv_nsec -= 1000000000;
+		}
+
+		while (!journal->stopping && pthread_cond_timedwait(&journal->work, &journal->lock, &due) != ETIMEDOUT)
+		{
+		}
+
+		if (journal->pending_count != 0)
+		{
+			journal_record_t *batch = journal->pending;
+			size_t batch_capacity	= journal->pending_capacity;
+			size_t batch_count		= journal->pending_count;
+
+			journal->pending		  = journal->writing;
+			journal->pending_capacity = journal->writing_capacity;
+			journal->pending_count	  = 0;
+			journal->writing		  = batch;
+			journal->writing_capacity = batch_capacity;
+
+			pthread_mutex_unlock(&journal->lock);
+			write_batch(journal, batch, batch_count);
+			pthread_mutex_lock(&journal->lock);
+		}
+		else if (journal->stopping)
+		{
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&journal->lock);
+	return NULL;
+}
+
+static void journal_header(uint8_t *header)
+{
+	memset(header, 0x00, JOURNAL_HEADER_SIZE);
+	memcpy(header, DISK_JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+	header[JOURNAL_MAGIC_SIZE] = DISK_JOURNAL_VERSION; // little endian uint32
+}
+
+static void replay(FILE *fp, difference_disk_t *layer)
+{
+	journal_record_t record;
+
+	while (fread(&record, sizeof(record), 1, fp) == 1 && record_valid(&record))
+	{
+		if (record.type == JOURNAL_CLEAR)
+		{
+			delete_all(layer);
+		}
+		else if (record.type == JOURNAL_SECTOR)
+		{
+			add_to_cache(layer, record.disk, record.sector[0] | record.sector[1] << 8, record.data);
+		}
+		else
+		{
+			break;
+		}
+	}
+}
+
+static void write_sector_record(int disk_number, int sector_number, uint8_t *sector, void *context)
+{
+	journal_writer_t *writer = context;
+	journal_record_t record;
+
+	fill_record(&record, disk_number, sector_number, sector);
+	seal_record(&record);
+	writer->failed = writer->failed || !write_all(writer->fd, &record, sizeof(record));
+}
+
+static void restore_sector(int disk_number, int sector_number, uint8_t *sector, void *context)
+{
+	add_to_cache(context, disk_number, sector_number, sector);
+}
+
+/// <summary>
+/// Write the replayed sectors as a new journal of one record each and put it in place of the old one, so the file
+/// does not keep every write of every earlier run
+/// </summary>
+static bool compact(const char *file_name, difference_disk_t *replayed)
+{
+	char temp_name[256];
+	uint8_t header[JOURNAL_HEADER_SIZE];
+	journal_writer_t writer = {0};
+
+	if (snprintf(temp_name, sizeof(temp_name), "%s.tmp", file_name) >= (int)sizeof(temp_name) ||
+		(writer.fd = open(temp_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+	{
+		return false;
+	}
+
+	journal_header(header);
+	writer.failed = !write_all(writer.fd, header, sizeof(header));
+	difference_disk_for_each(replayed, write_sector_record, &writer);
+	writer.failed = writer.failed || fdatasync(writer.fd) == -1;
+	writer.failed = close(writer.fd) == -1 || writer.failed;
+
+	if (writer.failed || rename(temp_name, file_name) == -1)
+	{
+		unlink(temp_name);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Add the sectors in the journal file to the differencing disk, then journal the writes that follow. Returns false,
+/// leaving the journal file alone, when the journal can not be written.
+/// </summary>
+bool disk_journal_open(disk_journal_t *journal, const char *file_name, uint32_t sync_ms, difference_disk_t *disk)
+{
+	difference_disk_t *replayed = calloc(1, sizeof(difference_disk_t));
+	FILE *fp;
+
+	memset(journal, 0x00, sizeof(disk_journal_t));
+	journal->sync_ms = sync_ms != 0 ? sync_ms : DISK_JOURNAL_SYNC_MS;
+
+	if (replayed == NULL)
+	{
+		return false;
+	}
+
+	if ((fp = fopen(file_name, "rb")) != NULL)
+	{
+		uint8_t header[JOURNAL_HEADER_SIZE];
+		uint8_t expected[JOURNAL_HEADER_SIZE];
+
+		journal_header(expected);
+		if (fread(header, sizeof(header), 1, fp) == 1 && memcmp(header, expected, sizeof(header)) == 0)
+		{
+			replay(fp, replayed);
+		}
+		else
+		{
+			Log_Debug("%s is not a disk journal, starting a new one\n", file_name);
+		}
+		fclose(fp);
+	}
+
+	if (!compact(file_name, replayed) || (journal->fd = open(file_name, O_WRONLY | O_APPEND)) == -1)
+	{
+		difference_disk_free(replayed);
+		free(replayed);
+		return false;
+	}
+
+	Log_Debug("Restored %u sectors from the disk journal\n", difference_disk_count(replayed));
+	difference_disk_for_each(replayed, restore_sector, disk);
+	difference_disk_free(replayed);
+	free(replayed);
+
+	journal->pending = calloc(DISK_JOURNAL_INITIAL, sizeof(journal_record_t));
+	journal->writing = calloc(DISK_JOURNAL_INITIAL, sizeof(journal_record_t));
+	if (journal->pending == NULL || journal->writing == NULL)
+	{
+		free(journal->pending);
+		free(journal->writing);
+		close(journal->fd);
+		return false;
+	}
+	journal->pending_capacity = DISK_JOURNAL_INITIAL;
+	journal->writing_capacity = DISK_JOURNAL_INITIAL;
+
+	pthread_mutex_init(&journal->lock, NULL);
+	pthread_cond_init(&journal->work, NULL);
+
+	if (pthread_create(&journal->thread, NULL, journal_thread, journal) != 0)
+	{
+		Log_Debug("Failed to start the disk journal thread. Error: %s\n", strerror(errno));
+		free(journal->pending);
+		free(journal->writing);
+		close(journal->fd);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Write and sync everything journaled and end the I/O thread
+/// </summary>
+void disk_journal_close(disk_journal_t *journal)
+{
+	pthread_mutex_lock(&journal->lock);
+	journal->stopping = true;
+	pthread_cond_signal(&journal->work);
+	pthread_mutex_unlock(&journal->lock);
+
+	pthread_join(journal->thread, NULL);
+
+	close(journal->fd);
+	free(journal->pending);
+	free(journal->writing);
+	journal->pending = NULL;
+	journal->writing = NULL;
+}
+
+static journal_record_t *next_record(disk_journal_t *journal)
+{
+	if (journal->pending_count == journal->pending_capacity)
+	{
+		size_t capacity			  = journal->pending_capacity * 2;
+		journal_record_t *pending = realloc(journal->pending, capacity * sizeof(journal_record_t));
+
+		if (pending == NULL)
+		{
+			return NULL;
+		}
+		journal->pending		  = pending;
+		journal->pending_capacity = capacity;
+	}
+	return &journal->pending[journal->pending_count++];
+}
+
+static void append_record(disk_journal_t *journal, int disk_number, int sector_number, const uint8_t *sector)
+{
+	journal_record_t *record;
+
+	if ((record = next_record(journal)) != NULL)
+	{
+		fill_record(record, disk_number, sector_number, sector);
+	}
+	else
+	{
+		Log_Debug("Disk journal out of memory, sector %d not journaled\n", sector_number);
+	}
+}
+
+static void append_sector(int disk_number, int sector_number, uint8_t *sector, void *context)
+{
+	append_record(context, disk_number, sector_number, sector);
+}
+
+static void append_clear(disk_journal_t *journal)
+{
+	journal_record_t *record;
+
+	journal->pending_count = 0; // nothing pending survives the clear
+	record				   = next_record(journal);
+	memset(record, 0x00, sizeof(journal_record_t));
+	record->type = JOURNAL_CLEAR;
+}
+
+/// <summary>
+/// Journal a differencing disk write. Only copies the sector into the batch, the I/O thread writes it.
+/// </summary>
+void disk_journal_append(disk_journal_t *journal, int disk_number, int sector_number, const uint8_t *sector)
+{
+	pthread_mutex_lock(&journal->lock);
+	append_record(journal, disk_number, sector_number, sector);
+	pthread_mutex_unlock(&journal->lock);
+}
+
+/// <summary>
+/// Journal the end of a session, the next replay starts from an empty differencing disk
+/// </summary>
+void disk_journal_clear(disk_journal_t *journal)
+{
+	pthread_mutex_lock(&journal->lock);
+	append_clear(journal);
+	pthread_mutex_unlock(&journal->lock);
+}
+
+/// <summary>
+/// Journal a differencing disk that was replaced as a whole, e.g. by a snapshot restore: a clear, then each of its
+/// sectors, so the next replay rebuilds it as it is now rather than as it was before
+/// </summary>
+void disk_journal_replace(disk_journal_t *journal, difference_disk_t *disk)
+{
+	pthread_mutex_lock(&journal->lock);
+	append_clear(journal);
+	difference_disk_for_each(disk, append_sector, journal);
+	pthread_mutex_unlock(&journal->lock);
+}
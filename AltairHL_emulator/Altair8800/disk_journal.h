@@ -0,0 +1,59 @@
+#ifndef _DISK_JOURNAL_H_
+#define _DISK_JOURNAL_H_
+
+#include "difference_disk.h"
+#include "types.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+// A journal file is the magic and version followed by fixed size records. Replay stops at the first record that is
+// short or fails its check, which is where a crash interrupted the last write.
+#define DISK_JOURNAL_MAGIC		"ALTAIRDJ"
+#define DISK_JOURNAL_VERSION	1
+#define DISK_JOURNAL_SYNC_MS	1000	// default time from a sector write to the journal reaching storage
+#define DISK_JOURNAL_INITIAL	64		// pending records before the batch grows
+
+typedef enum
+{
+	JOURNAL_SECTOR = 1, // a differencing disk sector write
+	JOURNAL_CLEAR  = 2	// the session ended, everything before this is dropped
+} JOURNAL_RECORD;
+
+// Bytes only, so the record has no padding and is the same on every host
+typedef struct
+{
+	uint8_t type;
+	uint8_t disk;
+	uint8_t sector[2]; // little endian
+	uint8_t data[SECTOR_LENGTH];
+	uint8_t check[4]; // FNV-1a of the bytes before, little endian
+} journal_record_t;
+
+// Differencing disk writes of a cloud session, appended to a file by one I/O thread. The CPU thread only copies each
+// write into the pending batch, the I/O thread writes the batch and syncs it once every sync interval.
+typedef struct
+{
+	int fd;
+	uint32_t sync_ms;
+
+	pthread_mutex_t lock;
+	pthread_cond_t work; // records pending or stopping
+
+	journal_record_t *pending;
+	size_t pending_count;
+	size_t pending_capacity;
+
+	journal_record_t *writing; // batch the I/O thread is writing, swapped with pending
+	size_t writing_capacity;
+
+	pthread_t thread;
+	bool stopping;
+} disk_journal_t;
+
+bool disk_journal_open(disk_journal_t *journal, const char *file_name, uint32_t sync_ms, difference_disk_t *disk);
+void disk_journal_close(disk_journal_t *journal);
+void disk_journal_append(disk_journal_t *journal, int disk_number, int sector_number, const uint8_t *sector);
+void disk_journal_clear(disk_journal_t *journal);
+void disk_journal_replace(disk_journal_t *journal, difference_disk_t *disk);
+
+#endif
@@ -0,0 +1,177 @@
+#include "disk_uring.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// No liburing, the three system calls and the shared rings are all a single reader needs
+static int uring_setup(unsigned entries, struct io_uring_params *params)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int ring_fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+/// <summary>
+/// Create the ring, false when the kernel has no io_uring or it is blocked, callers then read with pread
+/// </summary>
+bool disk_uring_init(disk_uring_t *ring)
+{
+	struct io_uring_params params;
+
+	memset(ring, 0x00, sizeof(disk_uring_t));
+	memset(&params, 0x00, sizeof(params));
+
+	if ((ring->ring_fd = uring_setup(DISK_URING_ENTRIES, &params)) < 0)
+	{
+		return false;
+	}
+
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->sqes_size	   = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (ring->cq_ring_size > ring->sq_ring_size)
+		{
+			ring->sq_ring_size = ring->cq_ring_size;
+		}
+		ring->cq_ring_size = 0;
+	}
+
+	ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+		IORING_OFF_SQ_RING);
+	ring->cq_ring = ring->cq_ring_size == 0 ? ring->sq_ring
+											: mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+												  MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+	ring->sqes	  = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd,
+		   IORING_OFF_SQES);
+
+	if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		disk_uring_close(ring);
+		return false;
+	}
+
+	uint8_t *sq = ring->sq_ring;
+	uint8_t *cq = ring->cq_ring;
+
+	ring->sq_head	 = (unsigned *)(sq + params.sq_off.head);
+	ring->sq_tail	 = (unsigned *)(sq + params.sq_off.tail);
+	ring->sq_mask	 = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sq_array	 = (unsigned *)(sq + params.sq_off.array);
+	ring->sq_entries = params.sq_entries;
+	ring->cq_head	 = (unsigned *)(cq + params.cq_off.head);
+	ring->cq_tail	 = (unsigned *)(cq + params.cq_off.tail);
+	ring->cq_mask	 = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes		 = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+	return true;
+}
+
+/// <summary>
+/// Wait for the reads in flight, their buffers must not be reused while the kernel still writes them, then tear
+/// the ring down
+/// </summary>
+void disk_uring_close(disk_uring_t *ring)
+{
+	uint64_t user_data;
+	int32_t result;
+
+	while (ring->in_flight != 0 && disk_uring_complete(ring, true, &user_data, &result))
+	{
+	}
+
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+	{
+		munmap(ring->sqes, ring->sqes_size);
+	}
+	if (ring->cq_ring != NULL && ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+	{
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	}
+	if (ring->sq_ring != NULL && ring->sq_ring != MAP_FAILED)
+	{
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	}
+	if (ring->ring_fd >= 0)
+	{
+		close(ring->ring_fd);
+	}
+	memset(ring, 0x00, sizeof(disk_uring_t));
+	ring->ring_fd = -1;
+}
+
+/// <summary>
+/// Submit a read without waiting for it, the buffer must stay put until its completion is reaped
+/// </summary>
+bool disk_uring_read(disk_uring_t *ring, int fd, void *buffer, uint32_t length, uint64_t offset, uint64_t user_data)
+{
+	unsigned tail = *ring->sq_tail;
+	unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+	if (tail - head >= ring->sq_entries || ring->in_flight >= DISK_URING_ENTRIES)
+	{
+		return false;
+	}
+
+	unsigned index			  = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+
+	memset(sqe, 0x00, sizeof(struct io_uring_sqe));
+	sqe->opcode	   = IORING_OP_READ;
+	sqe->fd		   = fd;
+	sqe->addr	   = (uint64_t)(uintptr_t)buffer;
+	sqe->len	   = length;
+	sqe->off	   = offset;
+	sqe->user_data = user_data;
+
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (uring_enter(ring->ring_fd, 1, 0, 0) != 1)
+	{
+		return false;
+	}
+
+	ring->in_flight++;
+	return true;
+}
+
+/// <summary>
+/// Reap one completion, waiting for it when wait is set and a read is in flight. result is the byte count or -errno.
+/// </summary>
+bool disk_uring_complete(disk_uring_t *ring, bool wait, uint64_t *user_data, int32_t *result)
+{
+	for (;;)
+	{
+		unsigned head = *ring->cq_head;
+
+		if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+
+			*user_data = cqe->user_data;
+			*result	   = cqe->res;
+			__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+			ring->in_flight--;
+			return true;
+		}
+
+		if (!wait || ring->in_flight == 0)
+		{
+			return false;
+		}
+
+		if (uring_enter(ring->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+		{
+			return false;
+		}
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef _DISK_URING_H_
+#define _DISK_URING_H_
+
+#include "types.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+#define DISK_URING_ENTRIES	8	// at most one read ahead per drive is in flight
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// A minimal io_uring for disk image reads, driven by the thread running the machine that owns it
+typedef struct
+{
+	int ring_fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+	unsigned in_flight;
+} disk_uring_t;
+
+bool disk_uring_init(disk_uring_t *ring);
+void disk_uring_close(disk_uring_t *ring);
+bool disk_uring_read(disk_uring_t *ring, int fd, void *buffer, uint32_t length, uint64_t offset, uint64_t user_data);
+bool disk_uring_complete(disk_uring_t *ring, bool wait, uint64_t *user_data, int32_t *result);
+
+#endif
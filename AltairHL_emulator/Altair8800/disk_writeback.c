@@ -0,0 +1,433 @@
+#include "disk_writeback.h"
+#include <applibs/log.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static bool write_sector(const writeback_sector_t *sector)
+{
+	const uint8_t *data = sector->data;
+	size_t length		= WRITEBACK_SECTOR_SIZE;
+	off_t offset		= (off_t)sector->offset;
+
+	while (length > 0)
+	{
+		ssize_t written = pwrite(sector->fp, data, length, offset);
+
+		if (written == -1 && errno == EINTR)
+		{
+			continue;
+		}
+		if (written <= 0)
+		{
+			if (written == 0)
+			{
+				errno = EIO;
+			}
+			return false;
+		}
+		data += written;
+		offset += written;
+		length -= (size_t)written;
+	}
+	return true;
+}
+
+static uint32_t index_slot(int fp, uint32_t offset)
+{
+	uint32_t hash = ((uint32_t)fp * 0x9e3779b1u ^ offset / WRITEBACK_SECTOR_SIZE) * 0x85ebca6bu;
+
+	return (hash >> 16) & (WRITEBACK_INDEX_SLOTS - 1);
+}
+
+static inline uint32_t next_slot(uint32_t slot)
+{
+	return (slot + 1) & (WRITEBACK_INDEX_SLOTS - 1);
+}
+
+static writeback_sector_t *queue_find(const writeback_queue_t *queue, int fp, uint32_t offset)
+{
+	for (uint32_t slot = index_slot(fp, offset); queue->index[slot] != 0; slot = next_slot(slot))
+	{
+		writeback_sector_t *sector = &queue->sectors[queue->index[slot] - 1];
+
+		if (sector->fp == fp && sector->offset == offset)
+		{
+			return sector;
+		}
+	}
+	return NULL;
+}
+
+/// <summary>
+/// Append a sector for a place not already in the queue, growing the queue up to WRITEBACK_MAX_SECTORS
+/// </summary>
+static writeback_sector_t *queue_add(writeback_queue_t *queue, int fp, uint32_t offset)
+{
+	uint32_t slot = index_slot(fp, offset);
+	writeback_sector_t *sector;
+
+	if (queue->count == WRITEBACK_MAX_SECTORS)
+	{
+		return NULL;
+	}
+
+	if (queue->count == queue->capacity)
+	{
+		size_t capacity = queue->capacity * 2;
+		writeback_sector_t *sectors;
+
+		if (capacity > WRITEBACK_MAX_SECTORS)
+		{
+			capacity = WRITEBACK_MAX_SECTORS;
+		}
+		sectors = realloc(queue->sectors, capacity * sizeof(writeback_sector_t));
+
+		if (sectors == NULL)
+		{
+			return NULL;
+		}
+		queue->sectors	= sectors;
+		queue->capacity = capacity;
+	}
+
+	while (queue->index[slot] != 0)
+	{
+		slot = next_slot(slot);
+	}
+	queue->index[slot] = (uint16_t)(queue->count + 1);
+
+	sector		   = &queue->sectors[queue->count++];
+	sector->fp	   = fp;
+	sector->offset = offset;
+	return sector;
+}
+
+static void queue_clear(writeback_queue_t *queue)
+{
+	queue->count = 0;
+	memset(queue->index, 0x00, sizeof(queue->index));
+}
+
+/// <summary>
+/// Held sectors are at the limit, requeued failures of the batch being written always fit in what is left
+/// </summary>
+static bool queue_full(const disk_writeback_t *writeback)
+{
+	return writeback->pending->count + writeback->flushing->count >= WRITEBACK_MAX_SECTORS;
+}
+
+/// <summary>
+/// Put the sectors of the batch that failed back on the queue, unless the CPU has queued a newer copy since
+/// </summary>
+static void requeue_failed(disk_writeback_t *writeback)
+{
+	for (size_t i = 0; i < writeback->flushing->count; i++)
+	{
+		writeback_sector_t *sector = &writeback->flushing->sectors[i];
+		writeback_sector_t *entry;
+
+		if (!sector->failed || queue_find(writeback->pending, sector->fp, sector->offset) != NULL)
+		{
+			continue;
+		}
+		if ((entry = queue_add(writeback->pending, sector->fp, sector->offset)) == NULL)
+		{
+			Log_Debug("Disk write back out of memory, sector at %u lost\n", sector->offset);
+			writeback->lost++;
+			continue;
+		}
+		*entry = *sector;
+	}
+}
+
+static void retry_wait(disk_writeback_t *writeback)
+{
+	struct timespec due;
+
+	clock_gettime(CLOCK_REALTIME, &due);
+	due.tv_nsec += (long)WRITEBACK_RETRY_MS * 1000000;
+	if (due.tv_nsec >= 1000000000)
+	{
+		due.tv_sec++;
+		due.tv_nsec -= 1000000000;
+	}
+
+	// Sit out the whole wait, new sectors are written with the retry rather than keep a failing file busy
+	while (pthread_cond_timedwait(&writeback->work, &writeback->lock, &due) != ETIMEDOUT)
+	{
+	}
+}
+
+static void *writeback_thread(void *arg)
+{
+	disk_writeback_t *writeback = arg;
+	int stop_retries			= 0;
+
+	pthread_mutex_lock(&writeback->lock);
+
+	for (;;)
+	{
+		while (writeback->pending->count == 0 && !writeback->stopping)
+		{
+			pthread_cond_wait(&writeback->work, &writeback->lock);
+		}
+
+		if (writeback->pending->count == 0)
+		{
+			break; // stopping with nothing left to write
+		}
+
+		// Take the queue as this batch, the CPU threads queue into the last batch's emptied one meanwhile
+		writeback_queue_t *batch = writeback->pending;
+		int error				 = 0;
+
+		writeback->pending	= writeback->flushing;
+		writeback->flushing = batch;
+
+		pthread_mutex_unlock(&writeback->lock);
+
+		// Only the failed flags change, readers overlaying the batch look at the rest
+		for (size_t i = 0; i < batch->count; i++)
+		{
+			batch->sectors[i].failed = !write_sector(&batch->sectors[i]);
+			if (batch->sectors[i].failed)
+			{
+				error = errno;
+			}
+		}
+
+		pthread_mutex_lock(&writeback->lock);
+
+		if (error != 0)
+		{
+			requeue_failed(writeback);
+			if (writeback->error == 0)
+			{
+				Log_Debug("Sector writes failing, retrying. Error: %s\n", strerror(error));
+			}
+		}
+		else if (writeback->error != 0)
+		{
+			Log_Debug("Sector writes recovered\n");
+		}
+
+		writeback->error = error;
+		queue_clear(writeback->flushing);
+		writeback->batches++;
+		pthread_cond_broadcast(&writeback->drained);
+
+		if (error != 0)
+		{
+			if (writeback->stopping && ++stop_retries >= WRITEBACK_STOP_RETRIES)
+			{
+				Log_Debug("Disk write back stopping, %zu sectors lost\n", writeback->pending->count);
+				writeback->lost += writeback->pending->count;
+				queue_clear(writeback->pending);
+			}
+			else
+			{
+				retry_wait(writeback);
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&writeback->lock);
+	return NULL;
+}
+
+static void writeback_free(disk_writeback_t *writeback)
+{
+	pthread_cond_destroy(&writeback->drained);
+	pthread_cond_destroy(&writeback->work);
+	pthread_mutex_destroy(&writeback->lock);
+
+	for (int i = 0; i < 2; i++)
+	{
+		free(writeback->queues[i].sectors);
+		writeback->queues[i].sectors = NULL;
+	}
+}
+
+/// <summary>
+/// Start the I/O thread with an empty queue
+/// </summary>
+bool disk_writeback_start(disk_writeback_t *writeback)
+{
+	int result;
+
+	memset(writeback, 0x00, sizeof(disk_writeback_t));
+
+	for (int i = 0; i < 2; i++)
+	{
+		writeback->queues[i].sectors  = calloc(WRITEBACK_INITIAL, sizeof(writeback_sector_t));
+		writeback->queues[i].capacity = WRITEBACK_INITIAL;
+	}
+	if (writeback->queues[0].sectors == NULL || writeback->queues[1].sectors == NULL)
+	{
+		free(writeback->queues[0].sectors);
+		free(writeback->queues[1].sectors);
+		return false;
+	}
+	writeback->pending	= &writeback->queues[0];
+	writeback->flushing = &writeback->queues[1];
+
+	pthread_mutex_init(&writeback->lock, NULL);
+	pthread_cond_init(&writeback->work, NULL);
+	pthread_cond_init(&writeback->drained, NULL);
+
+	if ((result = pthread_create(&writeback->thread, NULL, writeback_thread, writeback)) != 0)
+	{
+		Log_Debug("Failed to start the disk write back thread. Error: %s\n", strerror(result));
+		writeback_free(writeback);
+		return false;
+	}
+	return true;
+}
+
+/// <summary>
+/// Write everything queued and end the I/O thread. Returns false when sectors were lost, those still failing after
+/// WRITEBACK_STOP_RETRIES tries are given up so shutdown does not hang on a file that will not take them.
+/// </summary>
+bool disk_writeback_stop(disk_writeback_t *writeback)
+{
+	size_t lost;
+
+	pthread_mutex_lock(&writeback->lock);
+	writeback->stopping = true;
+	pthread_cond_signal(&writeback->work);
+	pthread_mutex_unlock(&writeback->lock);
+
+	pthread_join(writeback->thread, NULL);
+
+	lost = writeback->lost;
+	writeback_free(writeback);
+	return lost == 0;
+}
+
+/// <summary>
+/// Queue a sector for the I/O thread, replacing the copy already queued for the same place. Waits on storage
+/// only when WRITEBACK_MAX_SECTORS are held, until the batch being written is done. Returns false, for the
+/// caller to write the sector itself, for an offset off a sector boundary, out of memory, or when the queue
+/// is full and the file is failing, as waiting on the retries could stall the CPU for good.
+/// </summary>
+bool disk_writeback_queue(disk_writeback_t *writeback, int fp, uint32_t offset, const uint8_t *sector)
+{
+	writeback_sector_t *entry;
+
+	// Overlays only look up sectors on sector boundaries
+	if (offset % WRITEBACK_SECTOR_SIZE != 0)
+	{
+		return false;
+	}
+
+	pthread_mutex_lock(&writeback->lock);
+
+	while ((entry = queue_find(writeback->pending, fp, offset)) == NULL && queue_full(writeback) &&
+		   writeback->error == 0)
+	{
+		pthread_cond_wait(&writeback->drained, &writeback->lock);
+	}
+
+	// Still full only while the file is failing
+	if (entry == NULL &&
+		(queue_full(writeback) || (entry = queue_add(writeback->pending, fp, offset)) == NULL))
+	{
+		pthread_mutex_unlock(&writeback->lock);
+		return false;
+	}
+
+	memcpy(entry->data, sector, WRITEBACK_SECTOR_SIZE);
+
+	pthread_cond_signal(&writeback->work);
+	pthread_mutex_unlock(&writeback->lock);
+	return true;
+}
+
+/// <summary>
+/// Copy the queue's sectors in the range over the buffer, looking up each sector place the range touches
+/// </summary>
+static void overlay_sectors(
+	const writeback_queue_t *queue, int fp, uint32_t offset, uint8_t *buffer, uint32_t length)
+{
+	if (queue->count == 0)
+	{
+		return;
+	}
+
+	for (uint32_t start = offset - offset % WRITEBACK_SECTOR_SIZE; start < offset + length;
+		 start += WRITEBACK_SECTOR_SIZE)
+	{
+		const writeback_sector_t *sector = queue_find(queue, fp, start);
+
+		if (sector == NULL)
+		{
+			continue;
+		}
+
+		uint32_t end  = offset + length;
+		uint32_t from = start > offset ? start : offset;
+		uint32_t to	  = start + WRITEBACK_SECTOR_SIZE < end ? start + WRITEBACK_SECTOR_SIZE : end;
+
+		memcpy(buffer + (from - offset), sector->data + (from - start), to - from);
+	}
+}
+
+/// <summary>
+/// Batches finished so far, taken before reading the file and handed to disk_writeback_overlay
+/// </summary>
+uint32_t disk_writeback_batches(disk_writeback_t *writeback)
+{
+	uint32_t batches;
+
+	pthread_mutex_lock(&writeback->lock);
+	batches = writeback->batches;
+	pthread_mutex_unlock(&writeback->lock);
+	return batches;
+}
+
+/// <summary>
+/// Copy queued sectors over data just read from the file, so a read after a write sees the write before it lands.
+/// Returns false, leaving the buffer alone, when a batch finished since batches was taken. Its sectors have left
+/// the queue and the read may have been too early to see them, read the file again.
+/// </summary>
+bool disk_writeback_overlay(
+	disk_writeback_t *writeback, int fp, uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t batches)
+{
+	bool current;
+
+	pthread_mutex_lock(&writeback->lock);
+	if ((current = writeback->batches == batches))
+	{
+		// The batch being written is older than anything queued since, so it goes first
+		overlay_sectors(writeback->flushing, fp, offset, buffer, length);
+		overlay_sectors(writeback->pending, fp, offset, buffer, length);
+	}
+	pthread_mutex_unlock(&writeback->lock);
+	return current;
+}
+
+/// <summary>
+/// Wait until every sector queued so far is in the image files. Returns false, with the failed sectors still
+/// queued for retry, as soon as a batch has a write fail.
+/// </summary>
+bool disk_writeback_flush(disk_writeback_t *writeback)
+{
+	bool written = true;
+
+	pthread_mutex_lock(&writeback->lock);
+	while (writeback->pending->count != 0 || writeback->flushing->count != 0)
+	{
+		pthread_cond_signal(&writeback->work);
+		pthread_cond_wait(&writeback->drained, &writeback->lock);
+		if (writeback->error != 0)
+		{
+			written = false;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&writeback->lock);
+	return written;
+}
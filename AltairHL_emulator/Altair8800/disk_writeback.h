@@ -0,0 +1,62 @@
+#ifndef _DISK_WRITEBACK_H_
+#define _DISK_WRITEBACK_H_
+
+#include "types.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+#define WRITEBACK_SECTOR_SIZE	137		// an 88-DCDD sector, queued at multiples of it in their files
+#define WRITEBACK_INITIAL		64		// sectors a queue holds before it grows
+#define WRITEBACK_MAX_SECTORS	512		// queued and being written, past it the CPU threads wait for storage
+#define WRITEBACK_INDEX_SLOTS	1024	// a power of two, twice WRITEBACK_MAX_SECTORS keeps probes short
+#define WRITEBACK_RETRY_MS		100		// wait before writing sectors that failed again
+#define WRITEBACK_STOP_RETRIES	3		// tries on stop before sectors that keep failing are given up
+
+typedef struct
+{
+	int fp;
+	uint32_t offset;
+	bool failed; // set by the I/O thread, the sector goes back on the queue
+	uint8_t data[WRITEBACK_SECTOR_SIZE];
+} writeback_sector_t;
+
+// Sectors in the order they were queued, indexed by file and offset so a lookup does not scan them
+typedef struct
+{
+	writeback_sector_t *sectors;
+	size_t count;
+	size_t capacity;
+	uint16_t index[WRITEBACK_INDEX_SLOTS]; // open addressing, the sector's position + 1, 0 for an empty slot
+} writeback_queue_t;
+
+// Sectors written by the CPU threads, written to the image files by one I/O thread. A sector written again before
+// it reaches the file replaces the queued copy, and reads overlay queued sectors so they never see stale data.
+// A sector the file will not take stays queued and is tried again, so reads keep seeing it. At most
+// WRITEBACK_MAX_SECTORS are held, a CPU thread that outruns storage waits for the batch being written.
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t work;	// sectors queued or stopping
+	pthread_cond_t drained; // a batch reached the files
+
+	writeback_queue_t queues[2];
+	writeback_queue_t *pending;	 // queued since the I/O thread took its batch
+	writeback_queue_t *flushing; // batch the I/O thread is writing, read only until it is done
+
+	uint32_t batches; // batches the I/O thread has finished, their sectors are no longer there to overlay
+	int error;		  // errno of the last batch that had a sector fail, 0 once a batch is all written
+	size_t lost;	  // sectors dropped, out of memory to requeue them or still failing on stop
+
+	pthread_t thread;
+	bool stopping;
+} disk_writeback_t;
+
+bool disk_writeback_start(disk_writeback_t *writeback);
+bool disk_writeback_stop(disk_writeback_t *writeback);
+bool disk_writeback_queue(disk_writeback_t *writeback, int fp, uint32_t offset, const uint8_t *sector);
+uint32_t disk_writeback_batches(disk_writeback_t *writeback);
+bool disk_writeback_overlay(
+	disk_writeback_t *writeback, int fp, uint32_t offset, uint8_t *buffer, uint32_t length, uint32_t batches);
+bool disk_writeback_flush(disk_writeback_t *writeback);
+
+#endif
@@ -4,8 +4,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include <applibs/log.h>
-
 #ifdef ARDUINO
 	#include <Arduino.h>
 	#include <SPI.h>
@@ -26,202 +24,88 @@
 #define STATUS_WRITE_OUTPUT		0x02	// inverted!
 #define STATUS_INTERRUPT		0x01
 
-uint8_t get_parity(uint8_t val)
-{
-	val ^= val >> 4;
-	val &= 0xf;
-	return !((0x6996 >> val) & 1);
-}
-
-void i8080_reset(intel8080_t *cpu, port_in in, port_out out, read_sense_switches sense,
+#define FLAGS_SZP			(FLAGS_SIGN | FLAGS_ZERO | FLAGS_PARITY)
+
+// Sign, zero and parity flag bits for every 8 bit result
+// clang-format off
+static const uint8_t szp_table[256] = {
+	0x44, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+	0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04,
+	0x00, 0x04, 0x04, 0x00, 0x04, 0x00, 0x00, 0x04, 0x04, 0x00, 0x00, 0x04, 0x00, 0x04, 0x04, 0x00,
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+	0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80,
+	0x84, 0x80, 0x80, 0x84, 0x80, 0x84, 0x84, 0x80, 0x80, 0x84, 0x84, 0x80, 0x84, 0x80, 0x80, 0x84,
+};
+// clang-format on
+
+void i8080_reset(intel8080_t *cpu, memory_t *memory, void *context, port_in in, port_out out, read_sense_switches sense,
                         disk_controller_t *disk_controller, azure_sphere_port_in sphere_port_in, azure_sphere_port_out sphere_port_out)
 {
 	memset(cpu, 0, sizeof(intel8080_t));
+	cpu->memory = memory;
+	cpu->context = context;
 	cpu->term_in = in;
 	cpu->term_out = out;
 	cpu->_sphere_port_in = sphere_port_in;
 	cpu->_sphere_port_out = sphere_port_out;
 	cpu->disk_controller = *disk_controller;
 	cpu->registers.flags = 0x2;
+	cpu->flags_result = FLAGS_RESOLVED;
 	cpu->sense = sense;
 	cpu->cpuStatus = 0x00;
 }
 
-int i8080_check_carry(uint16_t a, uint16_t b)
-{
-	if((a + b) > 0xff)
-		return 1;
-	else
-		return 0;
-}
-
-int i8080_check_half_carry(uint16_t a, uint16_t b)
-{
-	a &= 0xf;
-	b &= 0xf;
-
-	if((a + b) > 0xf)
-		return 1;
-	else
-		return 0;
-}
 void i8080_mwrite(intel8080_t *cpu)
 {
 	cpu->cpuStatus &= ~(STATUS_MEMORY_READ);
-	write8(cpu->address_bus, cpu->data_bus);
+	write8(cpu->memory, cpu->address_bus, cpu->data_bus);
 }
 
 void i8080_mread(intel8080_t *cpu)
 {
 	{
 		cpu->cpuStatus |= STATUS_MEMORY_READ;
-		cpu->data_bus = read8(cpu->address_bus);
-	}
-}
-
-void i8080_pairwrite(intel8080_t *cpu, uint8_t pair, uint16_t val)
-{
-	cpu->cpuStatus &= ~(STATUS_MEMORY_READ);
-	switch(pair)
-	{
-	case PAIR_BC:
-		cpu->registers.bc = val;
-		break;
-	case PAIR_DE:
-		cpu->registers.de = val;
-		break;
-	case PAIR_HL:
-		cpu->registers.hl = val;
-		break;
-	case PAIR_SP:
-		cpu->registers.sp = val;
-		break;
-	}
-}
-
-uint16_t i8080_pairread(intel8080_t *cpu, uint8_t pair)
-{
-	cpu->cpuStatus |= STATUS_MEMORY_READ;
-	switch(pair)
-	{
-	case PAIR_BC:
-		return cpu->registers.bc;
-		break;
-	case PAIR_DE:
-		return cpu->registers.de;
-		break;
-	case PAIR_HL:
-		return cpu->registers.hl;
-		break;
-	case PAIR_SP:
-		return cpu->registers.sp;
-		break;
-	default:
-		return 0;
-	}
-}
-
-void i8080_regwrite(intel8080_t *cpu, uint8_t reg, uint8_t val)
-{
-	switch(reg)
-	{
-	case REGISTER_A:
-		cpu->registers.a = val;
-		break;
-	case REGISTER_B:
-		cpu->registers.b = val;
-		break;
-	case REGISTER_C:
-		cpu->registers.c = val;
-		break;
-	case REGISTER_D:
-		cpu->registers.d = val;
-		break;
-	case REGISTER_E:
-		cpu->registers.e = val;
-		break;
-	case REGISTER_H:
-		cpu->registers.h = val;
-		break;
-	case REGISTER_L:
-		cpu->registers.l = val;
-		break;
-	case MEMORY_ACCESS:
-		cpu->address_bus = cpu->registers.hl;
-		cpu->data_bus = val;
-		i8080_mwrite(cpu);
+		cpu->data_bus = read8(cpu->memory, cpu->address_bus);
 	}
 }
 
-uint8_t i8080_regread(intel8080_t *cpu, uint8_t reg)
+// The M operand, the byte addressed by HL. It goes through the bus so the front panel sees the cycle.
+static inline uint8_t i8080_read_hl(intel8080_t *cpu)
 {
-	switch(reg)
-	{
-	case REGISTER_A:
-		return cpu->registers.a;
-		break;
-	case REGISTER_B:
-		return cpu->registers.b;
-		break;
-	case REGISTER_C:
-		return cpu->registers.c;
-		break;
-	case REGISTER_D:
-		return cpu->registers.d;
-		break;
-	case REGISTER_E:
-		return cpu->registers.e;
-		break;
-	case REGISTER_H:
-		return cpu->registers.h;
-		break;
-	case REGISTER_L:
-		return cpu->registers.l;
-		break;
-	case MEMORY_ACCESS:
-		cpu->address_bus = cpu->registers.hl;
-		i8080_mread(cpu);
-		return cpu->data_bus;
-	default:
-		return 0;
-	}
+	cpu->address_bus = cpu->registers.hl;
+	i8080_mread(cpu);
+	return cpu->data_bus;
 }
 
-uint8_t i8080_check_condition(intel8080_t *cpu, uint8_t condition)
+static inline void i8080_write_hl(intel8080_t *cpu, uint8_t val)
 {
-	switch(condition)
-	{
-	case CONDITION_NZ:
-		return !(cpu->registers.flags & FLAGS_ZERO);
-	case CONDITION_Z:
-		return (cpu->registers.flags & FLAGS_ZERO);
-	case CONDITION_NC:
-		return !(cpu->registers.flags & FLAGS_CARRY);
-	case CONDITION_C:
-		return (cpu->registers.flags & FLAGS_CARRY);
-	case CONDITION_PO:
-		return !(cpu->registers.flags & FLAGS_PARITY);
-	case CONDITION_PE:
-		return (cpu->registers.flags & FLAGS_PARITY);
-	case CONDITION_P:
-		return !(cpu->registers.flags & FLAGS_SIGN);
-	case CONDITION_M:
-		return (cpu->registers.flags & FLAGS_SIGN);
-	}
-	return 0;
+	cpu->address_bus = cpu->registers.hl;
+	cpu->data_bus = val;
+	i8080_mwrite(cpu);
 }
 
 void i8080_examine(intel8080_t *cpu, uint16_t address)
 {
 	// Jump to the supplied address
 	cpu->registers.pc = cpu->address_bus = address;
-	cpu->data_bus = read8(cpu->address_bus);
+	cpu->halted = false;
+	cpu->data_bus = read8(cpu->memory, cpu->address_bus);
 }
 
 void i8080_examine_next(intel8080_t *cpu)
 {
 	cpu->address_bus++;
-	cpu->data_bus = read8(cpu->address_bus);
+	cpu->data_bus = read8(cpu->memory, cpu->address_bus);
 }
 
 void i8080_deposit(intel8080_t *cpu, uint8_t data)
@@ -247,60 +131,66 @@ void i8080_clear_flag(intel8080_t *cpu, uint8_t flag)
 	cpu->registers.flags &= ~flag;
 }
 
-void i8080_update_flags(intel8080_t *cpu, uint8_t reg, uint8_t mask)
+// Zero, sign and parity are evaluated lazily. Only the result is kept here and the flag bits are
+// worked out when a conditional branch, PUSH PSW or i8080_get_flags reads them.
+static inline void i8080_update_flags(intel8080_t *cpu, uint8_t val)
 {
-	uint8_t val = i8080_regread(cpu, reg);
-	if(mask & FLAGS_PARITY)
-	{
-		if(get_parity(val))
-			i8080_set_flag(cpu, FLAGS_PARITY);
-		else
-			i8080_clear_flag(cpu, FLAGS_PARITY);
-	}
-	if(mask & FLAGS_H)
-	{
-	}
-	if(mask & FLAGS_IF)
-	{
-	}
-	if(mask & FLAGS_ZERO)
-	{
-		if(val == 0)
-			i8080_set_flag(cpu, FLAGS_ZERO);
-		else
-			i8080_clear_flag(cpu, FLAGS_ZERO);
-	}
-	if(mask & FLAGS_SIGN)
+	cpu->flags_result = val;
+}
+
+uint8_t i8080_get_flags(intel8080_t *cpu)
+{
+	if(!(cpu->flags_result & FLAGS_RESOLVED))
 	{
-		if(val & 0x80)
-			i8080_set_flag(cpu, FLAGS_SIGN);
-		else
-			i8080_clear_flag(cpu, FLAGS_SIGN);
+		cpu->registers.flags = (cpu->registers.flags & ~FLAGS_SZP) | szp_table[cpu->flags_result];
+		cpu->flags_result = FLAGS_RESOLVED;
 	}
+	return cpu->registers.flags;
+}
+
+static inline uint8_t i8080_zero(intel8080_t *cpu)
+{
+	if(cpu->flags_result & FLAGS_RESOLVED)
+		return cpu->registers.flags & FLAGS_ZERO;
+	return (uint8_t)cpu->flags_result == 0;
+}
+
+static inline uint8_t i8080_sign(intel8080_t *cpu)
+{
+	if(cpu->flags_result & FLAGS_RESOLVED)
+		return cpu->registers.flags & FLAGS_SIGN;
+	return cpu->flags_result & 0x80;
+}
+
+static inline uint8_t i8080_parity(intel8080_t *cpu)
+{
+	if(cpu->flags_result & FLAGS_RESOLVED)
+		return cpu->registers.flags & FLAGS_PARITY;
+	return szp_table[cpu->flags_result] & FLAGS_PARITY;
+}
+
+/*
+ * Auxiliary carry and carry without branches. a ^ b ^ sum has the carry into every bit of the sum set, so
+ * bit 4 (FLAGS_H) is the carry out of the low nibble. The carry out of bit 7 is bit 8 of the 9 bit sum.
+ */
+static inline void i8080_set_carries(intel8080_t *cpu, uint16_t a, uint16_t b, uint16_t sum, uint8_t carry)
+{
+	cpu->registers.flags = (cpu->registers.flags & ~(FLAGS_H | FLAGS_CARRY)) | ((a ^ b ^ sum) & FLAGS_H) | carry;
 }
 
 void i8080_gensub(intel8080_t *cpu, uint16_t val)
 {
-	uint16_t a, b;
+	uint16_t a, b, sum;
 	// Subtract by adding with two-complement of val. Carry-flag meaning becomes inverted since we add.
 	a = cpu->registers.a;
 	b = 0x100 - val;
+	sum = a + b;
 
-	if(i8080_check_half_carry(a, b))
-		i8080_set_flag(cpu, FLAGS_H);
-	else
-		i8080_clear_flag(cpu, FLAGS_H);
-
-	if(i8080_check_carry(a, b))
-		i8080_clear_flag(cpu, FLAGS_CARRY);
-	else
-		i8080_set_flag(cpu, FLAGS_CARRY);
-
-	a += b ;
+	i8080_set_carries(cpu, a, b, sum, ((sum >> 8) & FLAGS_CARRY) ^ FLAGS_CARRY);
 
-	cpu->registers.a = a & 0xff;
+	cpu->registers.a = sum & 0xff;
 
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
+	i8080_update_flags(cpu, cpu->registers.a);
 }
 
 void i8080_compare(intel8080_t *cpu, uint8_t val)
@@ -310,55 +200,303 @@ void i8080_compare(intel8080_t *cpu, uint8_t val)
 	cpu->registers.a = tmp_a;
 }
 
-uint8_t i8080_mov(intel8080_t *cpu)
+void i8080_genadd(intel8080_t *cpu, uint16_t val)
 {
-	uint8_t dest = DESTINATION(cpu->current_op_code);
-	uint8_t source = SOURCE(cpu->current_op_code);
-	uint8_t val;
-	uint8_t cycles;
+	uint16_t a, sum;
 
-	if(dest == MEMORY_ACCESS || source == MEMORY_ACCESS)
-		cycles = CYCLES_MOV_MEM;
-	else
-		cycles = CYCLES_MOV_REG;
+	a = cpu->registers.a;
+	sum = a + val;
 
-	val = i8080_regread(cpu, source);
-	i8080_regwrite(cpu, dest, val);
-	cpu->registers.pc++;
+	i8080_set_carries(cpu, a, val, sum, (sum >> 8) & FLAGS_CARRY);
+
+	cpu->registers.a = sum & 0xff;
 
-	return cycles;
+	i8080_update_flags(cpu, cpu->registers.a);
 }
 
-uint8_t i8080_mvi(intel8080_t *cpu)
+// ANA leaves the auxiliary carry alone, ANI, ORA and XRA clear it
+void i8080_genand(intel8080_t *cpu, uint8_t val)
 {
-	uint8_t dest = DESTINATION(cpu->current_op_code);
-	uint8_t cycles;
+	cpu->registers.a &= val;
+	i8080_clear_flag(cpu, FLAGS_CARRY);
+	i8080_update_flags(cpu, cpu->registers.a);
+}
 
-	if(dest == MEMORY_ACCESS)
-		cycles = CYCLES_MVI_MEM;
-	else
-		cycles = CYCLES_MVI_REG;
+void i8080_genor(intel8080_t *cpu, uint8_t val)
+{
+	cpu->registers.a |= val;
+	i8080_clear_flag(cpu, FLAGS_CARRY | FLAGS_H);
+	i8080_update_flags(cpu, cpu->registers.a);
+}
 
-	i8080_regwrite(cpu, dest, read8(cpu->registers.pc+1));
+void i8080_genxor(intel8080_t *cpu, uint8_t val)
+{
+	cpu->registers.a ^= val;
+	i8080_clear_flag(cpu, FLAGS_CARRY | FLAGS_H);
+	i8080_update_flags(cpu, cpu->registers.a);
+}
 
-	cpu->registers.pc+=2;
+// INR and DCR leave the carry alone. DCR adds 0xff, so its auxiliary carry is set unless the low nibble was 0.
+uint8_t i8080_geninr(intel8080_t *cpu, uint8_t val)
+{
+	uint16_t sum = val + 1;
 
-	return cycles;
+	cpu->registers.flags = (cpu->registers.flags & ~FLAGS_H) | ((val ^ 1 ^ sum) & FLAGS_H);
+	i8080_update_flags(cpu, (uint8_t)sum);
+	return (uint8_t)sum;
 }
 
-uint8_t i8080_lxi(intel8080_t *cpu)
+uint8_t i8080_gendcr(intel8080_t *cpu, uint8_t val)
 {
-	uint8_t pair = RP(cpu->current_op_code);
-
-	i8080_pairwrite(cpu, pair, read16(cpu->registers.pc+1));
-	cpu->registers.pc+=3;
+	uint16_t sum = val + 0xff;
 
-	return CYCLES_LXI;
+	cpu->registers.flags = (cpu->registers.flags & ~FLAGS_H) | ((val ^ 0xff ^ sum) & FLAGS_H);
+	i8080_update_flags(cpu, (uint8_t)sum);
+	return (uint8_t)sum;
 }
 
+/*
+ * Operand and condition accessors used to stamp out one handler per op code. The register, register pair
+ * and condition are fixed when the handler is generated so nothing is decoded from the op code at run time.
+ */
+#define REG_NUMBER_b			REG_B
+#define REG_NUMBER_c			REG_C
+#define REG_NUMBER_d			REG_D
+#define REG_NUMBER_e			REG_E
+#define REG_NUMBER_h			REG_H
+#define REG_NUMBER_l			REG_L
+#define REG_NUMBER_m			REG_M
+#define REG_NUMBER_a			REG_A
+
+// The register number is a constant in each handler, so these fold to a direct register file access or the M bus cycle
+#define OPERAND(cpu, reg)											\
+	(REG_NUMBER_##reg == REG_M ? i8080_read_hl(cpu) : (cpu)->registers.r[I8080_REG(REG_NUMBER_##reg)])
+
+#define STORE(cpu, reg, val)										\
+	do																\
+	{																\
+		if (REG_NUMBER_##reg == REG_M)								\
+			i8080_write_hl(cpu, val);								\
+		else														\
+			(cpu)->registers.r[I8080_REG(REG_NUMBER_##reg)] = (val);	\
+	} while (0)
+
+// Register operands take reg T-states, the memory operand M takes mem
+#define OPERAND_CYCLES(reg, reg_cycles, mem_cycles)					\
+	(REG_NUMBER_##reg == REG_M ? (mem_cycles) : (reg_cycles))
+
+#define CONDITION_nz(cpu)		(!i8080_zero(cpu))
+#define CONDITION_z(cpu)		i8080_zero(cpu)
+#define CONDITION_nc(cpu)		(!((cpu)->registers.flags & FLAGS_CARRY))
+#define CONDITION_c(cpu)		((cpu)->registers.flags & FLAGS_CARRY)
+#define CONDITION_po(cpu)		(!i8080_parity(cpu))
+#define CONDITION_pe(cpu)		i8080_parity(cpu)
+#define CONDITION_p(cpu)		(!i8080_sign(cpu))
+#define CONDITION_m(cpu)		i8080_sign(cpu)
+
+#define CARRY_IN(cpu)			((cpu)->registers.flags & FLAGS_CARRY)
+
+#define I8080_MOV(dst, src, cycles)										\
+	static uint8_t i8080_mov_##dst##_##src(intel8080_t *cpu)			\
+	{																	\
+		STORE(cpu, dst, OPERAND(cpu, src));							\
+		cpu->registers.pc++;											\
+		return cycles;													\
+	}
+
+#define I8080_MOV_ROW(dst, cycles)										\
+	I8080_MOV(dst, b, cycles)											\
+	I8080_MOV(dst, c, cycles)											\
+	I8080_MOV(dst, d, cycles)											\
+	I8080_MOV(dst, e, cycles)											\
+	I8080_MOV(dst, h, cycles)											\
+	I8080_MOV(dst, l, cycles)											\
+	I8080_MOV(dst, m, CYCLES_MOV_MEM)									\
+	I8080_MOV(dst, a, cycles)
+
+#define I8080_MVI(dst, cycles)											\
+	static uint8_t i8080_mvi_##dst(intel8080_t *cpu)					\
+	{																	\
+		STORE(cpu, dst, read8(cpu->memory, cpu->registers.pc + 1));				\
+		cpu->registers.pc += 2;											\
+		return cycles;													\
+	}
+
+#define I8080_INR_DCR(reg)												\
+	static uint8_t i8080_inr_##reg(intel8080_t *cpu)					\
+	{																	\
+		STORE(cpu, reg, i8080_geninr(cpu, OPERAND(cpu, reg)));		\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(reg, CYCLES_INR, CYCLES_INR_MEM);		\
+	}																	\
+	static uint8_t i8080_dcr_##reg(intel8080_t *cpu)					\
+	{																	\
+		STORE(cpu, reg, i8080_gendcr(cpu, OPERAND(cpu, reg)));		\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(reg, CYCLES_DCR, CYCLES_DCR_MEM);		\
+	}
+
+#define I8080_ALU(src)													\
+	static uint8_t i8080_add_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_genadd(cpu, OPERAND(cpu, src));						\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_ADD, CYCLES_ALU_MEM);		\
+	}																	\
+	static uint8_t i8080_adc_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_genadd(cpu, (uint16_t)(OPERAND(cpu, src) + CARRY_IN(cpu)));	\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_ADC, CYCLES_ALU_MEM);		\
+	}																	\
+	static uint8_t i8080_sub_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_gensub(cpu, OPERAND(cpu, src));						\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_SUB, CYCLES_ALU_MEM);		\
+	}																	\
+	static uint8_t i8080_sbb_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_gensub(cpu, (uint16_t)(OPERAND(cpu, src) + CARRY_IN(cpu)));	\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_SBB, CYCLES_ALU_MEM);		\
+	}																	\
+	static uint8_t i8080_ana_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_genand(cpu, OPERAND(cpu, src));						\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_ANA, CYCLES_ALU_MEM);		\
+	}																	\
+	static uint8_t i8080_xra_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_genxor(cpu, OPERAND(cpu, src));						\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_XRA, CYCLES_ALU_MEM);		\
+	}																	\
+	static uint8_t i8080_ora_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_genor(cpu, OPERAND(cpu, src));						\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_ORA, CYCLES_ALU_MEM);		\
+	}																	\
+	static uint8_t i8080_cmp_##src(intel8080_t *cpu)					\
+	{																	\
+		i8080_compare(cpu, OPERAND(cpu, src));						\
+		cpu->registers.pc++;											\
+		return OPERAND_CYCLES(src, CYCLES_CMP, CYCLES_ALU_MEM);		\
+	}
+
+#define I8080_PAIR_OPS(rp)												\
+	static uint8_t i8080_lxi_##rp(intel8080_t *cpu)						\
+	{																	\
+		cpu->cpuStatus &= ~(STATUS_MEMORY_READ);						\
+		cpu->registers.rp = read16(cpu->memory, cpu->registers.pc + 1);				\
+		cpu->registers.pc += 3;											\
+		return CYCLES_LXI;												\
+	}																	\
+	static uint8_t i8080_inx_##rp(intel8080_t *cpu)						\
+	{																	\
+		cpu->cpuStatus &= ~(STATUS_MEMORY_READ);						\
+		cpu->registers.rp++;											\
+		cpu->registers.pc++;											\
+		return CYCLES_INX;												\
+	}																	\
+	static uint8_t i8080_dcx_##rp(intel8080_t *cpu)						\
+	{																	\
+		cpu->cpuStatus &= ~(STATUS_MEMORY_READ);						\
+		cpu->registers.rp--;											\
+		cpu->registers.pc++;											\
+		return CYCLES_DCX;												\
+	}																	\
+	static uint8_t i8080_dad_##rp(intel8080_t *cpu)						\
+	{																	\
+		uint32_t val = (uint32_t)cpu->registers.rp + cpu->registers.hl;	\
+		if(val > 0xffff)												\
+			i8080_set_flag(cpu, FLAGS_CARRY);							\
+		else															\
+			i8080_clear_flag(cpu, FLAGS_CARRY);							\
+		cpu->cpuStatus &= ~(STATUS_MEMORY_READ);						\
+		cpu->registers.hl = val & 0xffff;								\
+		cpu->registers.pc++;											\
+		return CYCLES_DAD;												\
+	}
+
+// PUSH PSW and POP PSW are written out below as the flags have to be resolved first
+#define I8080_STACK_OPS(rp, status)										\
+	static uint8_t i8080_push_##rp(intel8080_t *cpu)					\
+	{																	\
+		cpu->cpuStatus |= STATUS_STACK | (status);						\
+		cpu->registers.sp -= 2;											\
+		write16(cpu->memory, cpu->registers.sp, cpu->registers.rp);					\
+		cpu->registers.pc++;											\
+		return CYCLES_PUSH;												\
+	}																	\
+	static uint8_t i8080_pop_##rp(intel8080_t *cpu)						\
+	{																	\
+		cpu->cpuStatus |= STATUS_STACK;									\
+		cpu->cpuStatus &= ~(status);									\
+		cpu->registers.rp = read16(cpu->memory, cpu->registers.sp);					\
+		cpu->registers.sp += 2;											\
+		cpu->registers.pc++;											\
+		return CYCLES_POP;												\
+	}
+
+#define I8080_INDIRECT_OPS(rp)											\
+	static uint8_t i8080_ldax_##rp(intel8080_t *cpu)					\
+	{																	\
+		cpu->cpuStatus |= STATUS_MEMORY_READ;							\
+		cpu->registers.a = read8(cpu->memory, cpu->registers.rp);					\
+		cpu->registers.pc++;											\
+		return CYCLES_LDAX;												\
+	}																	\
+	static uint8_t i8080_stax_##rp(intel8080_t *cpu)					\
+	{																	\
+		cpu->cpuStatus |= STATUS_MEMORY_READ;							\
+		write8(cpu->memory, cpu->registers.rp, cpu->registers.a);					\
+		cpu->registers.pc++;											\
+		return CYCLES_STAX;												\
+	}
+
+#define I8080_BRANCH_OPS(cond)											\
+	static uint8_t i8080_j##cond(intel8080_t *cpu)						\
+	{																	\
+		if(CONDITION_##cond(cpu))										\
+			i8080_jmp(cpu);												\
+		else															\
+			cpu->registers.pc += 3;										\
+		return CYCLES_JMP;												\
+	}																	\
+	static uint8_t i8080_c##cond(intel8080_t *cpu)						\
+	{																	\
+		if(CONDITION_##cond(cpu))										\
+			return i8080_call(cpu);										\
+		cpu->registers.pc += 3;											\
+		return CYCLES_CALL_SKIPPED;										\
+	}																	\
+	static uint8_t i8080_r##cond(intel8080_t *cpu)						\
+	{																	\
+		if(CONDITION_##cond(cpu))										\
+		{																\
+			i8080_ret(cpu);												\
+			return CYCLES_RET_COND;										\
+		}																\
+		cpu->registers.pc++;											\
+		return CYCLES_RET_SKIPPED;										\
+	}
+
+#define I8080_RST(vec)													\
+	static uint8_t i8080_rst_##vec(intel8080_t *cpu)					\
+	{																	\
+		cpu->cpuStatus |= STATUS_STACK;									\
+		cpu->registers.sp -= 2;											\
+		write16(cpu->memory, cpu->registers.sp, cpu->registers.pc + 1);				\
+		cpu->registers.pc = vec * 8;									\
+		return CYCLES_RST;												\
+	}
+
 uint8_t i8080_lda(intel8080_t *cpu)
 {
-	cpu->address_bus = read16(cpu->registers.pc+1);
+	cpu->address_bus = read16(cpu->memory, cpu->registers.pc+1);
 	i8080_mread(cpu);
 	cpu->registers.a = cpu->data_bus;
 
@@ -368,7 +506,7 @@ uint8_t i8080_lda(intel8080_t *cpu)
 
 uint8_t i8080_sta(intel8080_t *cpu)
 {
-	cpu->address_bus = read16(cpu->registers.pc+1);
+	cpu->address_bus = read16(cpu->memory, cpu->registers.pc+1);
 	cpu->data_bus = cpu->registers.a;
 	i8080_mwrite(cpu);
 
@@ -378,37 +516,18 @@ uint8_t i8080_sta(intel8080_t *cpu)
 
 uint8_t i8080_lhld(intel8080_t *cpu)
 {
-	cpu->registers.hl = read16(read16(cpu->registers.pc+1));
+	cpu->registers.hl = read16(cpu->memory, read16(cpu->memory, cpu->registers.pc+1));
 	cpu->registers.pc+=3;
 	return CYCLES_LHLD;
 }
 
 uint8_t i8080_shld(intel8080_t *cpu)
 {
-	write16(read16(cpu->registers.pc+1), cpu->registers.hl);
+	write16(cpu->memory, read16(cpu->memory, cpu->registers.pc+1), cpu->registers.hl);
 	cpu->registers.pc+=3;
 	return CYCLES_SHLD;
 }
 
-// TODO: only BC and DE allowed for indirect
-uint8_t i8080_ldax(intel8080_t *cpu)
-{
-	uint8_t pair = RP(cpu->current_op_code);
-
-	cpu->registers.a = read8(i8080_pairread(cpu, pair));
-	cpu->registers.pc++;
-	return CYCLES_LDAX;
-}
-
-// TODO: only BC and DE allowed for indirect
-uint8_t i8080_stax(intel8080_t *cpu)
-{
-	uint8_t pair = RP(cpu->current_op_code);
-	write8(i8080_pairread(cpu, pair), cpu->registers.a);
-	cpu->registers.pc++;
-	return CYCLES_STAX;
-}
-
 uint8_t i8080_xchg(intel8080_t *cpu)
 {
 	uint16_t tmp = cpu->registers.hl;
@@ -419,60 +538,17 @@ uint8_t i8080_xchg(intel8080_t *cpu)
 	return CYCLES_XCHG;
 }
 
-void i8080_genadd(intel8080_t *cpu, uint16_t val)
-{
-	uint8_t a;
-
-	a = i8080_regread(cpu, REGISTER_A);
-
-	if(i8080_check_half_carry(a, val))
-		i8080_set_flag(cpu, FLAGS_H);
-	else
-		i8080_clear_flag(cpu, FLAGS_H);
-
-	if(i8080_check_carry(a, val))
-		i8080_set_flag(cpu, FLAGS_CARRY);
-	else
-		i8080_clear_flag(cpu, FLAGS_CARRY);
-
-	cpu->registers.a += val;
-
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
-}
-
-
-uint8_t i8080_add(intel8080_t *cpu)
-{
-	uint8_t source = SOURCE(cpu->current_op_code);
-	uint8_t val = i8080_regread(cpu, source);
-	i8080_genadd(cpu, val);
-	cpu->registers.pc++;
-	return CYCLES_ADD;
-}
-
 uint8_t i8080_adi(intel8080_t *cpu)
 {
-	i8080_genadd(cpu, read8(cpu->registers.pc+1));
+	i8080_genadd(cpu, read8(cpu->memory, cpu->registers.pc+1));
 	cpu->registers.pc+=2;
 	return CYCLES_ADI;
 }
 
-uint8_t i8080_adc(intel8080_t *cpu)
-{
-	uint8_t source = SOURCE(cpu->current_op_code);
-	uint16_t val = i8080_regread(cpu, source);
-
-	if(cpu->registers.flags & FLAGS_CARRY)
-		val++;
-	i8080_genadd(cpu, val);
-	cpu->registers.pc++;
-	return CYCLES_ADC;
-}
-
 uint8_t i8080_aci(intel8080_t *cpu)
 {
 	uint16_t val;
-	val = read8(cpu->registers.pc+1);
+	val = read8(cpu->memory, cpu->registers.pc+1);
 	if(cpu->registers.flags & FLAGS_CARRY)
 		val++;
 	i8080_genadd(cpu, val);
@@ -480,39 +556,17 @@ uint8_t i8080_aci(intel8080_t *cpu)
 	return CYCLES_ACI;
 }
 
-uint8_t i8080_sub(intel8080_t *cpu)
-{
-	uint8_t source = SOURCE(cpu->current_op_code);
-	uint8_t val = i8080_regread(cpu, source);
-	i8080_gensub(cpu, val);
-	cpu->registers.pc++;
-	return CYCLES_SUB;
-}
-
 uint8_t i8080_sui(intel8080_t *cpu)
 {
-	i8080_gensub(cpu, read8(cpu->registers.pc+1));
+	i8080_gensub(cpu, read8(cpu->memory, cpu->registers.pc+1));
 	cpu->registers.pc+=2;
 	return CYCLES_SUI;
 }
 
-uint8_t i8080_sbb(intel8080_t *cpu)
-{
-	uint8_t source = SOURCE(cpu->current_op_code);
-	uint16_t val = i8080_regread(cpu, source);
-
-	if(cpu->registers.flags & FLAGS_CARRY)
-		val++;
-
-	i8080_gensub(cpu, val);
-	cpu->registers.pc++;
-	return CYCLES_SBB;
-}
-
 uint8_t i8080_sbi(intel8080_t *cpu)
 {
 	uint16_t val;
-	val = read8(cpu->registers.pc+1);
+	val = read8(cpu->memory, cpu->registers.pc+1);
 	if(cpu->registers.flags & FLAGS_CARRY)
 		val++;
 	i8080_gensub(cpu, val);
@@ -520,163 +574,111 @@ uint8_t i8080_sbi(intel8080_t *cpu)
 	return CYCLES_SBI;
 }
 
-uint8_t i8080_inr(intel8080_t *cpu)
+uint8_t i8080_ani(intel8080_t *cpu)
 {
-	uint8_t dest = DESTINATION(cpu->current_op_code);
-	uint8_t val = i8080_regread(cpu, dest);
-
-	if(i8080_check_half_carry(val, 1))
-		i8080_set_flag(cpu, FLAGS_H);
-	else
-		i8080_clear_flag(cpu, FLAGS_H);
-
-	i8080_regwrite(cpu, dest, val + 1);
+	i8080_genand(cpu, read8(cpu->memory, cpu->registers.pc+1));
+	i8080_clear_flag(cpu, FLAGS_H);
 
-	i8080_update_flags(cpu, dest, FLAGS_ZERO | FLAGS_PARITY | FLAGS_SIGN | FLAGS_H);
-	cpu->registers.pc++;
-	return CYCLES_INR;
+	cpu->registers.pc+=2;
+	return CYCLES_ANI;
 }
 
-uint8_t i8080_dcr(intel8080_t *cpu)
+uint8_t i8080_ori(intel8080_t *cpu)
 {
-	uint8_t dest = DESTINATION(cpu->current_op_code);
-	uint8_t val = i8080_regread(cpu, dest);
+	i8080_genor(cpu, read8(cpu->memory, cpu->registers.pc+1));
 
-	if(i8080_check_half_carry(val, 0xff))
-		i8080_set_flag(cpu, FLAGS_H);
-	else
-		i8080_clear_flag(cpu, FLAGS_H);
-
-	i8080_regwrite(cpu, dest, val + 0xff);
-	i8080_update_flags(cpu, dest, FLAGS_ZERO | FLAGS_PARITY | FLAGS_SIGN | FLAGS_H);
-	cpu->registers.pc++;
-	return CYCLES_DCR;
+	cpu->registers.pc+=2;
+	return CYCLES_ORI;
 }
 
-uint8_t i8080_inx(intel8080_t *cpu)
+uint8_t i8080_xri(intel8080_t *cpu)
 {
-	uint8_t rp = RP(cpu->current_op_code);
-	i8080_pairwrite(cpu, rp, i8080_pairread(cpu, rp) + 1);
-	cpu->registers.pc++;
-	return CYCLES_INX;
-}
+	i8080_genxor(cpu, read8(cpu->memory, cpu->registers.pc+1));
 
-uint8_t i8080_dcx(intel8080_t *cpu)
-{
-	uint8_t rp = RP(cpu->current_op_code);
-	cpu->registers.pc++;
-	i8080_pairwrite(cpu, rp, i8080_pairread(cpu, rp) - 1);
-	return CYCLES_DCX;
+	cpu->registers.pc+=2;
+	return CYCLES_XRI;
 }
 
-uint8_t i8080_dad(intel8080_t *cpu)
+uint8_t i8080_ei(intel8080_t *cpu)
 {
-	uint8_t rp = RP(cpu->current_op_code);
-	uint32_t val = i8080_pairread(cpu, rp);
-	val += i8080_pairread(cpu, PAIR_HL);
-
-	if(val > 0xffff)
-		i8080_set_flag(cpu, FLAGS_CARRY);
-	else
-		i8080_clear_flag(cpu, FLAGS_CARRY);
-
-	i8080_pairwrite(cpu, PAIR_HL, val & 0xffff);
-
 	cpu->registers.pc++;
+	cpu->interrupt_enable = true;
 
-	return CYCLES_DAD;
+	// A pending interrupt is taken after the instruction following EI
+	if (atomic_load_explicit(&cpu->interrupt_request, memory_order_relaxed))
+	{
+		atomic_store_explicit(&cpu->run_until, cpu->cycles + CYCLES_EI + 1, memory_order_relaxed);
+	}
+	return CYCLES_EI;
 }
 
-uint8_t i8080_ana(intel8080_t *cpu)
+uint8_t i8080_di(intel8080_t *cpu)
 {
-	uint8_t source = SOURCE(cpu->current_op_code);
-
-	cpu->registers.a &= i8080_regread(cpu, source);
-	i8080_clear_flag(cpu, FLAGS_CARRY);
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
-
 	cpu->registers.pc++;
-	return CYCLES_ANA;
-}
-
-uint8_t i8080_ani(intel8080_t *cpu)
-{
-	cpu->registers.a &= read8(cpu->registers.pc+1);
-	i8080_clear_flag(cpu, FLAGS_CARRY);
-	i8080_clear_flag(cpu, FLAGS_H);
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
-
-	cpu->registers.pc+=2;
-	return CYCLES_ANI;
+	cpu->interrupt_enable = false;
+	return CYCLES_DI;
 }
 
-uint8_t i8080_ora(intel8080_t *cpu)
+uint8_t i8080_hlt(intel8080_t *cpu)
 {
-	uint8_t source = SOURCE(cpu->current_op_code);
-
-	cpu->registers.a |= i8080_regread(cpu, source);
-	i8080_clear_flag(cpu, FLAGS_CARRY);
-	i8080_clear_flag(cpu, FLAGS_H);
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
-
+	cpu->cpuStatus |= STATUS_HALT;
 	cpu->registers.pc++;
-	return CYCLES_ORA;
+	cpu->halted = true;
+	atomic_store_explicit(&cpu->run_until, 0, memory_order_relaxed);
+	return CYCLES_HLT;
 }
 
-uint8_t i8080_ori(intel8080_t *cpu)
+/// <summary>
+/// Request an RST vector interrupt, taken at the next instruction boundary once interrupts are enabled.
+/// Safe to call from any thread, the run loop sees run_until drop to 0 and stops to take it.
+/// </summary>
+void i8080_interrupt(intel8080_t *cpu, uint8_t vector)
 {
-	cpu->registers.a |= read8(cpu->registers.pc+1);
-	i8080_clear_flag(cpu, FLAGS_CARRY);
-	i8080_clear_flag(cpu, FLAGS_H);
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
-
-	cpu->registers.pc+=2;
-	return CYCLES_ORI;
+	atomic_store(&cpu->interrupt_request, (uint8_t)(0xc7 | (vector & 7) << 3));
+	atomic_store(&cpu->run_until, 0);
 }
 
-uint8_t i8080_xra(intel8080_t *cpu)
+static void i8080_take_interrupt(intel8080_t *cpu)
 {
-	uint8_t source = SOURCE(cpu->current_op_code);
-
-	cpu->registers.a ^= i8080_regread(cpu, source);
-	i8080_clear_flag(cpu, FLAGS_CARRY);
-	i8080_clear_flag(cpu, FLAGS_H);
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
+	cpu->cpuStatus |= STATUS_INTERRUPT | STATUS_STACK;
+	cpu->registers.sp -= 2;
+	write16(cpu->memory, cpu->registers.sp, cpu->registers.pc);
+	cpu->registers.pc = atomic_exchange(&cpu->interrupt_request, 0) & 0x38;
 
-	cpu->registers.pc++;
-	return CYCLES_XRA;
+	cpu->interrupt_enable = false;
+	cpu->halted			   = false;
+	cpu->cycles += CYCLES_RST;
 }
 
-uint8_t i8080_xri(intel8080_t *cpu)
+/// <summary>
+/// Take any pending interrupt, then decide if a run should carry on dispatching up to end T-states
+/// </summary>
+bool i8080_run_continue(intel8080_t *cpu, uint64_t end)
 {
-	cpu->registers.a ^= read8(cpu->registers.pc+1);
-	i8080_clear_flag(cpu, FLAGS_CARRY);
-	i8080_clear_flag(cpu, FLAGS_H);
-	i8080_update_flags(cpu, REGISTER_A, FLAGS_ZERO | FLAGS_SIGN | FLAGS_PARITY | FLAGS_CARRY | FLAGS_H);
-
-	cpu->registers.pc+=2;
-	return CYCLES_XRI;
-}
+	if (atomic_load(&cpu->interrupt_request) && cpu->interrupt_enable)
+	{
+		i8080_take_interrupt(cpu);
+	}
 
-uint8_t i8080_ei(intel8080_t *cpu)
-{
-	cpu->registers.pc++;
-	i8080_set_flag(cpu, FLAGS_IF);
-	return CYCLES_EI;
-}
+	if (cpu->halted || cpu->cycles >= end)
+	{
+		return false;
+	}
 
-uint8_t i8080_di(intel8080_t *cpu)
-{
-	cpu->registers.pc++;
-	i8080_clear_flag(cpu, FLAGS_IF);
-	return CYCLES_DI;
+	// An interrupt requested since the check above may have had its 0 overwritten, look again after the store
+	atomic_store(&cpu->run_until, end);
+	if (atomic_load(&cpu->interrupt_request) && cpu->interrupt_enable)
+	{
+		atomic_store_explicit(&cpu->run_until, 0, memory_order_relaxed);
+	}
+	return true;
 }
 
 uint8_t i8080_xthl(intel8080_t *cpu)
 {
-	uint16_t temp = read16(cpu->registers.sp);
+	uint16_t temp = read16(cpu->memory, cpu->registers.sp);
 
-	write16(cpu->registers.sp, cpu->registers.hl);
+	write16(cpu->memory, cpu->registers.sp, cpu->registers.hl);
 	cpu->registers.hl = temp;
 	cpu->registers.pc++;
 	return CYCLES_XTHL;
@@ -689,10 +691,37 @@ uint8_t i8080_sphl(intel8080_t *cpu)
 	return CYCLES_SPHL;
 }
 
+/// <summary>
+/// Count console status polls that found no input and mark the CPU idle once it is clearly spinning in a wait loop
+/// </summary>
+static void i8080_console_poll(intel8080_t *cpu, bool have_input)
+{
+	uint16_t pc = cpu->registers.pc;
+
+	if (have_input)
+	{
+		cpu->idle_polls = 0;
+	}
+	else if ((uint16_t)(pc - cpu->idle_poll_pc + IDLE_POLL_PC_RANGE) <= 2 * IDLE_POLL_PC_RANGE &&
+		cpu->cycles - cpu->idle_poll_cycles <= IDLE_POLL_CYCLES)
+	{
+		if (++cpu->idle_polls >= IDLE_POLL_THRESHOLD)
+		{
+			cpu->idle = true;
+		}
+	}
+	else
+	{
+		cpu->idle_polls = 1;
+	}
+
+	cpu->idle_poll_pc	  = pc;
+	cpu->idle_poll_cycles = cpu->cycles;
+}
+
 uint8_t i8080_in(intel8080_t *cpu)
 {
-	static uint8_t character = 0;
-	uint8_t port = read8(cpu->registers.pc + 1);
+	uint8_t port = read8(cpu->memory, cpu->registers.pc + 1);
 
 	switch(port)
 	{
@@ -701,46 +730,48 @@ uint8_t i8080_in(intel8080_t *cpu)
 		break;
 	case 0x1:
 		cpu->cpuStatus |= STATUS_PORT_INPUT;
-		cpu->registers.a = cpu->term_in();
-		// cpu->term_out(cpu->registers.a);
+		cpu->registers.a = cpu->term_in(cpu->context);
+		// cpu->term_out(cpu->context, cpu->registers.a);
+		i8080_console_poll(cpu, cpu->registers.a);
 		break;
 	case 0x8:
-		cpu->registers.a = cpu->disk_controller.disk_status();
+		cpu->registers.a = cpu->disk_controller.disk_status(cpu->disk_controller.context);
 		break;
 	case 0x9:
-		cpu->registers.a = cpu->disk_controller.sector();
+		cpu->registers.a = cpu->disk_controller.sector(cpu->disk_controller.context);
 		break;
 	case 0xa:
-		cpu->registers.a = cpu->disk_controller.read();
+		cpu->registers.a = cpu->disk_controller.read(cpu->disk_controller.context);
 		break;
 	case 0x10: // 2SIO port 1, status
 		cpu->registers.a = 0x2; // bit 1 == transmit buffer empty
-		if(!character)
+		if(!cpu->serial_rx_character)
 		{
-			character = cpu->term_in();
+			cpu->serial_rx_character = cpu->term_in(cpu->context);
 		}
-		if(character)
+		if(cpu->serial_rx_character)
 		{
 			cpu->registers.a |= 0x1;
 		}
+		i8080_console_poll(cpu, cpu->serial_rx_character);
 		break;
 	case 0x11: // 2SIO port 1, read
-		if(character)
+		if(cpu->serial_rx_character)
 		{
-			cpu->registers.a = character;
-			character = 0;
+			cpu->registers.a = cpu->serial_rx_character;
+			cpu->serial_rx_character = 0;
 		}
 		else
 		{
-			cpu->registers.a = cpu->term_in();
+			cpu->registers.a = cpu->term_in(cpu->context);
 		}
 		break;
 	case 0xff: // Front panel switches
-		cpu->registers.a = cpu->sense();
+		cpu->registers.a = cpu->sense(cpu->context);
 		break;
 	default:
 		cpu->registers.a = 0xff;
-		cpu->registers.a = cpu->_sphere_port_in(port);
+		cpu->registers.a = cpu->_sphere_port_in(cpu->context, port);
 		//printf("IN PORT %x\n", cpu->data_bus);
 		break;
 	}
@@ -751,64 +782,56 @@ uint8_t i8080_in(intel8080_t *cpu)
 
 uint8_t i8080_out(intel8080_t *cpu)
 {
-	uint8_t port = read8(cpu->registers.pc + 1);
+	uint8_t port = read8(cpu->memory, cpu->registers.pc + 1);
 	switch(port)
 	{
 	case 0x1:
 		cpu->cpuStatus |= STATUS_PORT_OUTPUT;
-		cpu->term_out(cpu->registers.a);
+		cpu->term_out(cpu->context, cpu->registers.a);
 		break;
 	case 0x8:
-		cpu->disk_controller.disk_select(cpu->registers.a);
+		cpu->disk_controller.disk_select(cpu->disk_controller.context, cpu->registers.a);
 		break;
 	case 0x9:
-		cpu->disk_controller.disk_function(cpu->registers.a);
+		cpu->disk_controller.disk_function(cpu->disk_controller.context, cpu->registers.a);
 		break;
 	case 0xa:
-		cpu->disk_controller.write(cpu->registers.a);
+		cpu->disk_controller.write(cpu->disk_controller.context, cpu->registers.a);
 		break;
 	case 0x10:  // 2SIO port 1 control
+		cpu->serial_rx_interrupt = cpu->registers.a & 0x80;
 		break;
 	case 0x11: // 2sio port 1 write
-		cpu->term_out(cpu->registers.a);
+		cpu->term_out(cpu->context, cpu->registers.a);
 		break;
 	default:
-		cpu->_sphere_port_out(port,cpu->registers.a);
-		// printf("OUT PORT %x, DATA: %x\n", read8(cpu->registers.pc + 1), cpu->registers.a);
+		cpu->_sphere_port_out(cpu->context, port, cpu->registers.a);
+		// printf("OUT PORT %x, DATA: %x\n", read8(cpu->memory, cpu->registers.pc + 1), cpu->registers.a);
 		break;
 	}
 	cpu->registers.pc+=2;
 	return CYCLES_OUT;
 }
 
-uint8_t i8080_push(intel8080_t *cpu)
+uint8_t i8080_push_psw(intel8080_t *cpu)
 {
 	cpu->cpuStatus |= STATUS_STACK;
-	uint8_t pair = RP(cpu->current_op_code);
-	uint16_t val;
-
-	if(pair == PAIR_SP)
-		val = cpu->registers.af;
-	else
-		val = i8080_pairread(cpu, pair);
+	i8080_get_flags(cpu);
 
 	cpu->registers.sp-=2;
-	write16(cpu->registers.sp, val);
+	write16(cpu->memory, cpu->registers.sp, (uint16_t)(cpu->registers.a << 8 | cpu->registers.flags));
 
 	cpu->registers.pc++;
 	return CYCLES_PUSH;
 }
 
-uint8_t i8080_pop(intel8080_t *cpu)
+uint8_t i8080_pop_psw(intel8080_t *cpu)
 {
 	cpu->cpuStatus |= STATUS_STACK;
-	uint8_t pair = RP(cpu->current_op_code);
-	uint16_t val = read16(cpu->registers.sp);
+	cpu->registers.flags = read8(cpu->memory, cpu->registers.sp);
+	cpu->registers.a = read8(cpu->memory, cpu->registers.sp + 1);
+	cpu->flags_result = FLAGS_RESOLVED;
 	cpu->registers.sp+=2;
-	if(pair == PAIR_SP)
-		cpu->registers.af = val;
-	else
-		i8080_pairwrite(cpu, pair, val);
 
 	cpu->registers.pc++;
 	return CYCLES_POP;
@@ -910,85 +933,25 @@ uint8_t i8080_rar(intel8080_t *cpu)
 
 uint8_t i8080_jmp(intel8080_t *cpu)
 {
-	cpu->registers.pc = read16(cpu->registers.pc+1);
-	return CYCLES_JMP;
-}
-
-uint8_t i8080_jccc(intel8080_t *cpu)
-{
-	uint8_t condition = CONDITION(cpu->current_op_code);
-
-	if(i8080_check_condition(cpu, condition))
-	{
-		i8080_jmp(cpu);
-	}
-	else
-	{
-		cpu->registers.pc+=3;
-	}
-
+	cpu->registers.pc = read16(cpu->memory, cpu->registers.pc+1);
 	return CYCLES_JMP;
 }
 
 uint8_t i8080_ret(intel8080_t *cpu)
 {
 	cpu->cpuStatus |= STATUS_STACK;
-	cpu->registers.pc = read16(cpu->registers.sp);
+	cpu->registers.pc = read16(cpu->memory, cpu->registers.sp);
 	cpu->registers.sp+=2;
 	return CYCLES_RET;
 }
 
-uint8_t i8080_rccc(intel8080_t *cpu)
-{
-	uint8_t condition = CONDITION(cpu->current_op_code);
-
-	if(i8080_check_condition(cpu, condition))
-	{
-		i8080_ret(cpu);
-	}
-	else
-	{
-		cpu->registers.pc++;
-	}
-	return CYCLES_RET;
-}
-
-uint8_t i8080_rst(intel8080_t *cpu)
-{
-	cpu->cpuStatus |= STATUS_STACK;
-	uint8_t vec = DESTINATION(cpu->current_op_code);
-
-	cpu->registers.sp-=2;
-	write16(cpu->registers.sp, cpu->registers.pc + 1);
-
-	cpu->registers.pc = vec*8;
-
-	return CYCLES_RET;
-}
-
 uint8_t i8080_call(intel8080_t *cpu)
 {
 	cpu->cpuStatus |= STATUS_STACK;
 	cpu->registers.sp-=2;
-	write16(cpu->registers.sp, cpu->registers.pc + 3);
-
-	cpu->registers.pc = read16(cpu->registers.pc + 1);
-	return CYCLES_JMP;
-}
-
-uint8_t i8080_cccc(intel8080_t *cpu)
-{
-	uint8_t condition = CONDITION(cpu->current_op_code);
-
-	if(i8080_check_condition(cpu, condition))
-	{
-		i8080_call(cpu);
-	}
-	else
-	{
-		cpu->registers.pc+=3;
-	}
+	write16(cpu->memory, cpu->registers.sp, cpu->registers.pc + 3);
 
+	cpu->registers.pc = read16(cpu->memory, cpu->registers.pc + 1);
 	return CYCLES_CALL;
 }
 
@@ -1013,19 +976,9 @@ uint8_t i8080_cma(intel8080_t *cpu)
 	return CYCLES_CMA;
 }
 
-uint8_t i8080_cmp(intel8080_t *cpu)
-{
-	uint8_t reg = SOURCE(cpu->current_op_code);
-
-	i8080_compare(cpu, i8080_regread(cpu, reg));
-
-	cpu->registers.pc++;
-	return CYCLES_CMP;
-}
-
 uint8_t i8080_cpi(intel8080_t *cpu)
 {
-	i8080_compare(cpu, read8(cpu->registers.pc+1));
+	i8080_compare(cpu, read8(cpu->memory, cpu->registers.pc+1));
 	cpu->registers.pc+=2;
 	return CYCLES_CPI;
 }
@@ -1039,7 +992,7 @@ void i8080_fetch_next_op(intel8080_t *cpu)
 uint8_t i8080_daa(intel8080_t *cpu)
 {
 	uint8_t val, add = 0;
-	val = i8080_regread(cpu, REGISTER_A);
+	val = cpu->registers.a;
 
 	if((val & 0xf) > 9 || cpu->registers.flags & FLAGS_H)
 		add += 0x06;
@@ -1055,260 +1008,258 @@ uint8_t i8080_daa(intel8080_t *cpu)
 	return CYCLES_DAA;
 }
 
-void i8080_cycle(intel8080_t *cpu)
+// Undefined op codes are not emulated, the CPU stays on the op code and idles like a NOP
+uint8_t i8080_unimplemented(intel8080_t *cpu)
+{
+	(void)cpu;
+	return CYCLES_NOP;
+}
+
+I8080_MOV_ROW(b, CYCLES_MOV_REG)
+I8080_MOV_ROW(c, CYCLES_MOV_REG)
+I8080_MOV_ROW(d, CYCLES_MOV_REG)
+I8080_MOV_ROW(e, CYCLES_MOV_REG)
+I8080_MOV_ROW(h, CYCLES_MOV_REG)
+I8080_MOV_ROW(l, CYCLES_MOV_REG)
+I8080_MOV_ROW(a, CYCLES_MOV_REG)
+I8080_MOV(m, b, CYCLES_MOV_MEM)
+I8080_MOV(m, c, CYCLES_MOV_MEM)
+I8080_MOV(m, d, CYCLES_MOV_MEM)
+I8080_MOV(m, e, CYCLES_MOV_MEM)
+I8080_MOV(m, h, CYCLES_MOV_MEM)
+I8080_MOV(m, l, CYCLES_MOV_MEM)
+I8080_MOV(m, a, CYCLES_MOV_MEM)
+
+I8080_MVI(b, CYCLES_MVI_REG)
+I8080_MVI(c, CYCLES_MVI_REG)
+I8080_MVI(d, CYCLES_MVI_REG)
+I8080_MVI(e, CYCLES_MVI_REG)
+I8080_MVI(h, CYCLES_MVI_REG)
+I8080_MVI(l, CYCLES_MVI_REG)
+I8080_MVI(m, CYCLES_MVI_MEM)
+I8080_MVI(a, CYCLES_MVI_REG)
+
+I8080_INR_DCR(b)
+I8080_INR_DCR(c)
+I8080_INR_DCR(d)
+I8080_INR_DCR(e)
+I8080_INR_DCR(h)
+I8080_INR_DCR(l)
+I8080_INR_DCR(m)
+I8080_INR_DCR(a)
+
+I8080_ALU(b)
+I8080_ALU(c)
+I8080_ALU(d)
+I8080_ALU(e)
+I8080_ALU(h)
+I8080_ALU(l)
+I8080_ALU(m)
+I8080_ALU(a)
+
+I8080_PAIR_OPS(bc)
+I8080_PAIR_OPS(de)
+I8080_PAIR_OPS(hl)
+I8080_PAIR_OPS(sp)
+
+I8080_STACK_OPS(bc, STATUS_MEMORY_READ)
+I8080_STACK_OPS(de, STATUS_MEMORY_READ)
+I8080_STACK_OPS(hl, STATUS_MEMORY_READ)
+
+I8080_INDIRECT_OPS(bc)
+I8080_INDIRECT_OPS(de)
+
+I8080_BRANCH_OPS(nz)
+I8080_BRANCH_OPS(z)
+I8080_BRANCH_OPS(nc)
+I8080_BRANCH_OPS(c)
+I8080_BRANCH_OPS(po)
+I8080_BRANCH_OPS(pe)
+I8080_BRANCH_OPS(p)
+I8080_BRANCH_OPS(m)
+
+I8080_RST(0)
+I8080_RST(1)
+I8080_RST(2)
+I8080_RST(3)
+I8080_RST(4)
+I8080_RST(5)
+I8080_RST(6)
+I8080_RST(7)
+
+#define UNDEF i8080_unimplemented
+
+// Every op code and its handler, expanded into the dispatch table and the threaded interpreter labels
+// clang-format off
+#define I8080_OPS(OP) \
+	OP(0x00, i8080_nop)      OP(0x01, i8080_lxi_bc)   OP(0x02, i8080_stax_bc)  OP(0x03, i8080_inx_bc)   OP(0x04, i8080_inr_b)    OP(0x05, i8080_dcr_b)    OP(0x06, i8080_mvi_b)    OP(0x07, i8080_rlc) \
+	OP(0x08, UNDEF)          OP(0x09, i8080_dad_bc)   OP(0x0a, i8080_ldax_bc)  OP(0x0b, i8080_dcx_bc)   OP(0x0c, i8080_inr_c)    OP(0x0d, i8080_dcr_c)    OP(0x0e, i8080_mvi_c)    OP(0x0f, i8080_rrc) \
+	OP(0x10, UNDEF)          OP(0x11, i8080_lxi_de)   OP(0x12, i8080_stax_de)  OP(0x13, i8080_inx_de)   OP(0x14, i8080_inr_d)    OP(0x15, i8080_dcr_d)    OP(0x16, i8080_mvi_d)    OP(0x17, i8080_ral) \
+	OP(0x18, UNDEF)          OP(0x19, i8080_dad_de)   OP(0x1a, i8080_ldax_de)  OP(0x1b, i8080_dcx_de)   OP(0x1c, i8080_inr_e)    OP(0x1d, i8080_dcr_e)    OP(0x1e, i8080_mvi_e)    OP(0x1f, i8080_rar) \
+	OP(0x20, UNDEF)          OP(0x21, i8080_lxi_hl)   OP(0x22, i8080_shld)     OP(0x23, i8080_inx_hl)   OP(0x24, i8080_inr_h)    OP(0x25, i8080_dcr_h)    OP(0x26, i8080_mvi_h)    OP(0x27, i8080_daa) \
+	OP(0x28, UNDEF)          OP(0x29, i8080_dad_hl)   OP(0x2a, i8080_lhld)     OP(0x2b, i8080_dcx_hl)   OP(0x2c, i8080_inr_l)    OP(0x2d, i8080_dcr_l)    OP(0x2e, i8080_mvi_l)    OP(0x2f, i8080_cma) \
+	OP(0x30, UNDEF)          OP(0x31, i8080_lxi_sp)   OP(0x32, i8080_sta)      OP(0x33, i8080_inx_sp)   OP(0x34, i8080_inr_m)    OP(0x35, i8080_dcr_m)    OP(0x36, i8080_mvi_m)    OP(0x37, i8080_stc) \
+	OP(0x38, UNDEF)          OP(0x39, i8080_dad_sp)   OP(0x3a, i8080_lda)      OP(0x3b, i8080_dcx_sp)   OP(0x3c, i8080_inr_a)    OP(0x3d, i8080_dcr_a)    OP(0x3e, i8080_mvi_a)    OP(0x3f, i8080_cmc) \
+	OP(0x40, i8080_mov_b_b)  OP(0x41, i8080_mov_b_c)  OP(0x42, i8080_mov_b_d)  OP(0x43, i8080_mov_b_e)  OP(0x44, i8080_mov_b_h)  OP(0x45, i8080_mov_b_l)  OP(0x46, i8080_mov_b_m)  OP(0x47, i8080_mov_b_a) \
+	OP(0x48, i8080_mov_c_b)  OP(0x49, i8080_mov_c_c)  OP(0x4a, i8080_mov_c_d)  OP(0x4b, i8080_mov_c_e)  OP(0x4c, i8080_mov_c_h)  OP(0x4d, i8080_mov_c_l)  OP(0x4e, i8080_mov_c_m)  OP(0x4f, i8080_mov_c_a) \
+	OP(0x50, i8080_mov_d_b)  OP(0x51, i8080_mov_d_c)  OP(0x52, i8080_mov_d_d)  OP(0x53, i8080_mov_d_e)  OP(0x54, i8080_mov_d_h)  OP(0x55, i8080_mov_d_l)  OP(0x56, i8080_mov_d_m)  OP(0x57, i8080_mov_d_a) \
+	OP(0x58, i8080_mov_e_b)  OP(0x59, i8080_mov_e_c)  OP(0x5a, i8080_mov_e_d)  OP(0x5b, i8080_mov_e_e)  OP(0x5c, i8080_mov_e_h)  OP(0x5d, i8080_mov_e_l)  OP(0x5e, i8080_mov_e_m)  OP(0x5f, i8080_mov_e_a) \
+	OP(0x60, i8080_mov_h_b)  OP(0x61, i8080_mov_h_c)  OP(0x62, i8080_mov_h_d)  OP(0x63, i8080_mov_h_e)  OP(0x64, i8080_mov_h_h)  OP(0x65, i8080_mov_h_l)  OP(0x66, i8080_mov_h_m)  OP(0x67, i8080_mov_h_a) \
+	OP(0x68, i8080_mov_l_b)  OP(0x69, i8080_mov_l_c)  OP(0x6a, i8080_mov_l_d)  OP(0x6b, i8080_mov_l_e)  OP(0x6c, i8080_mov_l_h)  OP(0x6d, i8080_mov_l_l)  OP(0x6e, i8080_mov_l_m)  OP(0x6f, i8080_mov_l_a) \
+	OP(0x70, i8080_mov_m_b)  OP(0x71, i8080_mov_m_c)  OP(0x72, i8080_mov_m_d)  OP(0x73, i8080_mov_m_e)  OP(0x74, i8080_mov_m_h)  OP(0x75, i8080_mov_m_l)  OP(0x76, i8080_hlt)      OP(0x77, i8080_mov_m_a) \
+	OP(0x78, i8080_mov_a_b)  OP(0x79, i8080_mov_a_c)  OP(0x7a, i8080_mov_a_d)  OP(0x7b, i8080_mov_a_e)  OP(0x7c, i8080_mov_a_h)  OP(0x7d, i8080_mov_a_l)  OP(0x7e, i8080_mov_a_m)  OP(0x7f, i8080_mov_a_a) \
+	OP(0x80, i8080_add_b)    OP(0x81, i8080_add_c)    OP(0x82, i8080_add_d)    OP(0x83, i8080_add_e)    OP(0x84, i8080_add_h)    OP(0x85, i8080_add_l)    OP(0x86, i8080_add_m)    OP(0x87, i8080_add_a) \
+	OP(0x88, i8080_adc_b)    OP(0x89, i8080_adc_c)    OP(0x8a, i8080_adc_d)    OP(0x8b, i8080_adc_e)    OP(0x8c, i8080_adc_h)    OP(0x8d, i8080_adc_l)    OP(0x8e, i8080_adc_m)    OP(0x8f, i8080_adc_a) \
+	OP(0x90, i8080_sub_b)    OP(0x91, i8080_sub_c)    OP(0x92, i8080_sub_d)    OP(0x93, i8080_sub_e)    OP(0x94, i8080_sub_h)    OP(0x95, i8080_sub_l)    OP(0x96, i8080_sub_m)    OP(0x97, i8080_sub_a) \
+	OP(0x98, i8080_sbb_b)    OP(0x99, i8080_sbb_c)    OP(0x9a, i8080_sbb_d)    OP(0x9b, i8080_sbb_e)    OP(0x9c, i8080_sbb_h)    OP(0x9d, i8080_sbb_l)    OP(0x9e, i8080_sbb_m)    OP(0x9f, i8080_sbb_a) \
+	OP(0xa0, i8080_ana_b)    OP(0xa1, i8080_ana_c)    OP(0xa2, i8080_ana_d)    OP(0xa3, i8080_ana_e)    OP(0xa4, i8080_ana_h)    OP(0xa5, i8080_ana_l)    OP(0xa6, i8080_ana_m)    OP(0xa7, i8080_ana_a) \
+	OP(0xa8, i8080_xra_b)    OP(0xa9, i8080_xra_c)    OP(0xaa, i8080_xra_d)    OP(0xab, i8080_xra_e)    OP(0xac, i8080_xra_h)    OP(0xad, i8080_xra_l)    OP(0xae, i8080_xra_m)    OP(0xaf, i8080_xra_a) \
+	OP(0xb0, i8080_ora_b)    OP(0xb1, i8080_ora_c)    OP(0xb2, i8080_ora_d)    OP(0xb3, i8080_ora_e)    OP(0xb4, i8080_ora_h)    OP(0xb5, i8080_ora_l)    OP(0xb6, i8080_ora_m)    OP(0xb7, i8080_ora_a) \
+	OP(0xb8, i8080_cmp_b)    OP(0xb9, i8080_cmp_c)    OP(0xba, i8080_cmp_d)    OP(0xbb, i8080_cmp_e)    OP(0xbc, i8080_cmp_h)    OP(0xbd, i8080_cmp_l)    OP(0xbe, i8080_cmp_m)    OP(0xbf, i8080_cmp_a) \
+	OP(0xc0, i8080_rnz)      OP(0xc1, i8080_pop_bc)   OP(0xc2, i8080_jnz)      OP(0xc3, i8080_jmp)      OP(0xc4, i8080_cnz)      OP(0xc5, i8080_push_bc)  OP(0xc6, i8080_adi)      OP(0xc7, i8080_rst_0) \
+	OP(0xc8, i8080_rz)       OP(0xc9, i8080_ret)      OP(0xca, i8080_jz)       OP(0xcb, UNDEF)          OP(0xcc, i8080_cz)       OP(0xcd, i8080_call)     OP(0xce, i8080_aci)      OP(0xcf, i8080_rst_1) \
+	OP(0xd0, i8080_rnc)      OP(0xd1, i8080_pop_de)   OP(0xd2, i8080_jnc)      OP(0xd3, i8080_out)      OP(0xd4, i8080_cnc)      OP(0xd5, i8080_push_de)  OP(0xd6, i8080_sui)      OP(0xd7, i8080_rst_2) \
+	OP(0xd8, i8080_rc)       OP(0xd9, UNDEF)          OP(0xda, i8080_jc)       OP(0xdb, i8080_in)       OP(0xdc, i8080_cc)       OP(0xdd, UNDEF)          OP(0xde, i8080_sbi)      OP(0xdf, i8080_rst_3) \
+	OP(0xe0, i8080_rpo)      OP(0xe1, i8080_pop_hl)   OP(0xe2, i8080_jpo)      OP(0xe3, i8080_xthl)     OP(0xe4, i8080_cpo)      OP(0xe5, i8080_push_hl)  OP(0xe6, i8080_ani)      OP(0xe7, i8080_rst_4) \
+	OP(0xe8, i8080_rpe)      OP(0xe9, i8080_pchl)     OP(0xea, i8080_jpe)      OP(0xeb, i8080_xchg)     OP(0xec, i8080_cpe)      OP(0xed, UNDEF)          OP(0xee, i8080_xri)      OP(0xef, i8080_rst_5) \
+	OP(0xf0, i8080_rp)       OP(0xf1, i8080_pop_psw)  OP(0xf2, i8080_jp)       OP(0xf3, i8080_di)       OP(0xf4, i8080_cp)       OP(0xf5, i8080_push_psw) OP(0xf6, i8080_ori)      OP(0xf7, i8080_rst_6) \
+	OP(0xf8, i8080_rm)       OP(0xf9, i8080_sphl)     OP(0xfa, i8080_jm)       OP(0xfb, i8080_ei)       OP(0xfc, i8080_cm)       OP(0xfd, UNDEF)          OP(0xfe, i8080_cpi)      OP(0xff, i8080_rst_7)
+
+#define I8080_OP_HANDLER(code, handler) handler,
+
+const i8080_op_handler i8080_op_table[256] = {I8080_OPS(I8080_OP_HANDLER)};
+// clang-format on
+
+static inline void i8080_execute(intel8080_t *cpu)
 {
-	uint8_t op_code;
 	cpu->cpuStatus = 0;
 	i8080_fetch_next_op(cpu);
 
-	op_code = cpu->current_op_code = cpu->data_bus;
-	switch(op_code)
+	cpu->current_op_code = cpu->data_bus;
+	I8080_COUNT_OP(cpu, cpu->current_op_code);
+	cpu->cycles += i8080_op_table[cpu->current_op_code](cpu);
+}
+
+void i8080_cycle(intel8080_t *cpu)
+{
+	if (atomic_load(&cpu->interrupt_request) && cpu->interrupt_enable)
 	{
-		case 0x00: i8080_nop(cpu); break;
-		case 0x01: i8080_lxi(cpu); break;
-		case 0x02: i8080_stax(cpu); break;
-		case 0x03: i8080_inx(cpu); break;
-		case 0x04: i8080_inr(cpu); break;
-		case 0x05: i8080_dcr(cpu); break;
-		case 0x06: i8080_mvi(cpu); break;
-		case 0x07: i8080_rlc(cpu); break;
-		case 0x09: i8080_dad(cpu); break;
-		case 0x0a: i8080_ldax(cpu); break;
-		case 0x0b: i8080_dcx(cpu); break;
-		case 0x0c: i8080_inr(cpu); break;
-		case 0x0d: i8080_dcr(cpu); break;
-		case 0x0e: i8080_mvi(cpu); break;
-		case 0x0f: i8080_rrc(cpu); break;
-		case 0x11: i8080_lxi(cpu); break;
-		case 0x12: i8080_stax(cpu); break;
-		case 0x13: i8080_inx(cpu); break;
-		case 0x14: i8080_inr(cpu); break;
-		case 0x15: i8080_dcr(cpu); break;
-		case 0x16: i8080_mvi(cpu); break;
-		case 0x17: i8080_ral(cpu); break;
-		case 0x19: i8080_dad(cpu); break;
-		case 0x1a: i8080_ldax(cpu); break;
-		case 0x1b: i8080_dcx(cpu); break;
-		case 0x1c: i8080_inr(cpu); break;
-		case 0x1d: i8080_dcr(cpu); break;
-		case 0x1e: i8080_mvi(cpu); break;
-		case 0x1f: i8080_rar(cpu); break;
-//		case 0x20: i8080_rim(cpu); break;
-		case 0x21: i8080_lxi(cpu); break;
-		case 0x22: i8080_shld(cpu); break;
-		case 0x23: i8080_inx(cpu); break;
-		case 0x24: i8080_inr(cpu); break;
-		case 0x25: i8080_dcr(cpu); break;
-		case 0x26: i8080_mvi(cpu); break;
-		case 0x27: i8080_daa(cpu); break;
-		case 0x29: i8080_dad(cpu); break;
-		case 0x2a: i8080_lhld(cpu); break;
-		case 0x2b: i8080_dcx(cpu); break;
-		case 0x2c: i8080_inr(cpu); break;
-		case 0x2d: i8080_dcr(cpu); break;
-		case 0x2e: i8080_mvi(cpu); break;
-		case 0x2f: i8080_cma(cpu); break;
-//		case 0x30: i8080_sim(cpu); break;
-		case 0x31: i8080_lxi(cpu); break;
-		case 0x32: i8080_sta(cpu); break;
-		case 0x33: i8080_inx(cpu); break;
-		case 0x34: i8080_inr(cpu); break;
-		case 0x35: i8080_dcr(cpu); break;
-		case 0x36: i8080_mvi(cpu); break;
-		case 0x37: i8080_stc(cpu); break;
-		case 0x39: i8080_dad(cpu); break;
-		case 0x3a: i8080_lda(cpu); break;
-		case 0x3b: i8080_dcx(cpu); break;
-		case 0x3c: i8080_inr(cpu); break;
-		case 0x3d: i8080_dcr(cpu); break;
-		case 0x3e: i8080_mvi(cpu); break;
-		case 0x3f: i8080_cmc(cpu); break;
-		case 0x40: i8080_mov(cpu); break;
-		case 0x41: i8080_mov(cpu); break;
-		case 0x42: i8080_mov(cpu); break;
-		case 0x43: i8080_mov(cpu); break;
-		case 0x44: i8080_mov(cpu); break;
-		case 0x45: i8080_mov(cpu); break;
-		case 0x46: i8080_mov(cpu); break;
-		case 0x47: i8080_mov(cpu); break;
-		case 0x48: i8080_mov(cpu); break;
-		case 0x49: i8080_mov(cpu); break;
-		case 0x4a: i8080_mov(cpu); break;
-		case 0x4b: i8080_mov(cpu); break;
-		case 0x4c: i8080_mov(cpu); break;
-		case 0x4d: i8080_mov(cpu); break;
-		case 0x4e: i8080_mov(cpu); break;
-		case 0x4f: i8080_mov(cpu); break;
-		case 0x50: i8080_mov(cpu); break;
-		case 0x51: i8080_mov(cpu); break;
-		case 0x52: i8080_mov(cpu); break;
-		case 0x53: i8080_mov(cpu); break;
-		case 0x54: i8080_mov(cpu); break;
-		case 0x55: i8080_mov(cpu); break;
-		case 0x56: i8080_mov(cpu); break;
-		case 0x57: i8080_mov(cpu); break;
-		case 0x58: i8080_mov(cpu); break;
-		case 0x59: i8080_mov(cpu); break;
-		case 0x5a: i8080_mov(cpu); break;
-		case 0x5b: i8080_mov(cpu); break;
-		case 0x5c: i8080_mov(cpu); break;
-		case 0x5d: i8080_mov(cpu); break;
-		case 0x5e: i8080_mov(cpu); break;
-		case 0x5f: i8080_mov(cpu); break;
-		case 0x60: i8080_mov(cpu); break;
-		case 0x61: i8080_mov(cpu); break;
-		case 0x62: i8080_mov(cpu); break;
-		case 0x63: i8080_mov(cpu); break;
-		case 0x64: i8080_mov(cpu); break;
-		case 0x65: i8080_mov(cpu); break;
-		case 0x66: i8080_mov(cpu); break;
-		case 0x67: i8080_mov(cpu); break;
-		case 0x68: i8080_mov(cpu); break;
-		case 0x69: i8080_mov(cpu); break;
-		case 0x6a: i8080_mov(cpu); break;
-		case 0x6b: i8080_mov(cpu); break;
-		case 0x6c: i8080_mov(cpu); break;
-		case 0x6d: i8080_mov(cpu); break;
-		case 0x6e: i8080_mov(cpu); break;
-		case 0x6f: i8080_mov(cpu); break;
-		case 0x70: i8080_mov(cpu); break;
-		case 0x71: i8080_mov(cpu); break;
-		case 0x72: i8080_mov(cpu); break;
-		case 0x73: i8080_mov(cpu); break;
-		case 0x74: i8080_mov(cpu); break;
-		case 0x75: i8080_mov(cpu); break;
-//		case 0x76: i8080_hlt(cpu); break;
-		case 0x77: i8080_mov(cpu); break;
-		case 0x78: i8080_mov(cpu); break;
-		case 0x79: i8080_mov(cpu); break;
-		case 0x7a: i8080_mov(cpu); break;
-		case 0x7b: i8080_mov(cpu); break;
-		case 0x7c: i8080_mov(cpu); break;
-		case 0x7d: i8080_mov(cpu); break;
-		case 0x7e: i8080_mov(cpu); break;
-		case 0x7f: i8080_mov(cpu); break;
-		case 0x80: i8080_add(cpu); break;
-		case 0x81: i8080_add(cpu); break;
-		case 0x82: i8080_add(cpu); break;
-		case 0x83: i8080_add(cpu); break;
-		case 0x84: i8080_add(cpu); break;
-		case 0x85: i8080_add(cpu); break;
-		case 0x86: i8080_add(cpu); break;
-		case 0x87: i8080_add(cpu); break;
-		case 0x88: i8080_adc(cpu); break;
-		case 0x89: i8080_adc(cpu); break;
-		case 0x8a: i8080_adc(cpu); break;
-		case 0x8b: i8080_adc(cpu); break;
-		case 0x8c: i8080_adc(cpu); break;
-		case 0x8d: i8080_adc(cpu); break;
-		case 0x8e: i8080_adc(cpu); break;
-		case 0x8f: i8080_adc(cpu); break;
-		case 0x90: i8080_sub(cpu); break;
-		case 0x91: i8080_sub(cpu); break;
-		case 0x92: i8080_sub(cpu); break;
-		case 0x93: i8080_sub(cpu); break;
-		case 0x94: i8080_sub(cpu); break;
-		case 0x95: i8080_sub(cpu); break;
-		case 0x96: i8080_sub(cpu); break;
-		case 0x97: i8080_sub(cpu); break;
-		case 0x98: i8080_sbb(cpu); break;
-		case 0x99: i8080_sbb(cpu); break;
-		case 0x9a: i8080_sbb(cpu); break;
-		case 0x9b: i8080_sbb(cpu); break;
-		case 0x9c: i8080_sbb(cpu); break;
-		case 0x9d: i8080_sbb(cpu); break;
-		case 0x9e: i8080_sbb(cpu); break;
-		case 0x9f: i8080_sbb(cpu); break;
-		case 0xa0: i8080_ana(cpu); break;
-		case 0xa1: i8080_ana(cpu); break;
-		case 0xa2: i8080_ana(cpu); break;
-		case 0xa3: i8080_ana(cpu); break;
-		case 0xa4: i8080_ana(cpu); break;
-		case 0xa5: i8080_ana(cpu); break;
-		case 0xa6: i8080_ana(cpu); break;
-		case 0xa7: i8080_ana(cpu); break;
-		case 0xa8: i8080_xra(cpu); break;
-		case 0xa9: i8080_xra(cpu); break;
-		case 0xaa: i8080_xra(cpu); break;
-		case 0xab: i8080_xra(cpu); break;
-		case 0xac: i8080_xra(cpu); break;
-		case 0xad: i8080_xra(cpu); break;
-		case 0xae: i8080_xra(cpu); break;
-		case 0xaf: i8080_xra(cpu); break;
-		case 0xb0: i8080_ora(cpu); break;
-		case 0xb1: i8080_ora(cpu); break;
-		case 0xb2: i8080_ora(cpu); break;
-		case 0xb3: i8080_ora(cpu); break;
-		case 0xb4: i8080_ora(cpu); break;
-		case 0xb5: i8080_ora(cpu); break;
-		case 0xb6: i8080_ora(cpu); break;
-		case 0xb7: i8080_ora(cpu); break;
-		case 0xb8: i8080_cmp(cpu); break;
-		case 0xb9: i8080_cmp(cpu); break;
-		case 0xba: i8080_cmp(cpu); break;
-		case 0xbb: i8080_cmp(cpu); break;
-		case 0xbc: i8080_cmp(cpu); break;
-		case 0xbd: i8080_cmp(cpu); break;
-		case 0xbe: i8080_cmp(cpu); break;
-		case 0xbf: i8080_cmp(cpu); break;
-		case 0xc0: i8080_rccc(cpu); break;
-		case 0xc1: i8080_pop(cpu); break;
-		case 0xc2: i8080_jccc(cpu); break;
-		case 0xc3: i8080_jmp(cpu); break;
-		case 0xc4: i8080_cccc(cpu); break;
-		case 0xc5: i8080_push(cpu); break;
-		case 0xc6: i8080_adi(cpu); break;
-		case 0xc7: i8080_rst(cpu); break;
-		case 0xc8: i8080_rccc(cpu); break;
-		case 0xc9: i8080_ret(cpu); break;
-		case 0xca: i8080_jccc(cpu); break;
-		case 0xcc: i8080_cccc(cpu); break;
-		case 0xcd: i8080_call(cpu); break;
-		case 0xce: i8080_aci(cpu); break;
-		case 0xcf: i8080_rst(cpu); break;
-		case 0xd0: i8080_rccc(cpu); break;
-		case 0xd1: i8080_pop(cpu); break;
-		case 0xd2: i8080_jccc(cpu); break;
-		case 0xd3: i8080_out(cpu); break;
-		case 0xd4: i8080_cccc(cpu); break;
-		case 0xd5: i8080_push(cpu); break;
-		case 0xd6: i8080_sui(cpu); break;
-		case 0xd7: i8080_rst(cpu); break;
-		case 0xd8: i8080_rccc(cpu); break;
-		case 0xda: i8080_jccc(cpu); break;
-		case 0xdb: i8080_in(cpu); break;
-		case 0xdc: i8080_cccc(cpu); break;
-		case 0xde: i8080_sbi(cpu); break;
-		case 0xdf: i8080_rst(cpu); break;
-		case 0xe0: i8080_rccc(cpu); break;
-		case 0xe1: i8080_pop(cpu); break;
-		case 0xe2: i8080_jccc(cpu); break;
-		case 0xe3: i8080_xthl(cpu); break;
-		case 0xe4: i8080_cccc(cpu); break;
-		case 0xe5: i8080_push(cpu); break;
-		case 0xe6: i8080_ani(cpu); break;
-		case 0xe7: i8080_rst(cpu); break;
-		case 0xe8: i8080_rccc(cpu); break;
-		case 0xe9: i8080_pchl(cpu); break;
-		case 0xea: i8080_jccc(cpu); break;
-		case 0xeb: i8080_xchg(cpu); break;
-		case 0xec: i8080_cccc(cpu); break;
-		case 0xee: i8080_xri(cpu); break;
-		case 0xef: i8080_rst(cpu); break;
-		case 0xf0: i8080_rccc(cpu); break;
-		case 0xf1: i8080_pop(cpu); break;
-		case 0xf2: i8080_jccc(cpu); break;
-		case 0xf3: i8080_di(cpu); break;
-		case 0xf4: i8080_cccc(cpu); break;
-		case 0xf5: i8080_push(cpu); break;
-		case 0xf6: i8080_ori(cpu); break;
-		case 0xf7: i8080_rst(cpu); break;
-		case 0xf8: i8080_rccc(cpu); break;
-		case 0xf9: i8080_sphl(cpu); break;
-		case 0xfa: i8080_jccc(cpu); break;
-		case 0xfb: i8080_ei(cpu); break;
-		case 0xfc: i8080_cccc(cpu); break;
-		case 0xfe: i8080_cpi(cpu); break;
-		case 0xff: i8080_rst(cpu); break;
+		i8080_take_interrupt(cpu);
+	}
+
+	if (!cpu->halted)
+	{
+		i8080_execute(cpu);
+	}
+}
+
+#if defined(ALTAIR_THREADED_DISPATCH) && defined(__GNUC__)
+
+#define I8080_OP_LABEL(code, handler) &&op_##code,
+
+#define I8080_DISPATCH()					\
+	if (cpu->cycles >= i8080_run_until(cpu) &&		\
+		!i8080_run_continue(cpu, end))			\
+		return;						\
+	cpu->cpuStatus = 0;					\
+	i8080_fetch_next_op(cpu);				\
+	cpu->current_op_code = cpu->data_bus;			\
+	I8080_COUNT_OP(cpu, cpu->current_op_code);		\
+	goto *dispatch[cpu->current_op_code]
+
+#define I8080_OP_BODY(code, handler)				\
+	op_##code : cpu->cycles += handler(cpu);		\
+	I8080_DISPATCH();
+
+// Direct threaded interpreter, each op code jumps straight to the label of the next one until budget T-states have run.
+// run_until is only checked between op codes so HLT, EI and interrupt requests can stop the run early.
+void i8080_run(intel8080_t *cpu, uint32_t budget)
+{
+	static const void *const dispatch[256] = {I8080_OPS(I8080_OP_LABEL)};
+	uint64_t end = cpu->cycles + budget;
+
+	atomic_store_explicit(&cpu->run_until, 0, memory_order_relaxed);
+	I8080_DISPATCH();
+	I8080_OPS(I8080_OP_BODY)
+}
+
+#else
+
+void i8080_run(intel8080_t *cpu, uint32_t budget)
+{
+	uint64_t end = cpu->cycles + budget;
+
+	while (i8080_run_continue(cpu, end))
+	{
+		while (cpu->cycles < i8080_run_until(cpu))
+		{
+			i8080_execute(cpu);
+		}
 	}
 }
+
+#endif // ALTAIR_THREADED_DISPATCH
+
+#ifdef ALTAIR_CPU_STATS
+
+uint64_t i8080_stats_instructions(intel8080_t *cpu)
+{
+	uint64_t instructions = 0;
+
+	for (int op_code = 0; op_code < 256; op_code++)
+	{
+		instructions += cpu->stats.op_counts[op_code];
+	}
+	return instructions;
+}
+
+/// <summary>
+/// Record the instruction and T-state totals at host time now_ns, called about once a second by the host
+/// </summary>
+void i8080_stats_sample(intel8080_t *cpu, uint64_t now_ns)
+{
+	i8080_stats_t *stats = &cpu->stats;
+
+	stats->window_instructions[stats->window_next] = i8080_stats_instructions(cpu);
+	stats->window_cycles[stats->window_next]	   = cpu->cycles;
+	stats->window_ns[stats->window_next]		   = now_ns;
+
+	stats->window_next = (uint8_t)((stats->window_next + 1) % CPU_STATS_WINDOW);
+	if (stats->window_used < CPU_STATS_WINDOW)
+	{
+		stats->window_used++;
+	}
+}
+
+/// <summary>
+/// Instructions and T-states per host second between the oldest and newest samples in the window.
+/// Returns false until there are two samples to measure between.
+/// </summary>
+bool i8080_stats_rate(intel8080_t *cpu, double *instructions_per_second, double *cycles_per_second)
+{
+	i8080_stats_t *stats = &cpu->stats;
+
+	if (stats->window_used < 2)
+	{
+		return false;
+	}
+
+	int newest = (stats->window_next + CPU_STATS_WINDOW - 1) % CPU_STATS_WINDOW;
+	int oldest = (stats->window_next + CPU_STATS_WINDOW - stats->window_used) % CPU_STATS_WINDOW;
+
+	// A reset between samples takes the counters backwards
+	if (stats->window_ns[newest] <= stats->window_ns[oldest] ||
+		stats->window_instructions[newest] < stats->window_instructions[oldest] ||
+		stats->window_cycles[newest] < stats->window_cycles[oldest])
+	{
+		return false;
+	}
+
+	double seconds = (double)(stats->window_ns[newest] - stats->window_ns[oldest]) / 1e9;
+
+	*instructions_per_second = (double)(stats->window_instructions[newest] - stats->window_instructions[oldest]) / seconds;
+	*cycles_per_second		 = (double)(stats->window_cycles[newest] - stats->window_cycles[oldest]) / seconds;
+	return true;
+}
+
+#endif // ALTAIR_CPU_STATS
@@ -1,55 +1,81 @@
 #ifndef _INTEL8080_H_
 #define _INTEL8080_H_
 
+#include "memory.h"
 #include "types.h"
+#include <stdatomic.h>
+#include <stdbool.h>
 
 #define FLAGS_CARRY		0x1
 #define FLAGS_PARITY		0x4
 #define FLAGS_H			16
-#define FLAGS_IF		32
 #define FLAGS_ZERO		64
 #define FLAGS_SIGN		128
 
+// flags_result holds the last ALU result until the sign, zero and parity bits are folded into flags
+#define FLAGS_RESOLVED		0x100
+
+// Console status polls that find no input, close together in time and code, mark the CPU idle
+#define IDLE_POLL_CYCLES	500		// max T-states between polls of the same wait loop
+#define IDLE_POLL_PC_RANGE	32		// max distance between the polling IN instructions
+#define IDLE_POLL_THRESHOLD	64		// empty polls in a row before the CPU is idle
+
+#ifdef ALTAIR_CPU_STATS
+#define CPU_STATS_WINDOW	10		// one second samples averaged for the instructions per second rate
+
 typedef struct
 {
-	union
-	{
-		uint16_t af;
-
-		struct {
-			uint8_t flags;
-			uint8_t a;
-		};
-	};
+	uint64_t op_counts[256]; // op codes run since reset, the only counter touched by the dispatch loops
+
+	// Sliding window of instruction and T-state totals, one sample per i8080_stats_sample call
+	uint64_t window_instructions[CPU_STATS_WINDOW];
+	uint64_t window_cycles[CPU_STATS_WINDOW];
+	uint64_t window_ns[CPU_STATS_WINDOW];
+	uint8_t window_next;
+	uint8_t window_used;
+} i8080_stats_t;
+
+#define I8080_COUNT_OP(cpu, op_code)	((cpu)->stats.op_counts[op_code]++)
+#else
+#define I8080_COUNT_OP(cpu, op_code)
+#endif // ALTAIR_CPU_STATS
+
+// Register numbers in op code encoding order. M is the byte addressed by HL, its slot in the register file holds the flags.
+#define REG_B	0
+#define REG_C	1
+#define REG_D	2
+#define REG_E	3
+#define REG_H	4
+#define REG_L	5
+#define REG_M	6
+#define REG_A	7
+
+// Register pairs are little endian, so each register is stored at its encoding number with the low bit flipped
+#define I8080_REG(n)	((n) ^ 1)
 
+typedef struct
+{
 	union
 	{
-		uint16_t bc;
+		uint8_t r[8]; // indexed with I8080_REG(REG_B) through I8080_REG(REG_A)
+
 		struct
 		{
-			uint8_t c;
-			uint8_t b;
+			uint16_t bc;
+			uint16_t de;
+			uint16_t hl;
 		};
-	};
 
-	union
-	{
-		uint16_t de;
 		struct
 		{
+			uint8_t c;
+			uint8_t b;
 			uint8_t e;
 			uint8_t d;
-
-		};
-	};
-
-	union
-	{
-		uint16_t hl;
-		struct
-		{
 			uint8_t l;
 			uint8_t h;
+			uint8_t a;
+			uint8_t flags;
 		};
 	};
 
@@ -57,15 +83,17 @@ typedef struct
 	uint16_t pc;
 } registers_t;
 
-typedef void (*azure_sphere_port_out)(uint8_t port, uint8_t data);
-typedef uint8_t(*azure_sphere_port_in)(uint8_t port);
+// Every device callback gets the context it was registered with, so one process can run many machines
+typedef void (*azure_sphere_port_out)(void *context, uint8_t port, uint8_t data);
+typedef uint8_t(*azure_sphere_port_in)(void *context, uint8_t port);
 
-typedef void (*port_out)(uint8_t b);
-typedef uint8_t (*port_in)(void);
-typedef uint8_t (*read_sense_switches)(void);
+typedef void (*port_out)(void *context, uint8_t b);
+typedef uint8_t (*port_in)(void *context);
+typedef uint8_t (*read_sense_switches)(void *context);
 
 typedef struct
 {
+	void *context; // passed to the disk callbacks, normally the machine's drives
 	port_out disk_select;
 	port_in	disk_status;
 	port_out disk_function;
@@ -82,6 +110,27 @@ typedef struct
 	uint8_t current_op_code;
 
 	registers_t registers;
+	uint16_t flags_result;
+
+	uint64_t cycles; // T-states run since reset
+
+	bool halted;				// HLT executed, waiting for an interrupt
+	bool interrupt_enable;		// INTE, set by EI and cleared by DI or taking an interrupt
+	// The three fields below are shared with the threads that call i8080_interrupt, everything else belongs to the
+	// thread running the CPU
+	atomic_bool serial_rx_interrupt;	// 2SIO receive interrupt enabled by bit 7 of the port 0x10 control register
+	_Atomic uint8_t interrupt_request;	// RST op code of the pending interrupt, 0 when none
+	_Atomic uint64_t run_until;			// i8080_run stops dispatching when cycles reaches this, cut short by HLT, EI and interrupts
+
+	bool idle; // set when the CPU is spinning on console input, cleared by the host
+	uint16_t idle_polls;
+	uint16_t idle_poll_pc;
+	uint64_t idle_poll_cycles;
+
+	memory_t *memory;
+	void *context; // passed to the terminal, sense switch and port callbacks
+
+	uint8_t serial_rx_character; // read ahead by a 2SIO status poll, returned by the next data read
 
 	azure_sphere_port_in _sphere_port_in;
 	azure_sphere_port_out _sphere_port_out;
@@ -92,9 +141,17 @@ typedef struct
 	uint8_t cpuStatus;
 
 	disk_controller_t disk_controller;
+
+#ifdef ALTAIR_CPU_STATS
+	i8080_stats_t stats;
+#endif
 } intel8080_t;
 
-void i8080_reset(intel8080_t *cpu, port_in in, port_out out, read_sense_switches sense,
+typedef uint8_t (*i8080_op_handler)(intel8080_t *cpu);
+
+extern const i8080_op_handler i8080_op_table[256];
+
+void i8080_reset(intel8080_t *cpu, memory_t *memory, void *context, port_in in, port_out out, read_sense_switches sense,
 			disk_controller_t *disk_controller, azure_sphere_port_in, azure_sphere_port_out);
 void i8080_deposit(intel8080_t *cpu, uint8_t data);
 void i8080_deposit_next(intel8080_t *cpu, uint8_t data);
@@ -102,6 +159,24 @@ void i8080_deposit_next(intel8080_t *cpu, uint8_t data);
 void i8080_examine(intel8080_t *cpu, uint16_t address);
 void i8080_examine_next(intel8080_t *cpu);
 
+uint8_t i8080_get_flags(intel8080_t *cpu);
+
+// Read on every op code, so the load is relaxed. A store of 0 by i8080_interrupt is seen within an op code or two.
+static inline uint64_t i8080_run_until(intel8080_t *cpu)
+{
+	return atomic_load_explicit(&cpu->run_until, memory_order_relaxed);
+}
+
+void i8080_interrupt(intel8080_t *cpu, uint8_t vector);
+bool i8080_run_continue(intel8080_t *cpu, uint64_t end);
+
 void i8080_cycle(intel8080_t *cpu);
+void i8080_run(intel8080_t *cpu, uint32_t budget);
+
+#ifdef ALTAIR_CPU_STATS
+uint64_t i8080_stats_instructions(intel8080_t *cpu);
+void i8080_stats_sample(intel8080_t *cpu, uint64_t now_ns);
+bool i8080_stats_rate(intel8080_t *cpu, double *instructions_per_second, double *cycles_per_second);
+#endif
 
 #endif
@@ -1,28 +1,74 @@
 #include "memory.h"
+#include <string.h>
 
-extern uint8_t memory[64 * 1024];
+#ifdef ALTAIR_BLOCK_CACHE
+#include "block_cache.h"
+#endif
 
-uint8_t read8(uint16_t address)
+uint8_t read8_slow(memory_t *memory, uint16_t address)
 {
-    return memory[address];
+    uint8_t page = address >> 8;
+
+    if (memory->page_flags[page] & PAGE_MMIO)
+    {
+        return memory->page_read[page](memory->page_context[page], address);
+    }
+    return memory->ram[address];
+}
+
+void write8_slow(memory_t *memory, uint16_t address, uint8_t val)
+{
+    uint8_t page = address >> 8;
+
+    if (memory->page_flags[page] & PAGE_MMIO)
+    {
+        memory->page_write[page](memory->page_context[page], address, val);
+        return;
+    }
+
+    if (memory->page_flags[page] & PAGE_ROM)
+    {
+        return;
+    }
+
+    memory->ram[address] = val;
+
+#ifdef ALTAIR_BLOCK_CACHE
+    if (block_cache_covers(memory->block_cache, address))
+    {
+        block_cache_invalidate(memory->block_cache, address);
+    }
+#endif
 }
 
-void write8(uint16_t address, uint8_t val)
+/// <summary>
+/// Clear RAM and return every page to plain RAM with no device hooks
+/// </summary>
+void memory_init(memory_t *memory)
 {
-    memory[address] = val;
+    memset(memory, 0x00, sizeof(memory_t));
 }
 
-// #endif
+void memory_set_page_flags(memory_t *memory, uint8_t page, uint8_t flags)
+{
+    memory->page_flags[page] |= flags;
+}
 
-uint16_t read16(uint16_t address)
+/// <summary>
+/// Clear the given attribute bits on every page, PAGE_ROM | PAGE_MMIO | PAGE_WATCHED returns all memory to plain RAM
+/// </summary>
+void memory_clear_page_flags(memory_t *memory, uint8_t flags)
 {
-    uint16_t result = read8(address);
-    result |= read8(address + 1) << 8;
-    return result;
+    for (int page = 0; page < 256; page++)
+    {
+        memory->page_flags[page] &= (uint8_t)~flags;
+    }
 }
 
-void write16(uint16_t address, uint16_t val)
+void memory_map_mmio(memory_t *memory, uint8_t page, mmio_read read, mmio_write write, void *context)
 {
-    write8(address, val & 0xff);
-    write8(address + 1, (val >> 8) & 0xff);
+    memory->page_read[page]    = read;
+    memory->page_write[page]   = write;
+    memory->page_context[page] = context;
+    memory->page_flags[page] |= PAGE_MMIO;
 }
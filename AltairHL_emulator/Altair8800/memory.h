@@ -55,11 +55,73 @@
 //#else
 #include "altair_panel.h"
 
+// Page attributes, one per 256 byte page. Plain RAM pages take the inline fast path.
+#define PAGE_RAM			0x00
+#define PAGE_ROM			0x01	// writes are ignored
+#define PAGE_MMIO			0x02	// reads and writes go to the page's device hooks
+#define PAGE_WATCHED		0x04	// writes are checked against the block cache
+
+#define PAGE_READ_SLOW		(PAGE_MMIO)
+#define PAGE_WRITE_SLOW		(PAGE_ROM | PAGE_MMIO | PAGE_WATCHED)
+
+typedef uint8_t (*mmio_read)(void *context, uint16_t address);
+typedef void (*mmio_write)(void *context, uint16_t address, uint8_t val);
+
+#ifdef ALTAIR_BLOCK_CACHE
+typedef struct block_cache_t block_cache_t;
+#endif
+
+// The 64K address space of one machine
+typedef struct
+{
+	uint8_t ram[64 * 1024];
+	uint8_t page_flags[256];
+	mmio_read page_read[256];
+	mmio_write page_write[256];
+	void *page_context[256];
+
+#ifdef ALTAIR_BLOCK_CACHE
+	block_cache_t *block_cache; // told about writes to PAGE_WATCHED pages
+#endif
+} memory_t;
 
 void load4kRom(uint16_t address);
-uint8_t read8(uint16_t address);
-void write8(uint16_t address, uint8_t val);
-uint16_t read16(uint16_t address);
-void write16(uint16_t address, uint16_t val);
+uint8_t read8_slow(memory_t *memory, uint16_t address);
+void write8_slow(memory_t *memory, uint16_t address, uint8_t val);
+
+void memory_init(memory_t *memory);
+void memory_set_page_flags(memory_t *memory, uint8_t page, uint8_t flags);
+void memory_clear_page_flags(memory_t *memory, uint8_t flags);
+void memory_map_mmio(memory_t *memory, uint8_t page, mmio_read read, mmio_write write, void *context);
+
+static inline uint8_t read8(memory_t *memory, uint16_t address)
+{
+	if (memory->page_flags[address >> 8] & PAGE_READ_SLOW)
+	{
+		return read8_slow(memory, address);
+	}
+	return memory->ram[address];
+}
+
+static inline void write8(memory_t *memory, uint16_t address, uint8_t val)
+{
+	if (memory->page_flags[address >> 8] & PAGE_WRITE_SLOW)
+	{
+		write8_slow(memory, address, val);
+		return;
+	}
+	memory->ram[address] = val;
+}
+
+static inline uint16_t read16(memory_t *memory, uint16_t address)
+{
+	return (uint16_t)(read8(memory, address) | read8(memory, (uint16_t)(address + 1)) << 8);
+}
+
+static inline void write16(memory_t *memory, uint16_t address, uint16_t val)
+{
+	write8(memory, address, (uint8_t)(val & 0xff));
+	write8(memory, (uint16_t)(address + 1), (uint8_t)(val >> 8));
+}
 
 #endif
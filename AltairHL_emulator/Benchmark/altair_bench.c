@@ -0,0 +1,569 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Headless Intel 8080 benchmark. Runs CP/M .COM diagnostics such as CPUDIAG and 8080EXER and BASIC
+// programs under the 8K BASIC ROM on the bare CPU core and reports how fast the host ran them.
+// A workload that prints an error fails the run. The diagnostics are not shipped, copy them to
+// Benchmark/Diagnostics as described in the README there and they are run along with the BASIC samples.
+
+#include "altair_scheduler.h"
+#include "intel8080.h"
+#include "memory.h"
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef ALTAIR_BLOCK_CACHE
+#include "block_cache.h"
+#endif
+
+#define BASIC_SAMPLES_DIRECTORY "BasicSamples"
+#define DIAGNOSTICS_DIRECTORY	"Benchmark/Diagnostics"
+
+#define BENCH_SLICE_CYCLES	   100000	  // T-states run between checks for the end of a workload
+#define BENCH_BASIC_CYCLES	   1000000000 // default cap on BASIC programs, many of them never end
+#define BENCH_INPUT_BYTES	   16 * 1024
+#define BENCH_OUTPUT_TAIL	   16 // console output kept to look for diagnostic errors
+
+// CP/M programs call the BDOS at 0x0005, which jumps to an OUT to this port and a RET
+#define BDOS_ADDRESS		0xfe00
+#define BDOS_PORT			0xfe
+#define BDOS_PRINT_CHAR		2
+#define BDOS_PRINT_STRING	9
+
+// Memory size, terminal width and keep SIN, COS, TAN and ATN
+static const char *basic_boot_answers = "\r\rY\r";
+
+static const uint8_t basic_rom[] = {
+#include "8krom.h"
+};
+
+static const char *default_workloads[] = {
+	BASIC_SAMPLES_DIRECTORY "/LOOPY.BAS",
+	BASIC_SAMPLES_DIRECTORY "/SIEVE.BAS",
+};
+
+// Run before the default workloads when they have been copied into place
+static const char *diagnostic_workloads[] = {
+	DIAGNOSTICS_DIRECTORY "/CPUDIAG.COM",
+	DIAGNOSTICS_DIRECTORY "/8080EXER.COM",
+};
+
+// Console output that fails a workload, a '.' matches any character. CPUDIAG prints "CPU HAS FAILED!" and
+// 8080EXER "ERROR **** crc expected" when an instruction is wrong, 8K BASIC stops a program with "?SN ERROR IN 5".
+static const char *diagnostic_errors[] = {"FAILED", "ERROR", NULL};
+static const char *basic_errors[]	  = {"?.. ERROR", NULL};
+
+// One benchmarked machine, the context of all of its callbacks
+typedef struct
+{
+	intel8080_t cpu;
+	memory_t memory;
+#ifdef ALTAIR_BLOCK_CACHE
+	block_cache_t block_cache;
+#endif
+	char console_input[BENCH_INPUT_BYTES];
+	size_t console_input_length;
+	size_t console_input_index;
+	bool echo;
+	const char **errors; // console output that fails the workload, diagnostic_errors or basic_errors
+	bool failed;		 // one of the errors was printed
+	char output_tail[BENCH_OUTPUT_TAIL];
+	uint64_t max_cycles;
+	bool done;
+} bench_machine_t;
+
+static bool verbose = false;
+static int machine_count = 0; // -j, run the workload on this many machines through the scheduler
+static int worker_count	 = 0; // -w, scheduler worker threads, 0 for one per core
+static atomic_int machines_done;
+
+static uint8_t bench_term_in(void *context)
+{
+	bench_machine_t *machine = context;
+
+	if (machine->console_input_index < machine->console_input_length)
+	{
+		return (uint8_t)machine->console_input[machine->console_input_index++];
+	}
+	return 0;
+}
+
+static bool tail_matches(const char *tail, const char *error)
+{
+	size_t length = strlen(error);
+
+	tail += BENCH_OUTPUT_TAIL - length;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		if (error[i] != '.' && error[i] != tail[i])
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// Slide the character into the output tail and flag the machine if the tail now ends with one of its errors
+/// </summary>
+static void check_output(bench_machine_t *machine, char c)
+{
+	memmove(machine->output_tail, machine->output_tail + 1, BENCH_OUTPUT_TAIL - 1);
+	machine->output_tail[BENCH_OUTPUT_TAIL - 1] = c;
+
+	for (const char **error = machine->errors; *error != NULL; error++)
+	{
+		if (tail_matches(machine->output_tail, *error))
+		{
+			machine->failed = true;
+		}
+	}
+}
+
+static void bench_term_out(void *context, uint8_t c)
+{
+	bench_machine_t *machine = context;
+
+	if (machine->errors != NULL)
+	{
+		check_output(machine, (char)(c & 0x7f));
+	}
+
+	if (machine->echo)
+	{
+		putchar(c & 0x7f);
+	}
+}
+
+static uint8_t bench_sense(void *context)
+{
+	(void)context;
+	return 0x00; // 8K BASIC uses the 2SIO console when the sense switches are all off
+}
+
+static uint8_t bench_disk_in(void *context)
+{
+	(void)context;
+	return 0xff; // no drive selected
+}
+
+static void bench_disk_out(void *context, uint8_t data)
+{
+	(void)context;
+	(void)data;
+}
+
+static uint8_t bench_port_in(void *context, uint8_t port)
+{
+	(void)context;
+	(void)port;
+	return 0x00;
+}
+
+/// <summary>
+/// The only port handled is the CP/M BDOS trap, the registers are read straight from the CPU
+/// </summary>
+static void bench_port_out(void *context, uint8_t port, uint8_t data)
+{
+	bench_machine_t *machine = context;
+	registers_t *registers	 = &machine->cpu.registers;
+
+	(void)data;
+
+	if (port != BDOS_PORT)
+	{
+		return;
+	}
+
+	switch (registers->c)
+	{
+		case BDOS_PRINT_CHAR:
+			bench_term_out(context, registers->e);
+			break;
+		case BDOS_PRINT_STRING:
+			for (uint16_t address = registers->de; machine->memory.ram[address] != '$'; address++)
+			{
+				bench_term_out(context, machine->memory.ram[address]);
+			}
+			break;
+		default:
+			break;
+	}
+}
+
+static void bench_reset(bench_machine_t *machine)
+{
+	disk_controller_t disk_controller = {
+		.disk_select   = bench_disk_out,
+		.disk_status   = bench_disk_in,
+		.disk_function = bench_disk_out,
+		.sector        = bench_disk_in,
+		.write         = bench_disk_out,
+		.read          = bench_disk_in,
+	};
+
+	memory_init(&machine->memory);
+#ifdef ALTAIR_BLOCK_CACHE
+	block_cache_init(&machine->block_cache, &machine->memory);
+#endif
+
+	i8080_reset(&machine->cpu, &machine->memory, machine, bench_term_in, bench_term_out, bench_sense, &disk_controller,
+		bench_port_in, bench_port_out);
+
+	machine->console_input_length = 0;
+	machine->console_input_index  = 0;
+	machine->errors				  = NULL;
+	machine->failed				  = false;
+	machine->done				  = false;
+	memset(machine->output_tail, 0x00, sizeof(machine->output_tail));
+}
+
+static bool read_file(const char *file_name, uint8_t *buffer, size_t size, size_t *length)
+{
+	FILE *fp = fopen(file_name, "rb");
+
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Failed to open %s\n", file_name);
+		return false;
+	}
+
+	*length = fread(buffer, 1, size, fp);
+	fclose(fp);
+	return true;
+}
+
+/// <summary>
+/// Load a CP/M program at 0x0100 with a BDOS that only prints, a warm boot through 0x0000 halts the CPU
+/// </summary>
+static bool load_com(bench_machine_t *machine, const char *file_name)
+{
+	uint8_t *ram = machine->memory.ram;
+	size_t length;
+
+	if (!read_file(file_name, &ram[0x0100], BDOS_ADDRESS - 0x0100, &length))
+	{
+		return false;
+	}
+
+	ram[0x0000] = 0x76; // HLT
+	ram[0x0005] = 0xc3; // JMP BDOS_ADDRESS, which CP/M programs also read as the top of memory
+	ram[0x0006] = BDOS_ADDRESS & 0xff;
+	ram[0x0007] = BDOS_ADDRESS >> 8;
+
+	ram[BDOS_ADDRESS]	  = 0xd3; // OUT BDOS_PORT
+	ram[BDOS_ADDRESS + 1] = BDOS_PORT;
+	ram[BDOS_ADDRESS + 2] = 0xc9; // RET
+
+	machine->errors = diagnostic_errors;
+	i8080_examine(&machine->cpu, 0x0100);
+	return true;
+}
+
+/// <summary>
+/// Load the 8K BASIC ROM and queue the boot answers, the program and RUN as console input
+/// </summary>
+static bool load_basic(bench_machine_t *machine, const char *file_name)
+{
+	char *input = machine->console_input;
+	size_t length;
+
+	memcpy(machine->memory.ram, basic_rom, sizeof(basic_rom));
+
+	machine->console_input_length = (size_t)snprintf(input, BENCH_INPUT_BYTES, "%s", basic_boot_answers);
+
+	if (!read_file(file_name, (uint8_t *)&input[machine->console_input_length],
+			BENCH_INPUT_BYTES - machine->console_input_length - sizeof("\rRUN\r"), &length))
+	{
+		return false;
+	}
+
+	// BASIC takes a carriage return at the end of each line
+	for (size_t i = machine->console_input_length; i < machine->console_input_length + length; i++)
+	{
+		if (input[i] == '\n')
+		{
+			input[i] = '\r';
+		}
+	}
+	machine->console_input_length += length;
+
+	// End a last line without a newline, or RUN would be typed onto it
+	if (length && input[machine->console_input_length - 1] != '\r')
+	{
+		input[machine->console_input_length++] = '\r';
+	}
+	machine->console_input_length += (size_t)snprintf(&input[machine->console_input_length],
+		BENCH_INPUT_BYTES - machine->console_input_length, "RUN\r");
+
+	machine->errors = basic_errors;
+	i8080_examine(&machine->cpu, 0x0000);
+	return true;
+}
+
+static void cpu_run(intel8080_t *cpu, uint32_t cycles)
+{
+#ifdef ALTAIR_BLOCK_CACHE
+	i8080_block_run(cpu, cycles);
+#else
+	i8080_run(cpu, cycles);
+#endif
+}
+
+static bool has_extension(const char *file_name, const char *extension)
+{
+	size_t name_length		= strlen(file_name);
+	size_t extension_length = strlen(extension);
+
+	return name_length > extension_length &&
+		   strcasecmp(&file_name[name_length - extension_length], extension) == 0;
+}
+
+/// <summary>
+/// A workload ends when it halts, waits for console input that will never come, or has run max_cycles T-states
+/// </summary>
+static bool bench_finished(bench_machine_t *machine)
+{
+	intel8080_t *cpu = &machine->cpu;
+
+	return cpu->halted || (cpu->idle && machine->console_input_index == machine->console_input_length) ||
+		   (machine->max_cycles && cpu->cycles >= machine->max_cycles);
+}
+
+static void run_single(bench_machine_t *machine)
+{
+	while (!bench_finished(machine))
+	{
+		machine->cpu.idle = false;
+		cpu_run(&machine->cpu, BENCH_SLICE_CYCLES);
+	}
+}
+
+static bool bench_ready(void *context)
+{
+	return !((bench_machine_t *)context)->done;
+}
+
+static void bench_slice_done(void *context)
+{
+	bench_machine_t *machine = context;
+
+	if (!machine->done && bench_finished(machine))
+	{
+		machine->done = true;
+		atomic_fetch_add(&machines_done, 1);
+	}
+}
+
+/// <summary>
+/// Time slice all the machines over the scheduler's workers until every one has finished
+/// </summary>
+static bool run_scheduled(bench_machine_t *machines, int count, int *workers)
+{
+	altair_schedule_hooks_t hooks = {.ready = bench_ready, .slice_done = bench_slice_done};
+	altair_scheduler_t *scheduler = malloc(sizeof(altair_scheduler_t));
+
+	if (scheduler == NULL || !altair_scheduler_init(scheduler, worker_count, count, BENCH_SLICE_CYCLES))
+	{
+		fprintf(stderr, "Failed to create the scheduler\n");
+		free(scheduler);
+		return false;
+	}
+
+	atomic_store(&machines_done, 0);
+
+	for (int i = 0; i < count; i++)
+	{
+		altair_scheduler_add(scheduler, &machines[i].cpu, &hooks, &machines[i]);
+	}
+
+	if (!altair_scheduler_start(scheduler))
+	{
+		fprintf(stderr, "Failed to start the scheduler workers\n");
+		altair_scheduler_destroy(scheduler);
+		free(scheduler);
+		return false;
+	}
+
+	while (atomic_load(&machines_done) < count)
+	{
+		nanosleep(&(struct timespec){0, 1000000}, NULL);
+	}
+
+	*workers = scheduler->worker_count;
+	altair_scheduler_destroy(scheduler);
+	free(scheduler);
+	return true;
+}
+
+/// <summary>
+/// Run one workload, on machine_count machines through the scheduler when -j is given
+/// </summary>
+static bool run_workload(const char *file_name, uint64_t max_cycles)
+{
+	bool basic				  = has_extension(file_name, ".BAS");
+	int count				  = machine_count ? machine_count : 1;
+	int workers				  = 1;
+	uint64_t instructions	  = 0;
+	uint64_t cycles			  = 0;
+	int failed				  = 0;
+	bench_machine_t *machines = calloc((size_t)count, sizeof(bench_machine_t));
+	const char *name		  = strrchr(file_name, '/') ? strrchr(file_name, '/') + 1 : file_name;
+	struct timespec start, end;
+	bool ok = true;
+
+	if (machines == NULL)
+	{
+		fprintf(stderr, "Out of memory for %d machines\n", count);
+		return false;
+	}
+
+	if (basic && max_cycles == 0)
+	{
+		max_cycles = BENCH_BASIC_CYCLES;
+	}
+
+	for (int i = 0; i < count && ok; i++)
+	{
+		bench_reset(&machines[i]);
+		machines[i].echo	   = verbose && i == 0;
+		machines[i].max_cycles = max_cycles;
+		ok					   = basic ? load_basic(&machines[i], file_name) : load_com(&machines[i], file_name);
+	}
+
+	if (ok)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (machine_count)
+		{
+			ok = run_scheduled(machines, count, &workers);
+		}
+		else
+		{
+			run_single(&machines[0]);
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &end);
+	}
+
+	if (!ok)
+	{
+		free(machines);
+		return false;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		instructions += i8080_stats_instructions(&machines[i].cpu);
+		cycles += machines[i].cpu.cycles;
+		failed += machines[i].failed;
+	}
+
+	double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	if (verbose)
+	{
+		printf("\n");
+	}
+
+	if (machine_count)
+	{
+		printf("%d machines on %d workers\n", count, workers);
+	}
+
+	printf("%-16s %12" PRIu64 " instructions %14" PRIu64 " T-states %8.3f s %9.2f MIPS %8.2f ns/instruction %14.0f "
+		   "cycles/s\n",
+		name, instructions, cycles, seconds, (double)instructions / seconds / 1e6,
+		instructions ? seconds * 1e9 / (double)instructions : 0.0, (double)cycles / seconds);
+
+	free(machines);
+
+	if (failed)
+	{
+		fprintf(stderr, "%s reported an error on %d of %d machines, run it with -v to see the error\n", name,
+			failed, count);
+		return false;
+	}
+	return true;
+}
+
+static void usage(const char *program)
+{
+	fprintf(stderr,
+		"Usage: %s [-c <million T-states>] [-j <machines>] [-w <workers>] [-v] [program.COM|program.BAS ...]\n"
+		"  -c  stop each workload after this many million T-states, BASIC programs default to %d\n"
+		"  -j  run each workload on this many machines at once through the scheduler, totals are reported\n"
+		"  -w  scheduler worker threads, one per host core by default\n"
+		"  -v  echo the 8080 console output, of the first machine with -j\n"
+		"With no programs CPUDIAG.COM and 8080EXER.COM are run from " DIAGNOSTICS_DIRECTORY " if they are there,\n"
+		"then the BASIC samples LOOPY.BAS and SIEVE.BAS. A workload that prints an error, a diagnostic's\n"
+		"failure or a BASIC ?xx ERROR, fails the run.\n",
+		program, BENCH_BASIC_CYCLES / 1000000);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t max_cycles = 0;
+	int option;
+	int failures = 0;
+
+	while ((option = getopt(argc, argv, "c:j:w:v")) != -1)
+	{
+		switch (option)
+		{
+			case 'c':
+				max_cycles = strtoull(optarg, NULL, 10) * 1000000;
+				break;
+			case 'j':
+				machine_count = atoi(optarg);
+				break;
+			case 'w':
+				worker_count = atoi(optarg);
+				break;
+			case 'v':
+				verbose = true;
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (optind < argc)
+	{
+		for (int i = optind; i < argc; i++)
+		{
+			failures += !run_workload(argv[i], max_cycles);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < sizeof(diagnostic_workloads) / sizeof(diagnostic_workloads[0]); i++)
+		{
+			if (access(diagnostic_workloads[i], R_OK) == 0)
+			{
+				failures += !run_workload(diagnostic_workloads[i], max_cycles);
+			}
+			else
+			{
+				printf("%s not found, see " DIAGNOSTICS_DIRECTORY "/README.md\n", diagnostic_workloads[i]);
+			}
+		}
+
+		for (size_t i = 0; i < sizeof(default_workloads) / sizeof(default_workloads[0]); i++)
+		{
+			failures += !run_workload(default_workloads[i], max_cycles);
+		}
+	}
+
+	return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,209 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Exhaustive check of the 8080 ALU flags. Every arithmetic and logic op code is run for every accumulator, operand,
+// carry and auxiliary carry and the accumulator and flags compared with the get_parity and check_carry based code the
+// flag tables replaced. Exits non zero on the first few mismatches.
+
+#include "intel8080.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define OP_ADD_B 0x80
+#define OP_ADC_B 0x88
+#define OP_SUB_B 0x90
+#define OP_SBB_B 0x98
+#define OP_ANA_B 0xa0
+#define OP_XRA_B 0xa8
+#define OP_ORA_B 0xb0
+#define OP_CMP_B 0xb8
+#define OP_INR_A 0x3c
+#define OP_DCR_A 0x3d
+#define OP_DAA	 0x27
+
+#define MAX_REPORTED 16
+
+static const uint8_t op_codes[] = {OP_ADD_B, OP_ADC_B, OP_SUB_B, OP_SBB_B, OP_ANA_B, OP_XRA_B,
+								   OP_ORA_B, OP_CMP_B, OP_INR_A, OP_DCR_A, OP_DAA};
+
+// The reference accumulator and flags, worked out one flag at a time the way intel8080.c used to
+typedef struct
+{
+	uint8_t a;
+	uint8_t flags;
+} reference_t;
+
+static uint8_t get_parity(uint8_t val)
+{
+	val ^= val >> 4;
+	val &= 0xf;
+	return !((0x6996 >> val) & 1);
+}
+
+static int check_carry(uint16_t a, uint16_t b)
+{
+	return (a + b) > 0xff;
+}
+
+static int check_half_carry(uint16_t a, uint16_t b)
+{
+	return ((a & 0xf) + (b & 0xf)) > 0xf;
+}
+
+static void set_flag(reference_t *ref, uint8_t flag, int set)
+{
+	ref->flags = set ? ref->flags | flag : ref->flags & ~flag;
+}
+
+static void update_flags(reference_t *ref, uint8_t val)
+{
+	set_flag(ref, FLAGS_PARITY, get_parity(val));
+	set_flag(ref, FLAGS_ZERO, val == 0);
+	set_flag(ref, FLAGS_SIGN, val & 0x80);
+}
+
+static void ref_add(reference_t *ref, uint16_t val)
+{
+	set_flag(ref, FLAGS_H, check_half_carry(ref->a, val));
+	set_flag(ref, FLAGS_CARRY, check_carry(ref->a, val));
+	ref->a += val;
+	update_flags(ref, ref->a);
+}
+
+static void ref_sub(reference_t *ref, uint16_t val)
+{
+	uint16_t b = 0x100 - val;
+
+	set_flag(ref, FLAGS_H, check_half_carry(ref->a, b));
+	set_flag(ref, FLAGS_CARRY, !check_carry(ref->a, b));
+	ref->a = (ref->a + b) & 0xff;
+	update_flags(ref, ref->a);
+}
+
+static uint8_t ref_inr_dcr(reference_t *ref, uint8_t val, uint8_t add)
+{
+	set_flag(ref, FLAGS_H, check_half_carry(val, add));
+	val += add;
+	update_flags(ref, val);
+	return val;
+}
+
+static void ref_daa(reference_t *ref)
+{
+	uint8_t val = ref->a, add = 0;
+
+	if ((val & 0xf) > 9 || ref->flags & FLAGS_H)
+		add += 0x06;
+
+	val += add;
+
+	if (((val & 0xf0) >> 4) > 9 || ref->flags & FLAGS_CARRY)
+		add += 0x60;
+
+	ref_add(ref, add);
+}
+
+static void reference(reference_t *ref, uint8_t op_code, uint8_t operand)
+{
+	uint8_t carry = ref->flags & FLAGS_CARRY;
+	uint8_t a	  = ref->a;
+
+	switch (op_code)
+	{
+	case OP_ADD_B:
+		ref_add(ref, operand);
+		break;
+	case OP_ADC_B:
+		ref_add(ref, (uint16_t)(operand + carry));
+		break;
+	case OP_SUB_B:
+		ref_sub(ref, operand);
+		break;
+	case OP_SBB_B:
+		ref_sub(ref, (uint16_t)(operand + carry));
+		break;
+	case OP_CMP_B:
+		ref_sub(ref, operand);
+		ref->a = a;
+		break;
+	case OP_ANA_B:
+		ref->a &= operand;
+		set_flag(ref, FLAGS_CARRY, 0);
+		update_flags(ref, ref->a);
+		break;
+	case OP_XRA_B:
+		ref->a ^= operand;
+		set_flag(ref, FLAGS_CARRY | FLAGS_H, 0);
+		update_flags(ref, ref->a);
+		break;
+	case OP_ORA_B:
+		ref->a |= operand;
+		set_flag(ref, FLAGS_CARRY | FLAGS_H, 0);
+		update_flags(ref, ref->a);
+		break;
+	case OP_INR_A:
+		ref->a = ref_inr_dcr(ref, ref->a, 1);
+		break;
+	case OP_DCR_A:
+		ref->a = ref_inr_dcr(ref, ref->a, 0xff);
+		break;
+	case OP_DAA:
+		ref_daa(ref);
+		break;
+	}
+}
+
+int main(void)
+{
+	static memory_t memory;
+	disk_controller_t disk_controller = {0};
+	intel8080_t cpu;
+	unsigned long checked = 0, failed = 0;
+
+	memory_init(&memory);
+	i8080_reset(&cpu, &memory, NULL, NULL, NULL, NULL, &disk_controller, NULL, NULL);
+
+	for (size_t op = 0; op < sizeof(op_codes); op++)
+	{
+		memory.ram[0] = op_codes[op];
+
+		for (unsigned int a = 0; a < 256; a++)
+		{
+			// INR, DCR and DAA have no operand, run them once per accumulator
+			unsigned int operands = op_codes[op] == OP_INR_A || op_codes[op] == OP_DCR_A || op_codes[op] == OP_DAA ? 1 : 256;
+
+			for (unsigned int operand = 0; operand < operands; operand++)
+			{
+				for (uint8_t carries = 0; carries < 4; carries++)
+				{
+					uint8_t flags	= 0x02 | (carries & 1 ? FLAGS_CARRY : 0) | (carries & 2 ? FLAGS_H : 0);
+					reference_t ref = {(uint8_t)a, flags};
+
+					cpu.registers.pc	= 0;
+					cpu.registers.a		= (uint8_t)a;
+					cpu.registers.b		= (uint8_t)operand;
+					cpu.registers.flags = flags;
+					cpu.flags_result	= FLAGS_RESOLVED;
+
+					i8080_cycle(&cpu);
+					i8080_get_flags(&cpu);
+					reference(&ref, op_codes[op], (uint8_t)operand);
+					checked++;
+
+					if (cpu.registers.a != ref.a || cpu.registers.flags != ref.flags)
+					{
+						if (failed++ < MAX_REPORTED)
+						{
+							printf("op %02x a %02x operand %02x flags %02x: got a %02x flags %02x, expected a %02x flags %02x\n",
+								op_codes[op], a, operand, flags, cpu.registers.a, cpu.registers.flags, ref.a, ref.flags);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	printf("%lu ALU cases checked, %lu failed\n", checked, failed);
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,319 @@
+/* Copyright (c) Microsoft Corporation. All rights reserved.
+   Licensed under the MIT License. */
+
+// Headless 88-DCDD disk benchmark. Drives the disk controller the way the CP/M BIOS does, stepping the head,
+// polling for sectors and reading or writing them a byte at a time, against a scratch disk image for each disk
+// backend and reports how long the host took.
+
+#include "88dcdd.h"
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DISK_TRACKS				77
+#define DISK_SECTORS			32
+#define DIRECTORY_TRACK			2
+#define BENCH_IMAGE				"disk_bench.dsk"
+
+static int filesystem_reads, mapped_reads, track_cache_hits, track_cache_misses, difference_disk_reads,
+	difference_disk_writes;
+
+DX_DEVICE_TWIN_BINDING dt_filesystem_reads		= {.propertyValue = &filesystem_reads};
+DX_DEVICE_TWIN_BINDING dt_mapped_reads			= {.propertyValue = &mapped_reads};
+DX_DEVICE_TWIN_BINDING dt_track_cache_hits		= {.propertyValue = &track_cache_hits};
+DX_DEVICE_TWIN_BINDING dt_track_cache_misses	= {.propertyValue = &track_cache_misses};
+DX_DEVICE_TWIN_BINDING dt_difference_disk_reads	= {.propertyValue = &difference_disk_reads};
+DX_DEVICE_TWIN_BINDING dt_difference_disk_writes = {.propertyValue = &difference_disk_writes};
+
+typedef enum
+{
+	BACKEND_FILE,
+	BACKEND_MMAP,
+	BACKEND_URING
+} DISK_BACKEND;
+
+static const char *backend_names[] = {"file", "mmap", "io_uring"};
+
+typedef struct
+{
+	disks drive;
+	uint64_t sectors_read;
+	uint64_t sectors_written;
+	uint32_t checksum;
+} bench_disk_t;
+
+static uint64_t now_ns(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+/// <summary>
+/// Write a disk image of recognisable sector data so every backend starts from the same bytes
+/// </summary>
+static bool create_image(const char *file_name)
+{
+	uint8_t track[TRACK];
+	FILE *fp = fopen(file_name, "wb");
+
+	if (fp == NULL)
+	{
+		return false;
+	}
+
+	for (uint32_t t = 0; t < DISK_TRACKS; t++)
+	{
+		for (size_t i = 0; i < sizeof(track); i++)
+		{
+			track[i] = (uint8_t)(t * 31 + i * 7);
+		}
+		fwrite(track, 1, sizeof(track), fp);
+	}
+
+	return fclose(fp) == 0;
+}
+
+static void step_to(bench_disk_t *bench, uint8_t track)
+{
+	while (bench->drive.current->track < track)
+	{
+		disk_function(&bench->drive, CONTROL_STEP_IN);
+	}
+	while (bench->drive.current->track > track)
+	{
+		disk_function(&bench->drive, CONTROL_STEP_OUT);
+	}
+}
+
+// The BIOS polls the sector register until the sector it wants comes under the head
+static void wait_for_sector(bench_disk_t *bench, uint8_t sector_number)
+{
+	while ((sector(&bench->drive) >> 1) != sector_number)
+	{
+	}
+}
+
+static void read_sector(bench_disk_t *bench, uint8_t track, uint8_t sector_number)
+{
+	step_to(bench, track);
+	wait_for_sector(bench, sector_number);
+
+	for (size_t i = 0; i < SECTOR_SIZE; i++)
+	{
+		bench->checksum = bench->checksum * 31 + disk_read(&bench->drive);
+	}
+	bench->sectors_read++;
+}
+
+static void write_sector(bench_disk_t *bench, uint8_t track, uint8_t sector_number, uint8_t seed)
+{
+	step_to(bench, track);
+	wait_for_sector(bench, sector_number);
+	disk_function(&bench->drive, CONTROL_WE);
+
+	// The controller writes the sector when it has the whole sector and a trailing byte
+	for (size_t i = 0; i <= SECTOR_SIZE; i++)
+	{
+		disk_write(&bench->drive, (uint8_t)(seed + i));
+	}
+	bench->sectors_written++;
+}
+
+/// <summary>
+/// One pass of a compile like workload: look the files up in the directory, load a program, read a source file
+/// a sector at a time with the usual two to one interleave, write the output file and update the directory
+/// </summary>
+static void run_workload(bench_disk_t *bench, uint8_t pass)
+{
+	for (uint8_t s = 0; s < 8; s++)
+	{
+		read_sector(bench, DIRECTORY_TRACK, s);
+	}
+
+	for (uint8_t t = 3; t < 40; t++)
+	{
+		for (uint8_t s = 0; s < DISK_SECTORS; s++)
+		{
+			read_sector(bench, t, (uint8_t)((s * 2) % DISK_SECTORS + (s * 2) / DISK_SECTORS));
+		}
+	}
+
+	for (uint8_t t = 40; t < 55; t++)
+	{
+		for (uint8_t s = 0; s < DISK_SECTORS; s += 2)
+		{
+			read_sector(bench, t, s);
+			write_sector(bench, (uint8_t)(t + 15), s, (uint8_t)(pass + t + s));
+		}
+	}
+
+	write_sector(bench, DIRECTORY_TRACK, 0, pass);
+	read_sector(bench, DIRECTORY_TRACK, 0);
+
+	for (uint8_t t = 55; t < 70; t++)
+	{
+		for (uint8_t s = 0; s < DISK_SECTORS; s += 2)
+		{
+			read_sector(bench, t, s);
+		}
+	}
+}
+
+static bool run_backend(DISK_BACKEND backend, const char *image, int passes, bool writeback, bool cold)
+{
+	static bench_disk_t bench;
+	disk_uring_t ring;
+	disk_writeback_t writeback_queue;
+	uint64_t elapsed_ns = 0;
+	bool written		= true;
+
+	memset(&bench, 0x00, sizeof(bench));
+	filesystem_reads = mapped_reads = track_cache_hits = track_cache_misses = 0;
+
+	if (!create_image(image) || (bench.drive.disk1.fp = open(image, O_RDWR)) == -1)
+	{
+		fprintf(stderr, "Failed to create %s\n", image);
+		return false;
+	}
+	bench.drive.current = &bench.drive.disk1;
+
+	if (backend == BACKEND_MMAP && !disk_map_image(&bench.drive.disk1, true))
+	{
+		fprintf(stderr, "%s: failed to map the disk image\n", backend_names[backend]);
+		close(bench.drive.disk1.fp);
+		return false;
+	}
+	if (backend == BACKEND_URING)
+	{
+		if (!disk_uring_init(&ring))
+		{
+			fprintf(stderr, "%s: not available on this host\n", backend_names[backend]);
+			close(bench.drive.disk1.fp);
+			return false;
+		}
+		bench.drive.uring = &ring;
+	}
+	if (writeback && backend != BACKEND_MMAP && disk_writeback_start(&writeback_queue))
+	{
+		bench.drive.writeback = &writeback_queue;
+	}
+
+	disk_select(&bench.drive, 0);
+	disk_function(&bench.drive, CONTROL_HEAD_LOAD);
+
+	for (int pass = 0; pass < passes; pass++)
+	{
+		if (cold)
+		{
+			if (bench.drive.writeback != NULL && !disk_writeback_flush(bench.drive.writeback))
+			{
+				fprintf(stderr, "%s: sector writes failed\n", backend_names[backend]);
+				written = false;
+			}
+			fdatasync(bench.drive.disk1.fp);
+			posix_fadvise(bench.drive.disk1.fp, 0, 0, POSIX_FADV_DONTNEED);
+			bench.drive.disk1.trackBytes = 0;
+		}
+
+		uint64_t start = now_ns();
+		run_workload(&bench, (uint8_t)pass);
+		elapsed_ns += now_ns() - start;
+	}
+
+	if (bench.drive.writeback != NULL && !disk_writeback_stop(bench.drive.writeback))
+	{
+		fprintf(stderr, "%s: sectors lost on stop\n", backend_names[backend]);
+		written = false;
+	}
+	if (backend == BACKEND_MMAP)
+	{
+		disk_unmap_image(&bench.drive.disk1);
+	}
+	if (bench.drive.uring != NULL)
+	{
+		disk_uring_close(bench.drive.uring);
+	}
+	close(bench.drive.disk1.fp);
+
+	printf("%-9s %8.2f ms  %8" PRIu64 " sectors read %7" PRIu64 " written  %6d file reads  %7d mapped reads  %7d track "
+		   "hits %5d misses  checksum %08x\n",
+		backend_names[backend], (double)elapsed_ns / 1e6, bench.sectors_read, bench.sectors_written, filesystem_reads,
+		mapped_reads, track_cache_hits, track_cache_misses, bench.checksum);
+	return written;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"usage: %s [-b file|mmap|io_uring] [-n passes] [-w] [-c] [-f image]\n"
+		"  -b  backend to run, all of them by default\n"
+		"  -n  workload passes, default 20\n"
+		"  -w  write sectors back on the I/O thread\n"
+		"  -c  drop the image from the page cache before each pass\n"
+		"  -f  scratch disk image, default " BENCH_IMAGE "\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *image = BENCH_IMAGE;
+	int backend		  = -1;
+	int passes		  = 20;
+	bool writeback	  = false;
+	bool cold		  = false;
+	int option;
+
+	while ((option = getopt(argc, argv, "b:n:wcf:h")) != -1)
+	{
+		switch (option)
+		{
+			case 'b':
+				for (int i = 0; i < (int)(sizeof(backend_names) / sizeof(backend_names[0])); i++)
+				{
+					if (strcmp(optarg, backend_names[i]) == 0)
+					{
+						backend = i;
+					}
+				}
+				if (backend == -1)
+				{
+					usage(argv[0]);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'n':
+				passes = atoi(optarg);
+				break;
+			case 'w':
+				writeback = true;
+				break;
+			case 'c':
+				cold = true;
+				break;
+			case 'f':
+				image = optarg;
+				break;
+			default:
+				usage(argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	bool ok = true;
+	for (int i = BACKEND_FILE; i <= BACKEND_URING; i++)
+	{
+		if (backend == -1 || backend == i)
+		{
+			ok = run_backend((DISK_BACKEND)i, image, passes, writeback, cold) && ok;
+		}
+	}
+
+	unlink(image);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
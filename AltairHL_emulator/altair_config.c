@@ -7,7 +7,9 @@
 static const char *cmdLineArgsUsageText =
 	"DPS connection type: \"CmdArgs:\" -s \"<your_scope_id>\" -d \"<your_device_id>\" -k "
 	"\"<your_device_key>\"\n"
-	"Connection string type: \"CmdArgs:\" -c \"<iot_hub_central_connection_string>\"\n";
+	"Connection string type: \"CmdArgs:\" -c \"<iot_hub_central_connection_string>\"\n"
+	"CPU clock speed in MHz, 0 for unthrottled: -m <2|4|0>\n"
+	"Disk journal sync interval in milliseconds: -j <1000>\n";
 
 bool parse_altair_cmd_line_arguments(int argc, char *argv[], ALTAIR_CONFIG_T *altair_config)
 {
@@ -21,12 +23,14 @@ bool parse_altair_cmd_line_arguments(int argc, char *argv[], ALTAIR_CONFIG_T *al
 		{.name = "Hostname", .has_arg = required_argument, .flag = NULL, .val = 'h'},
 		{.name = "NetworkInterface", .has_arg = required_argument, .flag = NULL, .val = 'n'},
 		{.name = "OpenWeatherMapKey", .has_arg = required_argument, .flag = NULL, .val = 'o'},
-		{.name = "CopyXUrl", .has_arg = required_argument, .flag = NULL, .val = 'u'}};
+		{.name = "CopyXUrl", .has_arg = required_argument, .flag = NULL, .val = 'u'},
+		{.name = "ClockSpeed", .has_arg = required_argument, .flag = NULL, .val = 'm'},
+		{.name = "JournalSyncMs", .has_arg = required_argument, .flag = NULL, .val = 'j'}};
 
 	altair_config->user_config.connectionType = DX_CONNECTION_TYPE_NOT_DEFINED;
 
 	// Loop over all of the options.
-	while ((option = getopt_long(argc, argv, "s:c:k:d:n:o:u:", cmdLineOptions, NULL)) != -1)
+	while ((option = getopt_long(argc, argv, "s:c:k:d:n:o:u:m:j:", cmdLineOptions, NULL)) != -1)
 	{
 		// Check if arguments are missing. Every option requires an argument.
 		if (optarg != NULL && optarg[0] == '-')
@@ -59,6 +63,16 @@ bool parse_altair_cmd_line_arguments(int argc, char *argv[], ALTAIR_CONFIG_T *al
 			case 'u':
 				altair_config->copy_x_url = optarg;
 				break;
+			case 'm':
+				altair_config->clock_speed_mhz = atoi(optarg);
+				if (altair_config->clock_speed_mhz < 0)
+				{
+					altair_config->clock_speed_mhz = 0;
+				}
+				break;
+			case 'j':
+				altair_config->journal_sync_ms = (uint32_t)strtoul(optarg, NULL, 10);
+				break;
 			default:
 				// Unknown options are ignored.
 				break;
@@ -6,6 +6,7 @@
 #include "dx_config.h"
 #include "dx_utilities.h"
 #include <ctype.h>
+#include <stdlib.h>
 #include <getopt.h>
 #include <string.h>
 
@@ -14,6 +15,8 @@ typedef struct
 	DX_USER_CONFIG user_config;
 	char *open_weather_map_api_key;
 	char *copy_x_url;
+	int clock_speed_mhz; // 0 runs the CPU unthrottled
+	uint32_t journal_sync_ms; // ALTAIR_DIFFERENCE_JOURNAL sync interval, 0 for the default
 } ALTAIR_CONFIG_T;
 
 bool parse_altair_cmd_line_arguments(int argc, char *argv[], ALTAIR_CONFIG_T *altairConfig);
@@ -71,6 +71,74 @@ static void process_virtual_switches(const char *command)
 	}
 }
 
+#ifdef ALTAIR_CPU_STATS
+#define CPU_STATS_TOP_OP_CODES 10
+
+/// <summary>
+/// Publish instruction and T-state totals, the current rate and the most frequently run op codes
+/// </summary>
+static void publish_cpu_stats(void)
+{
+	double instructions_per_second = 0;
+	double cycles_per_second       = 0;
+	uint64_t instructions          = i8080_stats_instructions(&altair.cpu);
+	uint8_t instruction_length     = 0;
+	uint8_t top[CPU_STATS_TOP_OP_CODES];
+	int top_count = 0;
+
+	i8080_stats_rate(&altair.cpu, &instructions_per_second, &cycles_per_second);
+
+	size_t msg_length = (size_t)snprintf(panel_info, sizeof(panel_info),
+		"\r\n%15s: %" PRIu64 "\r\n%15s: %" PRIu64 "\r\n%15s: %.2f\r\n%15s: %.2f", "Instructions", instructions,
+		"T-states", altair.cpu.cycles, "MIPS", instructions_per_second / 1e6, "Clock MHz", cycles_per_second / 1e6);
+	publish_message(panel_info, msg_length);
+
+	// Insertion sort the op codes run into the top list, most frequent first
+	for (int op_code = 0; op_code < 256; op_code++)
+	{
+		uint64_t count = altair.cpu.stats.op_counts[op_code];
+		int slot;
+
+		if (count == 0)
+		{
+			continue;
+		}
+
+		if (top_count < CPU_STATS_TOP_OP_CODES)
+		{
+			slot = top_count++;
+		}
+		else if (count > altair.cpu.stats.op_counts[top[CPU_STATS_TOP_OP_CODES - 1]])
+		{
+			slot = CPU_STATS_TOP_OP_CODES - 1;
+		}
+		else
+		{
+			continue;
+		}
+
+		while (slot > 0 && altair.cpu.stats.op_counts[top[slot - 1]] < count)
+		{
+			top[slot] = top[slot - 1];
+			slot--;
+		}
+		top[slot] = (uint8_t)op_code;
+	}
+
+	for (int i = 0; i < top_count; i++)
+	{
+		uint64_t count = altair.cpu.stats.op_counts[top[i]];
+
+		msg_length = (size_t)snprintf(panel_info, sizeof(panel_info), "\r\n%15s: 0x%02x %-15s %" PRIu64 " (%.1f%%)",
+			"Op code", top[i], get_i8080_instruction_name(top[i], &instruction_length), count,
+			(double)count * 100 / (double)instructions);
+		publish_message(panel_info, msg_length);
+	}
+
+	publish_message("\r\nCPU MONITOR> ", 15);
+}
+#endif // ALTAIR_CPU_STATS
+
 void process_virtual_input(const char *command)
 {
 	if (strlen(command) == 0)
@@ -124,6 +192,45 @@ void process_virtual_input(const char *command)
 		cmd_switches = LOAD_ALTAIR_BASIC;
 		process_control_panel_commands();
 	}
+	else if (strcmp(command, "SNAPSHOT") == 0)
+	{
+		altair_park();
+		const char *result = altair_snapshot_save(&altair, ALTAIR_SNAPSHOT) ? "\r\nSnapshot saved" : "\r\nSnapshot failed";
+		altair_unpark();
+		publish_message(result, strlen(result));
+		publish_message("\r\nCPU MONITOR> ", 15);
+	}
+	else if (strcmp(command, "RESTORE") == 0)
+	{
+		// The worker must be off the machine while the snapshot replaces it
+		altair_park();
+		bool restored = altair_snapshot_load(&altair, ALTAIR_SNAPSHOT);
+#ifdef ALTAIR_DIFFERENCE_JOURNAL
+		// A restart must replay the restored differencing disk, not the writes made before the restore
+		if (restored && altair.disk_drive.journal != NULL)
+		{
+			disk_journal_replace(altair.disk_drive.journal, &altair.disk_drive.difference_disk);
+		}
+#endif
+		altair_unpark();
+
+		if (restored)
+		{
+			bus_switches = altair.cpu.registers.pc;
+			publish_cpu_state("Restore", altair.cpu.address_bus, altair.cpu.data_bus);
+		}
+		else
+		{
+			publish_message("\r\nNo snapshot", 13);
+			publish_message("\r\nCPU MONITOR> ", 15);
+		}
+	}
+#ifdef ALTAIR_CPU_STATS
+	else if (strcmp(command, "STATS") == 0)
+	{
+		publish_cpu_stats();
+	}
+#endif // ALTAIR_CPU_STATS
 	else
 	{
 		process_virtual_switches(command);
@@ -271,7 +378,7 @@ bool loadRomImage(char *romImageName, uint16_t loadAddress)
 	off_t length = lseek(romFd, 0, SEEK_END);
 	lseek(romFd, 0, SEEK_SET);
 
-	ssize_t bytes = read(romFd, &memory[loadAddress], (size_t)length);
+	ssize_t bytes = read(romFd, &altair.memory.ram[loadAddress], (size_t)length);
 	close(romFd);
 
 	return bytes == length;
@@ -287,7 +394,7 @@ bool loadRomImage(char *romImageName, uint16_t loadAddress)
 	off_t length = lseek(romFd, 0, SEEK_END);
 	lseek(romFd, 0, SEEK_SET);
 
-	ssize_t bytes = read(romFd, &memory[loadAddress], (size_t)length);
+	ssize_t bytes = read(romFd, &altair.memory.ram[loadAddress], (size_t)length);
 	close(romFd);
 
 	return bytes == length;
@@ -296,15 +403,25 @@ bool loadRomImage(char *romImageName, uint16_t loadAddress)
 
 void load_boot_disk(void)
 {
-	memset(memory, 0x00, 64 * 1024); // clear altair memory.
+	altair_machine_clear_memory(&altair);
+
+	altair.cpu.interrupt_enable    = false;
+	altair.cpu.interrupt_request   = 0;
+	altair.cpu.serial_rx_interrupt = false;
+	altair.cpu.serial_rx_character = 0;
 	// load Disk Loader at 0xff00
 	if (!loadRomImage(DISK_LOADER, 0xff00))
 	{
 		Log_Debug("Failed to open %s disk load ROM image\n", DISK_LOADER);
 	}
+	memory_set_page_flags(&altair.memory, 0xff, PAGE_ROM);
+
+#ifdef ALTAIR_BLOCK_CACHE
+	block_cache_flush(&altair.block_cache); // memory was rewritten behind write8
+#endif
 	// print_console_banner();
 
-	i8080_examine(&cpu, 0xff00); // 0xff00 loads from disk boot loader
+	i8080_examine(&altair.cpu, 0xff00); // 0xff00 loads from disk boot loader
 }
 
 /// <summary>
@@ -315,52 +432,57 @@ void altair_panel_command_handler(void)
 	switch (deferred_command)
 	{
 		case SINGLE_STEP:
-			i8080_cycle(&cpu);
-			publish_cpu_state("Single step", cpu.address_bus, cpu.data_bus);
-			bus_switches = cpu.address_bus;
+			i8080_cycle(&altair.cpu);
+			publish_cpu_state("Single step", altair.cpu.address_bus, altair.cpu.data_bus);
+			bus_switches = altair.cpu.address_bus;
 			break;
 		case EXAMINE:
-			i8080_examine(&cpu, bus_switches);
-			publish_cpu_state("Examine", cpu.address_bus, cpu.data_bus);
-			bus_switches = cpu.address_bus;
+			i8080_examine(&altair.cpu, bus_switches);
+			publish_cpu_state("Examine", altair.cpu.address_bus, altair.cpu.data_bus);
+			bus_switches = altair.cpu.address_bus;
 			break;
 		case EXAMINE_NEXT:
-			i8080_examine_next(&cpu);
-			publish_cpu_state("Examine next", cpu.address_bus, cpu.data_bus);
-			bus_switches = cpu.address_bus;
+			i8080_examine_next(&altair.cpu);
+			publish_cpu_state("Examine next", altair.cpu.address_bus, altair.cpu.data_bus);
+			bus_switches = altair.cpu.address_bus;
 			break;
 		case DEPOSIT:
-			i8080_deposit(&cpu, (uint8_t)(bus_switches & 0xff));
-			publish_cpu_state("Deposit", cpu.address_bus, cpu.data_bus);
+			i8080_deposit(&altair.cpu, (uint8_t)(bus_switches & 0xff));
+			publish_cpu_state("Deposit", altair.cpu.address_bus, altair.cpu.data_bus);
 			break;
 		case DEPOSIT_NEXT:
-			i8080_deposit_next(&cpu, (uint8_t)(bus_switches & 0xff));
-			publish_cpu_state("Deposit next", cpu.address_bus, cpu.data_bus);
-			bus_switches = cpu.address_bus;
+			i8080_deposit_next(&altair.cpu, (uint8_t)(bus_switches & 0xff));
+			publish_cpu_state("Deposit next", altair.cpu.address_bus, altair.cpu.data_bus);
+			bus_switches = altair.cpu.address_bus;
 			break;
 		case DISASSEMBLE:
-			i8080_examine(&cpu, bus_switches);
-			disassemble(&cpu);
+			i8080_examine(&altair.cpu, bus_switches);
+			disassemble(&altair.cpu);
 			break;
 		case TRACE:
-			i8080_examine(&cpu, bus_switches);
-			trace(&cpu);
+			i8080_examine(&altair.cpu, bus_switches);
+			trace(&altair.cpu);
 			break;
 		case RESET:
 			load_boot_disk();
 			cpu_operating_mode = CPU_RUNNING;
+			altair_wake();
 			break;
 		case LOAD_ALTAIR_BASIC:
-			memset(memory, 0x00, 64 * 1024); // clear altair memory.
+			altair_machine_clear_memory(&altair);
 			// load Altair BASIC at 0xff00
 			if (!loadRomImage(ALTAIR_BASIC_ROM, 0x0000))
 			{
 				Log_Debug("Failed to open %s disk load ROM image\n", ALTAIR_BASIC_ROM);
 			}
+#ifdef ALTAIR_BLOCK_CACHE
+			block_cache_flush(&altair.block_cache);
+#endif
 			print_console_banner();
 
-			i8080_examine(&cpu, 0x0000); // 0x0000 loads Altair BASIC
+			i8080_examine(&altair.cpu, 0x0000); // 0x0000 loads Altair BASIC
 			cpu_operating_mode = CPU_RUNNING;
+			altair_wake();
 			break;
 		default:
 			break;
@@ -371,21 +493,27 @@ void process_control_panel_commands(void)
 {
 	if (cpu_operating_mode == CPU_STOPPED || cmd_switches == STOP_CMD)
 	{
+		// The worker may still be in a slice, the commands read and change the CPU and memory
+		altair_park();
+
 		switch (cmd_switches)
 		{
 			case RUN_CMD:
 				cpu_operating_mode = CPU_RUNNING;
+				altair_wake();
 				break;
 			case STOP_CMD:
 				cpu_operating_mode = CPU_STOPPED;
-				i8080_examine(&cpu, cpu.registers.pc);
-				bus_switches = cpu.address_bus;
+				i8080_examine(&altair.cpu, altair.cpu.registers.pc);
+				bus_switches = altair.cpu.address_bus;
 				break;
 			default:
 				deferred_command = cmd_switches;
 				altair_panel_command_handler();
 				break;
 		}
+
+		altair_unpark();
 	}
 
 	// if (cmd_switches & STOP_CMD)
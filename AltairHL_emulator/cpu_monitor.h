@@ -3,29 +3,44 @@
 
 #pragma once
 
+#include "altair_golden.h"
+#include "altair_machine.h"
 #include "altair_panel.h"
+#include "altair_snapshot.h"
 #include "dx_timer.h"
 #include "intel8080.h"
+#include "memory.h"
 #include "utils.h"
 #include "web_socket_server.h"
 #include <applibs/log.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 
+#ifdef ALTAIR_BLOCK_CACHE
+#include "block_cache.h"
+#endif
+
 #define DISK_A_RO        "Disks/azsphere_cpm63k.dsk"
 #define DISK_A           "Disks/cpm63k.dsk"
 #define DISK_B           "Disks/bdsc-v1.60.dsk"
 #define DISK_LOADER      "Disks/88dskrom.bin"
 #define ALTAIR_BASIC_ROM "Disks/altair_basic.bin"
+#define ALTAIR_SNAPSHOT  "Disks/altair.snap"
+#define ALTAIR_JOURNAL   "Disks/altair.journal"
 
 extern DX_TIMER_BINDING tmr_deferred_command;
-extern intel8080_t cpu;
-extern uint8_t memory[64 * 1024];
+extern altair_machine_t altair;
+extern altair_golden_t altair_golden;
 extern ALTAIR_COMMAND cmd_switches;
 extern CPU_OPERATING_MODE cpu_operating_mode;
 extern uint16_t bus_switches;
 
+void altair_wake(void);
+void altair_park(void);
+void altair_unpark(void);
+
 bool loadRomImage(char *romImageName, uint16_t loadAddress);
 void disassemble(intel8080_t *cpu);
 void load_boot_disk(void);
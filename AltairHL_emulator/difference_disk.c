@@ -1,53 +1,766 @@
 #include "difference_disk.h"
+#include <stdlib.h>
+#include <string.h>
 
-struct CacheEntry
+#ifdef ALTAIR_DIFFERENCE_SPILL
+#include <applibs/log.h>
+#include <errno.h>
+#include <unistd.h>
+
+#define LRU_NONE 0xFFFF
+#endif
+
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+#include <pthread.h>
+
+#define POOL_NONE			 UINT32_MAX
+#define POOL_INITIAL_BUCKETS 1024
+
+typedef struct
+{
+	uint64_t hash;
+	uint32_t references; // layer keys using the sector, 0 on the free list
+	uint32_t next;		 // next entry in the hash bucket, or on the free list
+} pool_entry_t;
+
+// Sectors of every layer in the process, each distinct sector held once. Sector data never moves once
+// written, so a layer reads the sectors it holds references to without the lock.
+static struct
+{
+	pthread_mutex_t lock;
+	uint8_t *slabs[DIFFERENCE_POOL_SLABS];
+	pool_entry_t *entries;
+	uint32_t entry_count; // entries handed out, in use or free
+	uint32_t entry_capacity;
+	uint32_t *buckets;
+	uint32_t bucket_count;
+	uint32_t free_list;
+	uint32_t sectors;
+	uint32_t references;
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .free_list = POOL_NONE};
+#endif
+
+static inline bool test_bit(const uint64_t *bits, uint32_t key)
+{
+	return (bits[key / 64] >> (key % 64)) & 1;
+}
+
+static inline void set_bit(uint64_t *bits, uint32_t key)
+{
+	bits[key / 64] |= 1ULL << (key % 64);
+}
+
+static inline void clear_bit(uint64_t *bits, uint32_t key)
+{
+	bits[key / 64] &= ~(1ULL << (key % 64));
+}
+
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+static inline uint8_t *slot_sector(const difference_disk_t *disk, uint32_t slot)
+{
+	(void)disk;
+	return pool.slabs[slot / DIFFERENCE_DISK_SLAB_SECTORS] +
+		   (slot % DIFFERENCE_DISK_SLAB_SECTORS) * SECTOR_LENGTH;
+}
+#else
+static inline uint8_t *slot_sector(const difference_disk_t *disk, uint32_t slot)
+{
+	return disk->slabs[slot / DIFFERENCE_DISK_SLAB_SECTORS] +
+		   (slot % DIFFERENCE_DISK_SLAB_SECTORS) * SECTOR_LENGTH;
+}
+#endif
+
+static bool key_for(int disk_number, int sector_number_key, uint32_t *key)
+{
+	if (disk_number < 0 || disk_number >= DIFFERENCE_DISK_DISKS || sector_number_key < 0 ||
+		sector_number_key >= DIFFERENCE_DISK_SECTORS)
+	{
+		return false;
+	}
+	*key = (uint32_t)(disk_number * DIFFERENCE_DISK_SECTORS + sector_number_key);
+	return true;
+}
+
+/// <summary>
+/// The layer has the key's sector in memory, not only in its spill file
+/// </summary>
+static inline bool in_memory(const difference_disk_t *disk, uint32_t key)
+{
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	return test_bit(disk->dirty, key) && !test_bit(disk->spilled, key);
+#else
+	return test_bit(disk->dirty, key);
+#endif
+}
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+
+static void lru_unlink(difference_disk_t *disk, uint16_t key)
+{
+	uint16_t prev = disk->lru_prev[key];
+	uint16_t next = disk->lru_next[key];
+
+	if (prev != LRU_NONE)
+	{
+		disk->lru_next[prev] = next;
+	}
+	else
+	{
+		disk->lru_head = next;
+	}
+
+	if (next != LRU_NONE)
+	{
+		disk->lru_prev[next] = prev;
+	}
+	else
+	{
+		disk->lru_tail = prev;
+	}
+}
+
+static void lru_push_front(difference_disk_t *disk, uint16_t key)
+{
+	disk->lru_prev[key] = LRU_NONE;
+	disk->lru_next[key] = disk->lru_head;
+
+	if (disk->lru_head != LRU_NONE)
+	{
+		disk->lru_prev[disk->lru_head] = key;
+	}
+	else
+	{
+		disk->lru_tail = key;
+	}
+	disk->lru_head = key;
+}
+
+static void lru_touch(difference_disk_t *disk, uint32_t key)
+{
+	if (disk->lru_head != key)
+	{
+		lru_unlink(disk, (uint16_t)key);
+		lru_push_front(disk, (uint16_t)key);
+	}
+}
+
+/// <summary>
+/// Count a key just brought into memory and make it the most recently used
+/// </summary>
+static void lru_add(difference_disk_t *disk, uint32_t key)
+{
+	if (disk->resident == 0)
+	{
+		disk->lru_head = disk->lru_tail = LRU_NONE;
+	}
+
+	clear_bit(disk->spilled, key);
+	lru_push_front(disk, (uint16_t)key);
+	disk->resident++;
+}
+
+static bool open_spill(difference_disk_t *disk)
+{
+	char file_name[] = DIFFERENCE_DISK_SPILL_TEMPLATE;
+
+	if (disk->spill_open)
+	{
+		return true;
+	}
+
+	if ((disk->spill_fd = mkstemp(file_name)) == -1)
+	{
+		Log_Debug("Failed to create a differencing disk spill file. Error: %s\n", strerror(errno));
+		return false;
+	}
+	unlink(file_name);
+
+	disk->spill_open = true;
+	return true;
+}
+
+/// <summary>
+/// Write the least recently used sector to the spill file. Its key's slot, or pool reference, is the caller's
+/// to reuse or drop.
+/// </summary>
+static bool spill_lru(difference_disk_t *disk, uint32_t *key)
+{
+	uint16_t victim = disk->lru_tail;
+
+	if (!open_spill(disk) || pwrite(disk->spill_fd, slot_sector(disk, disk->index[victim]), SECTOR_LENGTH,
+								 (off_t)victim * SECTOR_LENGTH) != SECTOR_LENGTH)
+	{
+		return false;
+	}
+
+	set_bit(disk->spilled, victim);
+	lru_unlink(disk, victim);
+	disk->resident--;
+	*key = victim;
+	return true;
+}
+
+/// <summary>
+/// Forget the spilled sectors, emptying the spill file, or closing it when the layer is freed
+/// </summary>
+static void spill_clear(difference_disk_t *disk, bool close_file)
+{
+	memset(disk->spilled, 0x00, sizeof(disk->spilled));
+	disk->resident = 0;
+
+	if (!disk->spill_open)
+	{
+		return;
+	}
+
+	if (close_file)
+	{
+		close(disk->spill_fd);
+		disk->spill_open = false;
+	}
+	else if (ftruncate(disk->spill_fd, 0) == -1)
+	{
+		Log_Debug("Failed to empty the differencing disk spill file. Error: %s\n", strerror(errno));
+	}
+}
+
+#endif // ALTAIR_DIFFERENCE_SPILL
+
+#ifndef ALTAIR_DIFFERENCE_DEDUP
+
+static bool grow_slabs(difference_disk_t *disk)
+{
+	uint8_t **slabs = realloc(disk->slabs, (disk->slab_count + 1) * sizeof(uint8_t *));
+
+	if (slabs == NULL)
+	{
+		return false;
+	}
+	disk->slabs = slabs;
+
+	if ((disk->slabs[disk->slab_count] = malloc(DIFFERENCE_DISK_SLAB_SECTORS * SECTOR_LENGTH)) == NULL)
+	{
+		return false;
+	}
+	disk->slab_count++;
+	return true;
+}
+
+static bool new_slot(difference_disk_t *disk, uint16_t *slot)
+{
+	if (disk->count == disk->slab_count * DIFFERENCE_DISK_SLAB_SECTORS && !grow_slabs(disk))
+	{
+		return false;
+	}
+	*slot = (uint16_t)disk->count++;
+	return true;
+}
+
+/// <summary>
+/// Give the key a slot of its own, spilling the least recently used sector when the layer is at its budget
+/// </summary>
+static bool take_slot(difference_disk_t *disk, uint32_t key)
+{
+	uint16_t slot;
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	uint32_t victim;
+
+	// When the spill file fails the layer goes over budget rather than lose the write
+	if (disk->resident >= DIFFERENCE_DISK_RESIDENT && spill_lru(disk, &victim))
+	{
+		slot = disk->index[victim];
+	}
+	else if (!new_slot(disk, &slot))
+	{
+		return false;
+	}
+	lru_add(disk, key);
+#else
+	if (!new_slot(disk, &slot))
+	{
+		return false;
+	}
+#endif
+
+	disk->index[key] = slot;
+	return true;
+}
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+/// <summary>
+/// Move a sector read back from the spill file into spill_buffer into a slot
+/// </summary>
+static bool unspill(difference_disk_t *disk, uint32_t key)
+{
+	if (!take_slot(disk, key))
+	{
+		return false;
+	}
+	memcpy(slot_sector(disk, disk->index[key]), disk->spill_buffer, SECTOR_LENGTH);
+	return true;
+}
+#endif
+
+#else
+
+/// <summary>
+/// FNV-1a of the sector, 64 bits so different sectors almost never share a hash
+/// </summary>
+static uint64_t sector_hash(const uint8_t *sector)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < SECTOR_LENGTH; i++)
+	{
+		hash = (hash ^ sector[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool pool_grow_buckets(void)
+{
+	uint32_t count	  = pool.bucket_count == 0 ? POOL_INITIAL_BUCKETS : pool.bucket_count * 2;
+	uint32_t *buckets = malloc(count * sizeof(uint32_t));
+
+	if (buckets == NULL)
+	{
+		return false;
+	}
+	memset(buckets, 0xFF, count * sizeof(uint32_t)); // every bucket POOL_NONE
+
+	free(pool.buckets);
+	pool.buckets	  = buckets;
+	pool.bucket_count = count;
+
+	for (uint32_t entry = 0; entry < pool.entry_count; entry++)
+	{
+		if (pool.entries[entry].references != 0)
+		{
+			uint32_t *bucket = &pool.buckets[pool.entries[entry].hash & (count - 1)];
+
+			pool.entries[entry].next = *bucket;
+			*bucket					 = entry;
+		}
+	}
+	return true;
+}
+
+static uint32_t pool_new_entry(void)
+{
+	uint32_t entry = pool.free_list;
+
+	if (entry != POOL_NONE)
+	{
+		pool.free_list = pool.entries[entry].next;
+		return entry;
+	}
+
+	if (pool.entry_count == DIFFERENCE_POOL_SLABS * DIFFERENCE_DISK_SLAB_SECTORS)
+	{
+		return POOL_NONE;
+	}
+
+	if (pool.entry_count == pool.entry_capacity)
+	{
+		uint32_t capacity = pool.entry_capacity == 0 ? DIFFERENCE_DISK_SLAB_SECTORS : pool.entry_capacity * 2;
+		pool_entry_t *entries = realloc(pool.entries, capacity * sizeof(pool_entry_t));
+
+		if (entries == NULL)
+		{
+			return POOL_NONE;
+		}
+		pool.entries		= entries;
+		pool.entry_capacity = capacity;
+	}
+
+	uint8_t **slab = &pool.slabs[pool.entry_count / DIFFERENCE_DISK_SLAB_SECTORS];
+
+	if (*slab == NULL && (*slab = malloc(DIFFERENCE_DISK_SLAB_SECTORS * SECTOR_LENGTH)) == NULL)
+	{
+		return POOL_NONE;
+	}
+	return pool.entry_count++;
+}
+
+/// <summary>
+/// Take a reference to the pool's copy of the sector, adding it when no layer holds one yet. Caller holds the
+/// lock.
+/// </summary>
+static uint32_t pool_reference(const uint8_t *sector, uint64_t hash)
+{
+	uint32_t *bucket;
+	uint32_t entry;
+
+	if (pool.bucket_count != 0)
+	{
+		for (entry = pool.buckets[hash & (pool.bucket_count - 1)]; entry != POOL_NONE;
+			 entry = pool.entries[entry].next)
+		{
+			if (pool.entries[entry].hash == hash &&
+				memcmp(slot_sector(NULL, entry), sector, SECTOR_LENGTH) == 0)
+			{
+				pool.entries[entry].references++;
+				pool.references++;
+				return entry;
+			}
+		}
+	}
+
+	if ((pool.sectors == pool.bucket_count && !pool_grow_buckets()) ||
+		(entry = pool_new_entry()) == POOL_NONE)
+	{
+		return POOL_NONE;
+	}
+
+	memcpy(slot_sector(NULL, entry), sector, SECTOR_LENGTH);
+	bucket				= &pool.buckets[hash & (pool.bucket_count - 1)];
+	pool.entries[entry] = (pool_entry_t){.hash = hash, .references = 1, .next = *bucket};
+	*bucket				= entry;
+
+	pool.sectors++;
+	pool.references++;
+	return entry;
+}
+
+/// <summary>
+/// Drop a reference, the last one puts the entry on the free list. Caller holds the lock.
+/// </summary>
+static void pool_release(uint32_t entry)
+{
+	uint32_t *link;
+
+	pool.references--;
+	if (--pool.entries[entry].references != 0)
+	{
+		return;
+	}
+
+	link = &pool.buckets[pool.entries[entry].hash & (pool.bucket_count - 1)];
+	while (*link != entry)
+	{
+		link = &pool.entries[*link].next;
+	}
+	*link = pool.entries[entry].next;
+
+	pool.entries[entry].next = pool.free_list;
+	pool.free_list			 = entry;
+	pool.sectors--;
+}
+
+/// <summary>
+/// Point the key at the pool's copy of the sector. With ALTAIR_DIFFERENCE_SPILL a key coming into memory when
+/// the layer is at its budget first sends the least recently used sector to the spill file and drops its
+/// reference.
+/// </summary>
+static bool store(difference_disk_t *disk, uint32_t key, const uint8_t *sector)
+{
+	bool resident	  = in_memory(disk, key);
+	uint32_t released = POOL_NONE;
+	uint64_t hash	  = sector_hash(sector);
+	uint32_t entry;
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	uint32_t victim;
+
+	// Written without the lock, the victim's sector stays put while the layer still holds its reference
+	if (!resident && disk->resident >= DIFFERENCE_DISK_RESIDENT && spill_lru(disk, &victim))
+	{
+		released = disk->index[victim];
+	}
+#endif
+
+	pthread_mutex_lock(&pool.lock);
+	if ((entry = pool_reference(sector, hash)) != POOL_NONE && resident)
+	{
+		pool_release(disk->index[key]);
+	}
+	if (released != POOL_NONE)
+	{
+		pool_release(released);
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	if (entry == POOL_NONE)
+	{
+		return false;
+	}
+
+	disk->index[key] = entry;
+	set_bit(disk->dirty, key);
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	if (resident)
+	{
+		lru_touch(disk, key);
+	}
+	else
+	{
+		lru_add(disk, key);
+	}
+#endif
+	return true;
+}
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+/// <summary>
+/// Take a pool reference to a sector read back from the spill file into spill_buffer
+/// </summary>
+static bool unspill(difference_disk_t *disk, uint32_t key)
+{
+	return store(disk, key, disk->spill_buffer);
+}
+#endif
+
+#endif // ALTAIR_DIFFERENCE_DEDUP
+
+/// <summary>
+/// Where a read finds the layer's copy of a sector, in memory or read back from the spill file into the
+/// buffer
+/// </summary>
+static uint8_t *layer_sector(const difference_disk_t *layer, uint32_t key, uint8_t *buffer)
+{
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	if (test_bit(layer->spilled, key))
+	{
+		if (pread(layer->spill_fd, buffer, SECTOR_LENGTH, (off_t)key * SECTOR_LENGTH) != SECTOR_LENGTH)
+		{
+			Log_Debug("Differencing disk spill file read failed. Error: %s\n", strerror(errno));
+			return NULL;
+		}
+		return buffer;
+	}
+#else
+	(void)buffer;
+#endif
+	return slot_sector(layer, layer->index[key]);
+}
+
+uint8_t *find_in_cache(difference_disk_t *disk, int disk_number, int sector_number_key)
+{
+	uint32_t key;
+
+	if (!key_for(disk_number, sector_number_key, &key))
+	{
+		return NULL;
+	}
+
+	if (test_bit(disk->dirty, key))
+	{
+#ifdef ALTAIR_DIFFERENCE_SPILL
+		if (test_bit(disk->spilled, key))
+		{
+			// Bring it back into memory, it is in use again. Should that fail the copy just read still serves
+			if (layer_sector(disk, key, disk->spill_buffer) == NULL)
+			{
+				return NULL;
+			}
+			if (!unspill(disk, key))
+			{
+				return disk->spill_buffer;
+			}
+		}
+		else
+		{
+			lru_touch(disk, key);
+		}
+#endif
+		return slot_sector(disk, disk->index[key]);
+	}
+
+	// Sectors not written this session fall through to the shared layer, writes always land in this one
+	if (disk->base != NULL && test_bit(disk->base->dirty, key))
+	{
+#ifdef ALTAIR_DIFFERENCE_SPILL
+		return layer_sector(disk->base, key, disk->spill_buffer);
+#else
+		return layer_sector(disk->base, key, NULL);
+#endif
+	}
+	return NULL;
+}
+
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+
+void add_to_cache(difference_disk_t *disk, int disk_number, int sector_number_key, uint8_t *sector)
+{
+	uint32_t key;
+
+	if (!key_for(disk_number, sector_number_key, &key))
+	{
+		return;
+	}
+
+	// Writing back what the layer already has, common for directory sectors, needs no lock
+	if (in_memory(disk, key) && memcmp(slot_sector(disk, disk->index[key]), sector, SECTOR_LENGTH) == 0)
+	{
+#ifdef ALTAIR_DIFFERENCE_SPILL
+		lru_touch(disk, key);
+#endif
+		return;
+	}
+	store(disk, key, sector);
+}
+
+/// <summary>
+/// Forget every sector, dropping the layer's references so sectors no other layer uses go back to the pool
+/// </summary>
+void delete_all(difference_disk_t *disk)
+{
+	pthread_mutex_lock(&pool.lock);
+	for (int word = 0; word < DIFFERENCE_DISK_WORDS; word++)
+	{
+		uint64_t bits = disk->dirty[word];
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+		bits &= ~disk->spilled[word]; // spilled keys gave their reference up
+#endif
+		for (; bits != 0; bits &= bits - 1)
+		{
+			pool_release(disk->index[word * 64 + __builtin_ctzll(bits)]);
+		}
+	}
+	pthread_mutex_unlock(&pool.lock);
+
+	memset(disk->dirty, 0x00, sizeof(disk->dirty));
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	spill_clear(disk, false);
+#endif
+}
+
+void difference_disk_free(difference_disk_t *disk)
+{
+	delete_all(disk);
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	spill_clear(disk, true);
+#endif
+}
+
+/// <summary>
+/// Distinct sectors in the shared pool and the layer keys referring to them, references / sectors is the
+/// saving
+/// </summary>
+void difference_pool_stats(unsigned int *sectors, unsigned int *references)
 {
-    int sector_number_key;
-    uint8_t sector[SECTOR_LENGTH];
-    UT_hash_handle hh;
-};
+	pthread_mutex_lock(&pool.lock);
+	*sectors	= pool.sectors;
+	*references = pool.references;
+	pthread_mutex_unlock(&pool.lock);
+}
 
-static struct CacheEntry *cache = NULL;
+#else
 
-uint8_t *find_in_cache(int disk_number, int sector_number_key)
+void add_to_cache(difference_disk_t *disk, int disk_number, int sector_number_key, uint8_t *sector)
 {
-    struct CacheEntry *entry;
+	uint32_t key;
 
-    sector_number_key = sector_number_key + (disk_number * 2000);
+	if (!key_for(disk_number, sector_number_key, &key))
+	{
+		return;
+	}
 
-    HASH_FIND_INT(cache, &sector_number_key, entry);
-    return entry ?  entry->sector : NULL;
+	if (!in_memory(disk, key))
+	{
+		if (!take_slot(disk, key))
+		{
+			return;
+		}
+		set_bit(disk->dirty, key);
+	}
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	else
+	{
+		lru_touch(disk, key);
+	}
+#endif
+
+	memcpy(slot_sector(disk, disk->index[key]), sector, SECTOR_LENGTH);
 }
 
-void add_to_cache(int disk_number, int sector_number_key, uint8_t *sector)
+/// <summary>
+/// Forget every sector by clearing the bitmap, keeping the slabs for the next session
+/// </summary>
+void delete_all(difference_disk_t *disk)
 {
-    struct CacheEntry *entry;
+	memset(disk->dirty, 0x00, sizeof(disk->dirty));
+	disk->count = 0;
 
-    // if (HASH_COUNT(cache) < MAX_CACHE_ITEMS)
-    // {
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	spill_clear(disk, false);
+#endif
+}
 
-        sector_number_key = sector_number_key + (disk_number * 2000);
+/// <summary>
+/// Give the slabs and spill file back, leaving an empty disk
+/// </summary>
+void difference_disk_free(difference_disk_t *disk)
+{
+	for (uint32_t slab = 0; slab < disk->slab_count; slab++)
+	{
+		free(disk->slabs[slab]);
+	}
+	free(disk->slabs);
 
-        HASH_FIND_INT(cache, &sector_number_key, entry); /* id already in the hash? */
-        if (entry == NULL)
-        {
-            entry = malloc(sizeof(struct CacheEntry));
-            entry->sector_number_key = sector_number_key;
+	memset(disk->dirty, 0x00, sizeof(disk->dirty));
+	disk->count		 = 0;
+	disk->slabs		 = NULL;
+	disk->slab_count = 0;
+
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	spill_clear(disk, true);
+#endif
+}
 
-            HASH_ADD_INT(cache, sector_number_key, entry);
-        }
+#endif // ALTAIR_DIFFERENCE_DEDUP
 
-        memcpy(entry->sector, sector, SECTOR_LENGTH);
-    // }
+unsigned int difference_disk_count(difference_disk_t *disk)
+{
+	unsigned int count = 0;
+
+	for (int word = 0; word < DIFFERENCE_DISK_WORDS; word++)
+	{
+		// This layer's sectors and the base sectors it has not replaced
+		uint64_t bits = disk->dirty[word] | (disk->base != NULL ? disk->base->dirty[word] : 0);
+
+		count += (unsigned int)__builtin_popcountll(bits);
+	}
+	return count;
+}
+
+static void visit_layer(
+	const difference_disk_t *layer, const uint64_t *shadow, difference_disk_visit visit, void *context)
+{
+	uint8_t buffer[SECTOR_LENGTH];
+
+	for (int word = 0; word < DIFFERENCE_DISK_WORDS; word++)
+	{
+		uint64_t bits = layer->dirty[word] & ~(shadow != NULL ? shadow[word] : 0);
+
+		while (bits != 0)
+		{
+			uint32_t key	= (uint32_t)word * 64 + (uint32_t)__builtin_ctzll(bits);
+			uint8_t *sector = layer_sector(layer, key, buffer);
+
+			bits &= bits - 1;
+			if (sector != NULL)
+			{
+				visit(key / DIFFERENCE_DISK_SECTORS, key % DIFFERENCE_DISK_SECTORS, sector, context);
+			}
+		}
+	}
 }
 
-void delete_all()
+/// <summary>
+/// Visit every sector a read would find, this layer's and any of the base layer's it does not replace
+/// </summary>
+void difference_disk_for_each(difference_disk_t *disk, difference_disk_visit visit, void *context)
 {
-    struct CacheEntry *entry, *tmp_entry;
+	visit_layer(disk, NULL, visit, context);
 
-    HASH_ITER(hh, cache, entry, tmp_entry)
-    {
-        HASH_DEL(cache, entry); /* delete; users advances to next */
-        free(entry);            /* optional- if you want to free  */
-    }
-}
\ No newline at end of file
+	if (disk->base != NULL)
+	{
+		visit_layer(disk->base, disk->dirty, visit, context);
+	}
+}
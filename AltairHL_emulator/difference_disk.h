@@ -1,12 +1,71 @@
 #pragma once
 
-#include "uthash.h"
+#include <stdbool.h>
+#include <stdint.h>
 
-// CacheEntry is 176 bytes
-// 800 items is stable
-#define MAX_CACHE_ITEMS 800
 #define SECTOR_LENGTH 137
+// 77 tracks of 32 sectors on an 8" disk. Keys are disk number * DIFFERENCE_DISK_SECTORS + sector number
+#define DIFFERENCE_DISK_SECTORS (77 * 32)
+#define DIFFERENCE_DISK_DISKS	2
+#define DIFFERENCE_DISK_KEYS	(DIFFERENCE_DISK_DISKS * DIFFERENCE_DISK_SECTORS)
+#define DIFFERENCE_DISK_WORDS	((DIFFERENCE_DISK_KEYS + 63) / 64)
+// Sectors live in slabs of this many slots, a little under 9K each
+#define DIFFERENCE_DISK_SLAB_SECTORS 64
+// Sectors a layer keeps in memory before the least recently used go to its spill file,
+// ALTAIR_DIFFERENCE_SPILL only. With ALTAIR_DIFFERENCE_DEDUP it caps the layer's pool references instead.
+#define DIFFERENCE_DISK_RESIDENT 800
+// Spill files are unlinked once open so they go away with the process
+#define DIFFERENCE_DISK_SPILL_TEMPLATE "/tmp/altair_spill_XXXXXX"
 
-uint8_t *find_in_cache(int disk_number, int sector_number_key);
-void add_to_cache(int disk_number, int sector_number_key, uint8_t *sector);
-void delete_all();
\ No newline at end of file
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+// Slabs the shared pool can grow to, a million sectors
+#define DIFFERENCE_POOL_SLABS 16384
+typedef uint32_t difference_disk_slot_t; // entry in the shared pool
+#else
+typedef uint16_t difference_disk_slot_t; // slot in the layer's slabs
+#endif
+
+// Sectors written by one machine, keyed by disk and sector number. A key's bit says whether this layer has
+// the sector and its index entry which slab slot holds it, index entries of clear bits are never read. Slabs
+// outlive delete_all so the next session reuses them without going back to the allocator. With
+// ALTAIR_DIFFERENCE_DEDUP the layer has no slabs, index entries are references to sectors in a pool shared by
+// every layer in the process.
+typedef struct difference_disk_t
+{
+	uint64_t dirty[DIFFERENCE_DISK_WORDS];
+	difference_disk_slot_t index[DIFFERENCE_DISK_KEYS];
+#ifndef ALTAIR_DIFFERENCE_DEDUP
+	uint32_t count; // slots handed out, also the next free slot
+	uint8_t **slabs;
+	uint32_t slab_count;
+#endif
+#ifdef ALTAIR_DIFFERENCE_SPILL
+	// Keys with the spilled bit set are in the spill file at key * SECTOR_LENGTH, not in memory. Keys in
+	// memory are on a list in use order, the tail goes to the file when the layer is full. A spilled key
+	// holds no slot or pool reference, reading it brings it back.
+	uint64_t spilled[DIFFERENCE_DISK_WORDS];
+	uint16_t lru_prev[DIFFERENCE_DISK_KEYS];
+	uint16_t lru_next[DIFFERENCE_DISK_KEYS];
+	uint16_t lru_head; // most recently used key
+	uint16_t lru_tail;
+	uint16_t resident; // keys in memory
+	bool spill_open;
+	int spill_fd;
+	uint8_t spill_buffer[SECTOR_LENGTH]; // sector read back from a spill file
+#endif
+	const struct difference_disk_t *base; // read only layer under this one, e.g. the golden image's sectors
+} difference_disk_t;
+
+uint8_t *find_in_cache(difference_disk_t *disk, int disk_number, int sector_number_key);
+void add_to_cache(difference_disk_t *disk, int disk_number, int sector_number_key, uint8_t *sector);
+void delete_all(difference_disk_t *disk);
+void difference_disk_free(difference_disk_t *disk);
+
+typedef void (*difference_disk_visit)(int disk_number, int sector_number, uint8_t *sector, void *context);
+
+unsigned int difference_disk_count(difference_disk_t *disk);
+void difference_disk_for_each(difference_disk_t *disk, difference_disk_visit visit, void *context);
+
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+void difference_pool_stats(unsigned int *sectors, unsigned int *references);
+#endif
@@ -2,6 +2,7 @@
    Licensed under the MIT License. */
 
 #include "io_ports.h"
+#include "cpu_monitor.h"
 
 static int copy_web(char *url);
 
@@ -38,6 +39,7 @@ static volatile bool delay_milliseconds_enabled = false;
 static volatile bool delay_seconds_enabled      = false;
 static volatile bool publish_json_pending       = false;
 static volatile bool publish_weather_pending    = false;
+static volatile bool delay_interrupt_enabled    = false; // raise RST 7 when a port 29/30 delay expires
 
 // set tick_count to 1 as the tick count timer doesn't kick in until 1 second after startup
 static uint32_t tick_count = 1;
@@ -133,6 +135,37 @@ static void format_string(const void *value)
 	ru.len = (size_t)snprintf(ru.buffer, sizeof(ru.buffer), "%s", (char *)value);
 }
 
+#ifdef ALTAIR_CPU_STATS
+static void cpu_stats_format(intel8080_t *cpu, uint8_t stat)
+{
+	double instructions_per_second = 0;
+	double cycles_per_second       = 0;
+
+	i8080_stats_rate(cpu, &instructions_per_second, &cycles_per_second);
+
+	switch (stat)
+	{
+		case 0:
+			ru.len = (size_t)snprintf(ru.buffer, sizeof(ru.buffer), "%" PRIu64, i8080_stats_instructions(cpu));
+			break;
+		case 1:
+			ru.len = (size_t)snprintf(ru.buffer, sizeof(ru.buffer), "%" PRIu64, cpu->cycles);
+			break;
+		case 2:
+			ru.len = (size_t)snprintf(ru.buffer, sizeof(ru.buffer), "%.0f", instructions_per_second);
+			break;
+		case 3:
+			ru.len = (size_t)snprintf(ru.buffer, sizeof(ru.buffer), "%.2f", instructions_per_second / 1e6);
+			break;
+		case 4:
+			ru.len = (size_t)snprintf(ru.buffer, sizeof(ru.buffer), "%.2f", cycles_per_second / 1e6);
+			break;
+		default:
+			break;
+	}
+}
+#endif // ALTAIR_CPU_STATS
+
 /// <summary>
 /// Callback handler for Asynchronous Inter-Core Messaging Pattern
 /// </summary>
@@ -185,15 +218,29 @@ DX_TIMER_HANDLER(read_accelerometer_handler)
 }
 DX_TIMER_HANDLER_END
 
+/// <summary>
+/// Let a program sleeping on HLT know its delay has expired
+/// </summary>
+static void delay_expired_interrupt(void)
+{
+	if (delay_interrupt_enabled)
+	{
+		i8080_interrupt(&altair.cpu, 7);
+		altair_wake();
+	}
+}
+
 DX_TIMER_HANDLER(timer_seconds_expired_handler)
 {
 	delay_seconds_enabled = false;
+	delay_expired_interrupt();
 }
 DX_TIMER_HANDLER_END
 
 DX_TIMER_HANDLER(timer_millisecond_expired_handler)
 {
 	delay_milliseconds_enabled = false;
+	delay_expired_interrupt();
 }
 DX_TIMER_HANDLER_END
 
@@ -272,7 +319,7 @@ DX_ASYNC_HANDLER_END
 /// </summary>
 /// <param name="port"></param>
 /// <param name="data"></param>
-void io_port_out(uint8_t port, uint8_t data)
+void io_port_out(void *context, uint8_t port, uint8_t data)
 {
 	memset(&ru, 0x00, sizeof(REQUEST_UNIT_T));
 	static int timer_delay;
@@ -287,6 +334,9 @@ void io_port_out(uint8_t port, uint8_t data)
 
 	switch (port)
 	{
+		case 28: // Delay expired interrupt, 0 = poll ports 29/30, 1 = RST 7 when a delay expires
+			delay_interrupt_enabled = data != 0;
+			break;
 		case 29:
 			delay_milliseconds_enabled = false;
 			if (data > 0)
@@ -417,6 +467,15 @@ void io_port_out(uint8_t port, uint8_t data)
 		case 44: // Generate random number to seed mbasic randomize command
 			ru.len = (size_t)snprintf(ru.buffer, sizeof(ru.buffer), "%d", ((rand() % 64000) - 32000));
 			break;
+#ifdef ALTAIR_CPU_STATS
+		case 45: // CPU statistics, 0 = instructions, 1 = T-states, 2 = instructions/sec, 3 = MIPS, 4 = clock MHz
+			cpu_stats_format(&((altair_machine_t *)context)->cpu, data);
+			break;
+		case 46: // Number of times the op code in data has been run
+			ru.len = (size_t)snprintf(
+				ru.buffer, sizeof(ru.buffer), "%" PRIu64, ((altair_machine_t *)context)->cpu.stats.op_counts[data]);
+			break;
+#endif // ALTAIR_CPU_STATS
 #ifdef AZURE_SPHERE
 		case 60: // Red LEB
 			dx_gpioStateSet(&gpioRed, (bool)data);
@@ -640,7 +699,7 @@ void io_port_out(uint8_t port, uint8_t data)
 /// </summary>
 /// <param name="port"></param>
 /// <returns></returns>
-uint8_t io_port_in(uint8_t port)
+uint8_t io_port_in(void *context, uint8_t port)
 {
 	uint8_t retVal = 0;
 
@@ -661,6 +720,11 @@ uint8_t io_port_in(uint8_t port)
 		case 33: // has copyx file need copied and loaded
 			retVal = copy_x.end_of_file;
 			break;
+#ifdef ALTAIR_CPU_STATS
+		case 45: // CPU statistics are available
+			retVal = 1;
+			break;
+#endif // ALTAIR_CPU_STATS
 		case 200: // READ STRING
 			if (ru.count < ru.len && ru.count < sizeof(ru.buffer))
 			{
@@ -8,6 +8,7 @@
 #include "environment_types.h"
 #include "iotc_manager.h"
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -71,5 +72,5 @@ enum PANEL_MODE_T
 
 extern enum PANEL_MODE_T panel_mode;
 
-uint8_t io_port_in(uint8_t port);
-void io_port_out(uint8_t port, uint8_t data);
+uint8_t io_port_in(void *context, uint8_t port);
+void io_port_out(void *context, uint8_t port, uint8_t data);
@@ -50,13 +50,53 @@ static DX_TIMER_HANDLER(heart_beat_handler)
 		dx_deviceTwinReportValue(
 			&dt_heartbeatUtc, dx_getCurrentUtc(msgBuffer, sizeof(msgBuffer))); // DX_TYPE_STRING
 		dx_deviceTwinReportValue(&dt_filesystem_reads, dt_filesystem_reads.propertyValue);
+		dx_deviceTwinReportValue(&dt_mapped_reads, dt_mapped_reads.propertyValue);
+		dx_deviceTwinReportValue(&dt_track_cache_hits, dt_track_cache_hits.propertyValue);
+		dx_deviceTwinReportValue(&dt_track_cache_misses, dt_track_cache_misses.propertyValue);
 		dx_deviceTwinReportValue(&dt_difference_disk_reads, dt_difference_disk_reads.propertyValue);
 		dx_deviceTwinReportValue(&dt_difference_disk_writes, dt_difference_disk_writes.propertyValue);
 		dx_deviceTwinReportValue(&dt_new_sessions, dt_new_sessions.propertyValue);
+#ifdef ALTAIR_CPU_STATS
+		double instructions_per_second, cycles_per_second;
+
+		if (i8080_stats_rate(&altair.cpu, &instructions_per_second, &cycles_per_second))
+		{
+			float mips      = (float)(instructions_per_second / 1e6);
+			float clock_mhz = (float)(cycles_per_second / 1e6);
+
+			dx_deviceTwinReportValue(&dt_cpu_mips, &mips);
+			dx_deviceTwinReportValue(&dt_cpu_clock_mhz, &clock_mhz);
+		}
+#endif // ALTAIR_CPU_STATS
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+		// References over sectors is how many times over the pool saves differencing disk memory
+		unsigned int pool_sectors, pool_references;
+
+		difference_pool_stats(&pool_sectors, &pool_references);
+		int sectors	   = (int)pool_sectors;
+		int references = (int)pool_references;
+
+		dx_deviceTwinReportValue(&dt_difference_pool_sectors, &sectors);
+		dx_deviceTwinReportValue(&dt_difference_pool_references, &references);
+#endif // ALTAIR_DIFFERENCE_DEDUP
 	}
 }
 DX_TIMER_HANDLER_END
 
+#ifdef ALTAIR_CPU_STATS
+/// <summary>
+/// Sample the CPU instruction and T-state counters once a second for the instructions per second window
+/// </summary>
+static DX_TIMER_HANDLER(cpu_stats_sample_handler)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	i8080_stats_sample(&altair.cpu, (uint64_t)now.tv_sec * 1000 * ONE_MS + (uint64_t)now.tv_nsec);
+}
+DX_TIMER_HANDLER_END
+#endif // ALTAIR_CPU_STATS
+
 /// <summary>
 /// Handler called to process inbound message
 /// </summary>
@@ -99,12 +139,13 @@ DX_ASYNC_HANDLER(async_terminal_handler, handle)
 			cpu_operating_mode = cpu_operating_mode == CPU_RUNNING ? CPU_STOPPED : CPU_RUNNING;
 			if (cpu_operating_mode == CPU_STOPPED)
 			{
-				bus_switches = cpu.address_bus;
+				bus_switches = altair.cpu.address_bus;
 				publish_message("\r\nCPU MONITOR> ", 15);
 			}
 			else
 			{
 				send_terminal_character(0x0d, false);
+				altair_wake();
 			}
 		}
 		else // pass through the ctrl character
@@ -164,6 +205,7 @@ DX_ASYNC_HANDLER(async_terminal_handler, handle)
 				terminalOutputMessageLen = (int)application_message_size - 1;
 
 				haveTerminalInputMessage = haveTerminalOutputMessage = true;
+				terminal_input_ready();
 
 				spin_wait(&haveTerminalInputMessage);
 			}
@@ -185,6 +227,7 @@ static void send_terminal_character(char character, bool wait)
 {
 	int retry              = 0;
 	terminalInputCharacter = character;
+	terminal_input_ready();
 
 	if (!wait)
 	{
@@ -221,6 +264,7 @@ static void client_connected_cb(void)
 {
 	print_console_banner();
 	cpu_operating_mode = CPU_RUNNING;
+	altair_wake();
 }
 
 /// <summary>
@@ -244,6 +288,7 @@ static bool load_application(const char *fileName)
 	{
 		haveTerminalInputMessage = false;
 		haveAppLoad              = true;
+		terminal_input_ready();
 
 		retry = 0;
 		while (haveAppLoad && retry++ < 20)
@@ -257,7 +302,7 @@ static bool load_application(const char *fileName)
 	return false;
 }
 
-static char terminal_read(void)
+static uint8_t terminal_read(void *context)
 {
 	uint8_t rxBuffer[2] = {0};
 	char retVal;
@@ -306,7 +351,7 @@ static char terminal_read(void)
 	return 0;
 }
 
-static void terminal_write(uint8_t c)
+static void terminal_write(void *context, uint8_t c)
 {
 	c &= 0x7F; // take first 7 bits (127 ascii chars) only and discard 8th bit.
 
@@ -325,7 +370,7 @@ static void terminal_write(uint8_t c)
 	}
 }
 
-static inline uint8_t sense(void)
+static uint8_t sense(void *context)
 {
 	return (uint8_t)(bus_switches >> 8);
 }
@@ -334,17 +379,17 @@ void print_console_banner(void)
 {
 	for (int x = 0; x < strlen(AltairMsg); x++)
 	{
-		terminal_write(AltairMsg[x]);
+		terminal_write(&altair, AltairMsg[x]);
 	}
 
 	for (int x = 0; x < strlen(ALTAIR_EMULATOR_VERSION); x++)
 	{
-		terminal_write(ALTAIR_EMULATOR_VERSION[x]);
+		terminal_write(&altair, ALTAIR_EMULATOR_VERSION[x]);
 	}
 
 	for (int x = 0; x < strlen("\r\n"); x++)
 	{
-		terminal_write("\r\n"[x]);
+		terminal_write(&altair, "\r\n"[x]);
 	}
 }
 
@@ -361,9 +406,9 @@ static void *panel_refresh_thread(void *arg)
 	{
 		if (panel_mode == PANEL_BUS_MODE)
 		{
-			uint8_t status = cpu.cpuStatus;
-			uint8_t data   = cpu.data_bus;
-			uint16_t bus   = cpu.address_bus;
+			uint8_t status = altair.cpu.cpuStatus;
+			uint8_t data   = altair.cpu.data_bus;
+			uint16_t bus   = altair.cpu.address_bus;
 
 			if (status != last_status || data != last_data || bus != last_bus)
 			{
@@ -390,85 +435,241 @@ static void *panel_refresh_thread(void *arg)
 }
 
 /// <summary>
-/// Main Altair CPU execution thread
+/// Queue the Altair to run if it is parked waiting for console input or for the CPU to be started
 /// </summary>
-static void *altair_thread(void *arg)
+void altair_wake(void)
 {
-	Log_Debug("Altair Thread starting...\n");
-	print_console_banner();
+	if (altair_scheduled)
+	{
+		altair_scheduler_wake(altair_scheduled);
+	}
+}
+
+/// <summary>
+/// Wait for the Altair to come off its worker and keep it off until altair_unpark, so a thread other than the
+/// worker can replace its state
+/// </summary>
+void altair_park(void)
+{
+	if (altair_scheduled)
+	{
+		altair_scheduler_park(altair_scheduled);
+	}
+}
+
+void altair_unpark(void)
+{
+	if (altair_scheduled)
+	{
+		altair_scheduler_unpark(altair_scheduled);
+	}
+}
+
+/// <summary>
+/// Wake the CPU thread for new terminal input and interrupt the 8080 if it enabled 2SIO receive interrupts
+/// </summary>
+static void terminal_input_ready(void)
+{
+	if (altair.cpu.serial_rx_interrupt)
+	{
+		i8080_interrupt(&altair.cpu, 7);
+	}
+	altair_wake();
+}
+
+static bool altair_ready(void *context)
+{
+	return cpu_operating_mode == CPU_RUNNING;
+}
+
+static uint32_t altair_clock_hz(void *context)
+{
+	return (uint32_t)altair_config.clock_speed_mhz * 1000000;
+}
+
+#if defined(ALTAIR_DIFFERENCE_JOURNAL) && defined(ALTAIR_CLOUD)
+/// <summary>
+/// Put the writes journaled before a restart back over the golden image and journal the session's writes from here
+/// </summary>
+static void journal_start(void)
+{
+	if (disk_journal_open(&disk_journal, ALTAIR_JOURNAL, altair_config.journal_sync_ms, &altair.disk_drive.difference_disk))
+	{
+		altair.disk_drive.journal = &disk_journal;
+
+		// CP/M logged drive A in before the golden image was taken, so its allocation and checksum vectors describe
+		// the base disk. The first session warm boots through 0x0000 instead, the CCP resets the disk system and
+		// logs the replayed files in rather than allocating over them or setting A: read only. The golden image
+		// is left as it is, later sessions start from it with an empty differencing disk.
+		if (difference_disk_count(&altair.disk_drive.difference_disk) != 0)
+		{
+			i8080_examine(&altair.cpu, 0x0000);
+		}
+	}
+	else
+	{
+		Log_Debug("Failed to open the disk journal %s, disk writes will not survive a restart\n", ALTAIR_JOURNAL);
+	}
+}
+#endif
+
+/// <summary>
+/// Called on the worker thread after each turn the Altair gets, running or stopped
+/// </summary>
+static void altair_slice_done(void *context)
+{
+	if (send_partial_msg)
+	{
+		send_partial_message();
+		send_partial_msg = false;
+	}
+
+#ifdef ALTAIR_CLOUD
+	// The headless boot's first wait for console input is the ready state every session is cloned from. No client
+	// can connect before it is captured, so nothing typed or written by a session is in the image.
+	if (!atomic_load(&altair_golden.ready) && cpu_operating_mode == CPU_RUNNING && altair.cpu.idle)
+	{
+#ifdef ALTAIR_DIFFERENCE_JOURNAL
+		if (altair_golden_capture(&altair_golden, &altair))
+		{
+			journal_start();
+		}
+#else
+		altair_golden_capture(&altair_golden, &altair);
+#endif
+		cpu_operating_mode = CPU_STOPPED; // until the first client connects
+	}
+#endif // ALTAIR_CLOUD
+}
 
-	memset(memory, 0x00, 64 * 1024); // clear Altair memory.
+/// <summary>
+/// Boot the Altair and hand it to the scheduler's worker threads
+/// </summary>
+static void altair_start(void)
+{
+	altair_schedule_hooks_t hooks = {.ready = altair_ready, .clock_hz = altair_clock_hz, .slice_done = altair_slice_done};
 
-	disk_controller_t disk_controller;
-	disk_controller.disk_function = disk_function;
-	disk_controller.disk_select   = disk_select;
-	disk_controller.disk_status   = disk_status;
-	disk_controller.read          = disk_read;
-	disk_controller.write         = disk_write;
-	disk_controller.sector        = sector;
+	Log_Debug("Altair starting...\n");
+	print_console_banner();
+
+	altair_machine_init(&altair, &altair, terminal_read, terminal_write, sense, io_port_in, io_port_out);
 
 #ifdef ALTAIR_CLOUD
-	if ((disk_drive.disk1.fp = open(DISK_A, O_RDONLY)) == -1)
+	if ((altair.disk_drive.disk1.fp = open(DISK_A, O_RDONLY)) == -1)
 	{
 		Log_Debug("Failed to open %s disk image\n", DISK_A);
 		exit(-1);
 	}
 #else
-	if ((disk_drive.disk1.fp = open(DISK_A, O_RDWR)) == -1)
+	if ((altair.disk_drive.disk1.fp = open(DISK_A, O_RDWR)) == -1)
 	{
 		Log_Debug("Failed to open %s disk image\n", DISK_A);
 		exit(-1);
 	}
 #endif // ALTAIR_CLOUD
 
-	disk_drive.disk1.diskPointer = 0;
-	disk_drive.disk1.sector      = 0;
-	disk_drive.disk1.track       = 0;
+	altair.disk_drive.disk1.diskPointer = 0;
+	altair.disk_drive.disk1.sector      = 0;
+	altair.disk_drive.disk1.track       = 0;
 
 #ifdef ALTAIR_CLOUD
-	if ((disk_drive.disk2.fp = open(DISK_B, O_RDONLY)) == -1)
+	if ((altair.disk_drive.disk2.fp = open(DISK_B, O_RDONLY)) == -1)
 	{
 		Log_Debug("Failed to open %s disk image\n", DISK_A);
 		exit(-1);
 	}
 #else
-	if ((disk_drive.disk2.fp = open(DISK_B, O_RDWR)) == -1)
+	if ((altair.disk_drive.disk2.fp = open(DISK_B, O_RDWR)) == -1)
 	{
 		Log_Debug("Failed to open %s disk image\n", DISK_B);
 		exit(-1);
 	}
 #endif // ALTAIR_CLOUD
-	disk_drive.disk2.diskPointer = 0;
-	disk_drive.disk2.sector      = 0;
-	disk_drive.disk2.track       = 0;
+	altair.disk_drive.disk2.diskPointer = 0;
+	altair.disk_drive.disk2.sector      = 0;
+	altair.disk_drive.disk2.track       = 0;
 
-	i8080_reset(&cpu, (port_in)terminal_read, (port_out)terminal_write, sense, &disk_controller,
-		(azure_sphere_port_in)io_port_in, (azure_sphere_port_out)io_port_out);
+#ifdef ALTAIR_DISK_IO_URING
+	if (disk_uring_init(&disk_uring))
+	{
+		altair.disk_drive.uring = &disk_uring;
+	}
+	else
+	{
+		Log_Debug("io_uring is not available, reading disk tracks with pread\n");
+	}
+#endif
 
-	// load Disk Loader at 0xff00
-	if (!loadRomImage(DISK_LOADER, 0xff00))
+#if defined(ALTAIR_DISK_WRITEBACK) && !defined(ALTAIR_CLOUD)
+	if (disk_writeback_start(&disk_writeback))
 	{
-		Log_Debug("Failed to open %s disk load ROM image\n", DISK_LOADER);
+		altair.disk_drive.writeback = &disk_writeback;
 	}
+#endif
 
-	i8080_examine(&cpu, 0xff00); // 0xff00 loads from disk, 0x0000 loads basic
+#ifdef ALTAIR_DISK_MMAP
+#ifdef ALTAIR_CLOUD
+	bool writable = false; // writes go to the differencing disk
+#else
+	bool writable = true;
+#endif // ALTAIR_CLOUD
+	if (!disk_map_image(&altair.disk_drive.disk1, writable) || !disk_map_image(&altair.disk_drive.disk2, writable))
+	{
+		Log_Debug("Failed to map disk images, reading them through the file system\n");
+	}
+#endif // ALTAIR_DISK_MMAP
 
-	while (1)
+#ifdef ALTAIR_CLOUD
+	// A saved snapshot is already booted, take it as the golden image rather than waiting for the first prompt
+	if (altair_snapshot_load(&altair, ALTAIR_SNAPSHOT))
 	{
-		if (cpu_operating_mode == CPU_RUNNING)
+#ifdef ALTAIR_DIFFERENCE_JOURNAL
+		if (altair_golden_capture(&altair_golden, &altair))
 		{
-			i8080_cycle(&cpu);
+			journal_start();
 		}
+#else
+		altair_golden_capture(&altair_golden, &altair);
+#endif
+	}
+	else
+	{
+		// Boot headless, altair_slice_done takes the golden image at the first console prompt
+		load_boot_disk();
+		cpu_operating_mode = CPU_RUNNING;
+	}
+#else
+	// load Disk Loader at 0xff00 and point the CPU at it
+	load_boot_disk();
+#endif // ALTAIR_CLOUD
 
-		if (send_partial_msg)
+	if (!altair_scheduler_init(&altair_scheduler, ALTAIR_WORKERS, ALTAIR_MAX_MACHINES, CPU_RUN_BATCH) ||
+		(altair_scheduled = altair_scheduler_add(&altair_scheduler, &altair.cpu, &hooks, &altair)) == NULL ||
+		!altair_scheduler_start(&altair_scheduler))
+	{
+		Log_Debug("Failed to start the Altair scheduler\n");
+		exit(-1);
+	}
+}
+
+#ifdef ALTAIR_CLOUD
+/// <summary>
+/// Wait for the headless boot to reach the golden image. Without one a session would be cloned from whatever the
+/// previous session left, so give up on the process if the boot never gets to a console prompt.
+/// </summary>
+static void wait_for_golden_image(void)
+{
+	for (int waited_ms = 0; !atomic_load(&altair_golden.ready); waited_ms += GOLDEN_BOOT_POLL_MS)
+	{
+		if (waited_ms >= GOLDEN_BOOT_TIMEOUT_MS)
 		{
-			send_partial_message();
-			send_partial_msg = false;
+			Log_Debug("The Altair did not boot to a console prompt, there is no golden image to start sessions from\n");
+			exit(-1);
 		}
+		nanosleep(&(struct timespec){0, GOLDEN_BOOT_POLL_MS * ONE_MS}, NULL);
 	}
-
-	return NULL;
 }
+#endif // ALTAIR_CLOUD
 
 /// <summary>
 /// Report on first connect the software version and device startup UTC time
@@ -533,9 +734,14 @@ static void InitPeripheralAndHandlers(int argc, char *argv[])
 	}
 
 	dx_deviceTwinSubscribe(device_twin_bindings, NELEMS(device_twin_bindings));
-	init_web_socket_server(client_connected_cb);
 	dx_timerSetStart(timer_bindings, NELEMS(timer_bindings));
-	dx_startThreadDetached(altair_thread, NULL, "altair_thread");
+	altair_start();
+
+#ifdef ALTAIR_CLOUD
+	// Sessions are cloned from the golden image, take no connections until the headless boot has captured it
+	wait_for_golden_image();
+#endif
+	init_web_socket_server(client_connected_cb);
 
 #ifdef ALTAIR_FRONT_PANEL_PI_SENSE
 	dx_startThreadDetached(panel_refresh_thread, NULL, "panel_refresh_thread");
@@ -551,6 +757,41 @@ static void ClosePeripheralAndHandlers(void)
 	dx_deviceTwinUnsubscribe();
 	dx_timerEventLoopStop();
 
+	// Stop the CPU before anything it uses is torn down, nothing writes sectors after this. The scheduler is not
+	// destroyed, a late terminal wake from the web socket thread still finds its machine.
+	altair_scheduler_stop(&altair_scheduler);
+
+#if defined(ALTAIR_DISK_WRITEBACK) && !defined(ALTAIR_CLOUD)
+	// Let the I/O thread write what it has queued
+	if (altair.disk_drive.writeback != NULL)
+	{
+		if (!disk_writeback_stop(&disk_writeback))
+		{
+			Log_Debug("Disk write back stopped with sectors not written\n");
+		}
+	}
+#endif
+
+#ifdef ALTAIR_DISK_MMAP
+	// Sync what the CPU wrote through writable maps back to the images
+	disk_unmap_image(&altair.disk_drive.disk1);
+	disk_unmap_image(&altair.disk_drive.disk2);
+#endif
+
+#ifdef ALTAIR_DISK_IO_URING
+	// Let the track read aheads still in flight land, then tear the ring down
+	altair.disk_drive.uring = NULL;
+	disk_uring_close(&disk_uring);
+#endif
+
+#if defined(ALTAIR_DIFFERENCE_JOURNAL) && defined(ALTAIR_CLOUD)
+	// Sync what the journal has batched so the session survives the restart
+	if (altair.disk_drive.journal != NULL)
+	{
+		disk_journal_close(&disk_journal);
+	}
+#endif
+
 	curl_global_cleanup();
 }
 
@@ -17,6 +17,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/resource.h>
+#include <time.h>
 
 // Altair app
 #include "altair_config.h"
@@ -30,10 +31,17 @@
 
 // Intel 8080 emulator
 #include "88dcdd.h"
+#include "altair_golden.h"
+#include "altair_machine.h"
+#include "altair_scheduler.h"
 #include "intel8080.h"
 #include "io_ports.h"
 #include "memory.h"
 
+#ifdef ALTAIR_BLOCK_CACHE
+#include "block_cache.h"
+#endif
+
 #ifdef ALTAIR_FRONT_PANEL_PI_SENSE
 #include "front_panel_pi_sense_hat.h"
 #else
@@ -49,6 +57,18 @@ const char ALTAIR_EMULATOR_VERSION[] = "4.6.1";
 
 #define BASIC_SAMPLES_DIRECTORY "BasicSamples"
 
+// T-states run between checks of the CPU operating mode and pending partial messages when unthrottled
+#define CPU_RUN_BATCH 8000
+// Machines the scheduler has room for, and worker threads to run them on, 0 for one per host core. One, the web
+// socket server takes a single client (MAX_CLIENTS) so a process hosts one session and hosts scale out by
+// process. The ALTAIR_DIFFERENCE_DEDUP pool is per process, it shares sectors between the session, the golden
+// image and keys holding the same data, not across the sessions of other processes.
+#define ALTAIR_MAX_MACHINES 1
+#define ALTAIR_WORKERS      0
+// ALTAIR_CLOUD boots headless to the golden image before taking connections, giving up after this long
+#define GOLDEN_BOOT_TIMEOUT_MS 60000
+#define GOLDEN_BOOT_POLL_MS    10
+
 static const char *AltairMsg = "\x1b[2J\r\nAltair 8800 Emulator ";
 
 enum PANEL_MODE_T panel_mode = PANEL_BUS_MODE;
@@ -69,8 +89,27 @@ CPU_OPERATING_MODE cpu_operating_mode = CPU_STOPPED;
 ALTAIR_CONFIG_T altair_config;
 ENVIRONMENT_TELEMETRY environment;
 
-intel8080_t cpu;
-uint8_t memory[64 * 1024]; // Altair system memory.
+altair_machine_t altair; // CPU, memory and disks of the Altair this process runs
+altair_golden_t altair_golden; // ALTAIR_CLOUD sessions start from this, captured at the first console prompt
+
+// Runs the Altair on a pool of worker threads, parking it while it is idle, halted or stopped
+static altair_scheduler_t altair_scheduler;
+static scheduled_machine_t *altair_scheduled = NULL;
+
+#ifdef ALTAIR_DISK_IO_URING
+// Reads disk tracks ahead of the CPU, used only by the worker running the Altair
+static disk_uring_t disk_uring;
+#endif
+
+#if defined(ALTAIR_DISK_WRITEBACK) && !defined(ALTAIR_CLOUD)
+// Writes sectors to the disk image files off the CPU threads, cloud builds write to the differencing disk instead
+static disk_writeback_t disk_writeback;
+#endif
+
+#if defined(ALTAIR_DIFFERENCE_JOURNAL) && defined(ALTAIR_CLOUD)
+// Differencing disk writes of the current session, replayed over the golden image when the emulator restarts
+static disk_journal_t disk_journal;
+#endif
 
 ALTAIR_COMMAND cmd_switches;
 uint16_t bus_switches = 0x00;
@@ -97,12 +136,16 @@ static char Log_Debug_Time_buffer[128];
 static bool load_application(const char *fileName);
 static void send_terminal_character(char character, bool wait);
 static void spin_wait(bool *flag);
+static void terminal_input_ready(void);
 
 static DX_DECLARE_TIMER_HANDLER(heart_beat_handler);
 // static DX_DECLARE_TIMER_HANDLER(panel_refresh_handler);
 static DX_DECLARE_TIMER_HANDLER(report_memory_usage);
 static DX_DECLARE_TIMER_HANDLER(update_environment_handler);
-static void *altair_thread(void *arg);
+#ifdef ALTAIR_CPU_STATS
+static DX_DECLARE_TIMER_HANDLER(cpu_stats_sample_handler);
+#endif
+static void altair_start(void);
 
 const uint8_t reverse_lut[16] = {
 	0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf};
@@ -119,6 +162,9 @@ static DX_TIMER_BINDING tmr_heart_beat = {.repeat = &(struct timespec){60, 0}, .
 static DX_TIMER_BINDING tmr_report_memory_usage = {.repeat = &(struct timespec){45, 0}, .name = "tmr_report_memory_usage", .handler = report_memory_usage};
 static DX_TIMER_BINDING tmr_tick_count = {.repeat = &(struct timespec){1, 0}, .name = "tmr_tick_count", .handler = tick_count_handler};
 static DX_TIMER_BINDING tmr_update_environment = {.delay = &(struct timespec){2, 0}, .name = "tmr_update_environment", .handler = update_environment_handler};
+#ifdef ALTAIR_CPU_STATS
+static DX_TIMER_BINDING tmr_cpu_stats_sample = {.repeat = &(struct timespec){1, 0}, .name = "tmr_cpu_stats_sample", .handler = cpu_stats_sample_handler};
+#endif
 
 DX_ASYNC_BINDING async_copyx_request = {.name = "async_copyx_request", .handler = async_copyx_request_handler};
 DX_ASYNC_BINDING async_expire_session = { .name = "async_expire_session", .handler = async_expire_session_handler};
@@ -154,6 +200,9 @@ DX_DEVICE_TWIN_BINDING dt_country = {.propertyName = "Country", .twinType = DX_D
 DX_DEVICE_TWIN_BINDING dt_location = {.propertyName = "Location", .twinType = DX_DEVICE_TWIN_JSON_OBJECT};
 
 DX_DEVICE_TWIN_BINDING dt_filesystem_reads = {.propertyName = "FilesystemReads", .twinType = DX_DEVICE_TWIN_INT};
+DX_DEVICE_TWIN_BINDING dt_mapped_reads = {.propertyName = "MappedReads", .twinType = DX_DEVICE_TWIN_INT};
+DX_DEVICE_TWIN_BINDING dt_track_cache_hits = {.propertyName = "TrackCacheHits", .twinType = DX_DEVICE_TWIN_INT};
+DX_DEVICE_TWIN_BINDING dt_track_cache_misses = {.propertyName = "TrackCacheMisses", .twinType = DX_DEVICE_TWIN_INT};
 DX_DEVICE_TWIN_BINDING dt_difference_disk_reads = {.propertyName = "DifferenceDiskReads", .twinType = DX_DEVICE_TWIN_INT};
 DX_DEVICE_TWIN_BINDING dt_difference_disk_writes = {.propertyName = "DifferenceDiskWrites", .twinType = DX_DEVICE_TWIN_INT};
 DX_DEVICE_TWIN_BINDING dt_new_sessions = {.propertyName = "NewSessions", .twinType = DX_DEVICE_TWIN_INT};
@@ -161,6 +210,14 @@ DX_DEVICE_TWIN_BINDING dt_new_sessions = {.propertyName = "NewSessions", .twinTy
 static DX_DEVICE_TWIN_BINDING dt_deviceStartTimeUtc = {.propertyName = "StartTimeUTC", .twinType = DX_DEVICE_TWIN_STRING};
 static DX_DEVICE_TWIN_BINDING dt_heartbeatUtc = {.propertyName = "HeartbeatUTC", .twinType = DX_DEVICE_TWIN_STRING};
 static DX_DEVICE_TWIN_BINDING dt_softwareVersion = {.propertyName = "SoftwareVersion", .twinType = DX_DEVICE_TWIN_STRING};
+#ifdef ALTAIR_CPU_STATS
+static DX_DEVICE_TWIN_BINDING dt_cpu_mips = {.propertyName = "CpuMips", .twinType = DX_DEVICE_TWIN_FLOAT};
+static DX_DEVICE_TWIN_BINDING dt_cpu_clock_mhz = {.propertyName = "CpuClockMHz", .twinType = DX_DEVICE_TWIN_FLOAT};
+#endif
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+static DX_DEVICE_TWIN_BINDING dt_difference_pool_sectors = {.propertyName = "DifferencePoolSectors", .twinType = DX_DEVICE_TWIN_INT};
+static DX_DEVICE_TWIN_BINDING dt_difference_pool_references = {.propertyName = "DifferencePoolReferences", .twinType = DX_DEVICE_TWIN_INT};
+#endif
 // clang-format on
 
 static DX_ASYNC_BINDING *async_bindings[] = {
@@ -183,6 +240,9 @@ static DX_TIMER_BINDING *timer_bindings[] = {
 	&tmr_timer_seconds_expired,
 	&tmr_update_environment,
 	&tmr_ws_ping_pong,
+#ifdef ALTAIR_CPU_STATS
+	&tmr_cpu_stats_sample,
+#endif
 };
 
 static DX_DEVICE_TWIN_BINDING *device_twin_bindings[] = {
@@ -210,7 +270,18 @@ static DX_DEVICE_TWIN_BINDING *device_twin_bindings[] = {
 	&dt_pm10,
 
 	&dt_filesystem_reads,
+	&dt_mapped_reads,
+	&dt_track_cache_hits,
+	&dt_track_cache_misses,
 	&dt_difference_disk_reads,
 	&dt_difference_disk_writes,
 	&dt_new_sessions,
+#ifdef ALTAIR_CPU_STATS
+	&dt_cpu_mips,
+	&dt_cpu_clock_mhz,
+#endif
+#ifdef ALTAIR_DIFFERENCE_DEDUP
+	&dt_difference_pool_sectors,
+	&dt_difference_pool_references,
+#endif
 };
@@ -53,11 +53,25 @@ static void cleanup_session(void)
 #ifdef ALTAIR_CLOUD
 	cpu_operating_mode = CPU_STOPPED;
 
-	// Sleep this thread so the Altair CPU thread can complete current instruction
-	nanosleep(&(struct timespec){0, 250 * ONE_MS}, NULL);
+	// Wait for the worker running the Altair to finish its slice, nothing runs it until the state is replaced
+	altair_park();
 
-	load_boot_disk();
-	clear_difference_disk();
+	// Start the next session from the golden image or a saved snapshot, else cold boot from the disk loader
+	if (!altair_golden_clone(&altair_golden, &altair) && !altair_snapshot_load(&altair, ALTAIR_SNAPSHOT))
+	{
+		load_boot_disk();
+		clear_difference_disk(&altair.disk_drive);
+	}
+
+#ifdef ALTAIR_DIFFERENCE_JOURNAL
+	// The session's writes are gone, a restart must not bring them back
+	if (altair.disk_drive.journal != NULL)
+	{
+		disk_journal_clear(altair.disk_drive.journal);
+	}
+#endif
+
+	altair_unpark();
 #endif
 	cleanup_required = false;
 }
@@ -173,6 +187,7 @@ DX_TIMER_HANDLER(partial_message_handler)
 	if (output_buffer_length)
 	{
 		send_partial_msg = true;
+		altair_wake();
 	}
 }
 DX_TIMER_HANDLER_END
\ No newline at end of file